@@ -0,0 +1,65 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "hashstore.h"
+
+// Limits that keep a hostile archive from costing more than a big file
+const int MAX_ARCHIVE_DEPTH = 3;                        // archives inside archives
+const uint64_t MAX_ARCHIVE_BYTES = 1ull << 30;          // decompressed, per outer file,
+const uint64_t MAX_ARCHIVE_EXPANSION = 16;              // plus this much per byte of it
+const uint64_t MAX_COMPRESSION_RATIO = 100;             // per member or stream
+const size_t MAX_ARCHIVE_MEMBERS = 1 << 16;             // per outer file
+// Members up to this size are kept in memory while they stream past, so
+// nested archives can be opened and YARA conditions can read back
+const uint64_t MAX_BUFFERED_MEMBER = 64ull << 20;
+
+// On by default; --skip-archives turns member scanning off
+extern std::atomic<bool> scan_archives;
+
+// One member, hashed. `path` reads "outer.zip!dir/inner.jar!a.class".
+struct ArchiveMember {
+    std::string path;
+    FileDigests digests;
+};
+
+// What one archive cost and what the limits cut short
+struct ArchiveStats {
+    size_t members = 0;         // hashed
+    size_t skipped = 0;         // encrypted, unreadable, no decoder, or not executable content
+    size_t limited = 0;         // cut short by a limit above
+    bool outer_hashed = false;  // the archive's own digests were taken on the way
+};
+
+// What scan_archive would open a file as, judged from its first bytes
+enum class ArchiveKind {
+    None,
+    Zip,
+    Stream,         // tar, ar, cpio, RPM, gzip/xz/zstd: read front to back
+    DiskImage       // maybe; only opening it tells for sure
+};
+
+// `head` is the first STREAM_SNIFF_SIZE bytes of the `size`-byte file, or
+// all of a shorter one. Lets a caller that has read them anyway decide
+// without opening the file again.
+ArchiveKind sniff_archive(const unsigned char* head, size_t len, uint64_t size);
+
+// Streams every member of the archive at `path` through the `algos`
+// digests and the content engines without extracting anything to disk,
+// and the members of archives inside it. Calls `visit` for each member
+// hashed. With `executables_only`, members whose head isn't executable
+// content are skipped as in a quick scan.
+//
+// ZIP (JAR, APK, OOXML, ...) is opened through libzip. tar, ar (.deb),
+// cpio, RPM and gzip/xz/zstd streams of them are read front to back in one
+// sequential pass, and with `outer` the archive's own digests are taken in
+// that same pass. Returns false if `path` isn't an archive.
+bool scan_archive(const std::string& path, unsigned algos, bool executables_only,
+                  const std::function<void(const ArchiveMember&)>& visit, ArchiveStats& stats,
+                  FileDigests* outer = nullptr);
+
+#endif
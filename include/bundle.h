@@ -0,0 +1,71 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include "hashstore.h"
+#include "dedup.h"
+
+// A verdict bundle lists the digests of every file of a reference tree
+// (a golden image) so that hosts cloned from it don't hash those files
+// again. One line per path, tab separated:
+//
+//   sha256 sha1 md5 fingerprint size mtime_ns ctime_ns inode entropy path
+//
+// `entropy` is "-" for anything but a native executable, otherwise
+// "file,max_window,windows,high_windows" as in EntropyStats. Lines are
+// sorted by sha256, so identical content sits together. The inode and
+// ctime only hold on block-level clones of the image; a file copied any
+// other way is hashed as usual.
+const std::string BUNDLE_HEADER = "# verdict bundle v3";
+
+struct FileHead;
+
+// SHA-256 over the size and a few 4 KiB blocks spread over the file.
+// Cheap to recompute and independent of where the file lives. The first
+// block starts the file, so `head` is filled from it when given.
+std::string sample_fingerprint(int fd, uint64_t size, FileHead* head = nullptr);
+
+// Hashes every regular file under `root` into a bundle at `file`. Paths
+// are recorded relative to `root`, so an image mounted anywhere on the build
+// machine yields the paths its clones will see. Returns false and sets msg
+// on failure.
+bool export_bundle(const std::string& root, const std::string& file);
+
+// Digests imported from a bundle, consulted before a file is hashed
+class BundleIndex {
+public:
+    // Returns false and sets msg if `file` isn't a readable bundle
+    bool load(const std::string& file);
+
+    // Fills `out` if some path of `target` is in the bundle with the same
+    // size, mtime, ctime and inode, its fingerprint still matches, and the
+    // bundle has every algorithm in `algos`. Anything else is left to the
+    // full hash. `head` gets the file's first bytes when the fingerprint
+    // read them, so an archive on the image is still walked.
+    bool lookup(const ScanTarget& target, unsigned algos, FileDigests& out, FileHead* head = nullptr) const;
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        uint32_t content;       // index into `contents`
+        uint64_t size;
+        int64_t mtime_ns;
+        int64_t ctime_ns;       // any write since the image was built moves it
+        uint64_t ino;
+    };
+    struct Content {
+        FileDigests digests;
+        std::string fingerprint;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::vector<Content> contents;
+};
+
+extern BundleIndex imported_bundle;
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef BYTESTREAM_H
+#define BYTESTREAM_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Pull-based byte streams that stack: a file, a member's slice of another
+// stream, decompressors on top of either. Archives inside compressed
+// archives inside archives are read front to back, without temp files and
+// with memory bounded by the buffers of each layer.
+class ByteStream {
+public:
+    virtual ~ByteStream() = default;
+    // Reads up to `len` bytes; returns 0 at the end and -1 on error
+    virtual ssize_t read(unsigned char* out, size_t len) = 0;
+};
+
+// Reads until `len` bytes are in or the stream ends. Returns the count or -1.
+ssize_t read_full(ByteStream& in, unsigned char* out, size_t len);
+// Reads and discards `len` bytes; false if the stream ends or fails first
+bool skip_bytes(ByteStream& in, uint64_t len);
+
+// What the decompressing streams of one walk may produce together:
+// `remaining` bytes in all, and past the first MiB of each stream no more
+// than `ratio` bytes out per byte in
+struct InflateLimit {
+    uint64_t remaining = 0;
+    uint64_t ratio = 0;
+    size_t refused = 0;         // streams stopped by the limit
+
+    // Accounts `produced` more bytes; false once a stream went too far
+    bool charge(uint64_t produced, uint64_t in_total, uint64_t out_total);
+};
+
+// An open descriptor, read sequentially from its current position
+class FdStream : public ByteStream {
+public:
+    explicit FdStream(int fd);
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    int fd;
+};
+
+// Bytes already in memory
+class MemoryStream : public ByteStream {
+public:
+    MemoryStream(const unsigned char* data, size_t len) : data(data), len(len) {}
+    ssize_t read(unsigned char* out, size_t want) override;
+
+private:
+    const unsigned char* data;
+    size_t len;
+    size_t pos = 0;
+};
+
+// Bytes already read from `rest` (to sniff its format) put back in front
+class PrefixStream : public ByteStream {
+public:
+    PrefixStream(std::vector<unsigned char> head, ByteStream& rest) : head(std::move(head)), rest(rest) {}
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    std::vector<unsigned char> head;
+    size_t pos = 0;
+    ByteStream& rest;
+};
+
+// The next `size` bytes of `parent`: one archive member's body. Ending
+// early is an error.
+class SliceStream : public ByteStream {
+public:
+    SliceStream(ByteStream& parent, uint64_t size) : parent(parent), left(size) {}
+    ssize_t read(unsigned char* out, size_t len) override;
+    uint64_t remaining() const { return left; }
+
+private:
+    ByteStream& parent;
+    uint64_t left;
+};
+
+// gzip (and zlib) data, concatenated members included
+class GzipStream : public ByteStream {
+public:
+    GzipStream(ByteStream& in, InflateLimit& limit);
+    ~GzipStream() override;
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// xz (and lzma-alone) data, concatenated streams included
+class XzStream : public ByteStream {
+public:
+    XzStream(ByteStream& in, InflateLimit& limit);
+    ~XzStream() override;
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// zstd frames, one after another, inflated as they are read
+class ZstdStream : public ByteStream {
+public:
+    ZstdStream(ByteStream& in, InflateLimit& limit);
+    ~ZstdStream() override;
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// What a stream holds, judged from its first bytes
+enum class StreamFormat {
+    Unknown,
+    Gzip,
+    Xz,
+    Zstd,
+    Bzip2,          // recognised, but no decoder is linked
+    Tar,            // ustar, pax and GNU, and v7 by its checksum
+    Ar,             // .deb, static libraries
+    Cpio,           // newc, as in RPM payloads and initramfs
+    Rpm,
+    Zip
+};
+
+// Enough of the head for every check below
+const size_t STREAM_SNIFF_SIZE = 512;
+
+StreamFormat sniff_stream_format(const unsigned char* head, size_t len);
+
+// True if the 512-byte `block` carries a valid tar header checksum
+bool tar_checksum_ok(const unsigned char* block);
+
+bool is_compressed_format(StreamFormat format);
+
+#endif
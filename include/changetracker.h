@@ -0,0 +1,106 @@
+#ifndef CHANGETRACKER_H
+#define CHANGETRACKER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <ctime>
+
+// Watches a tree in the background and keeps the set of paths that changed
+// since the last full walk, so a rescan only has to look at those.
+//
+// Uses fanotify filesystem marks with FAN_REPORT_DFID_NAME where permitted
+// (CAP_SYS_ADMIN) and recursive inotify otherwise. Any lost event (queue
+// overflow, watch limit) marks the set incomplete and forces a full walk.
+class ChangeTracker {
+public:
+    ~ChangeTracker();
+
+    // Starts watching `root`. `state_file` is rewritten every few seconds
+    // so that another process can pick the dirty set up.
+    bool start(const std::string& root, const std::string& state_file);
+    void stop();
+    bool running() const { return worker.joinable(); }
+    std::string backend() const;
+
+    // Bracket a full walk of `root`. Only once it has finished do events
+    // become relative to it: paths changed before it started are dropped
+    // and it becomes the baseline. A walk that never ends changes nothing.
+    void begin_full_walk(const std::string& root);
+    void end_full_walk(const std::string& root);
+
+    // Copies the changed paths under `root` into `out`, and the time they
+    // were taken into `as_of`. Returns false when no complete set is
+    // available and a full walk is needed instead.
+    bool peek_dirty(const std::string& root, std::vector<std::string>& out, time_t& as_of);
+    // Drops the paths under `root` last changed before `as_of`, once a
+    // scan has looked at them
+    void drop_dirty(const std::string& root, time_t as_of);
+
+private:
+    enum class Backend { None, Fanotify, Inotify };
+
+    void run();
+    bool start_fanotify();
+    bool start_inotify();
+    void add_inotify_tree(const std::string& dir);
+    void read_fanotify();
+    void read_inotify();
+    void mark_dirty(const std::string& path);
+    void save_state();
+
+    Backend mode = Backend::None;
+    int notify_fd = -1;
+    int stop_fd = -1;
+    std::thread worker;
+    std::string root;
+    std::string state_path;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, time_t> dirty;  // path -> time of last change
+    std::string baseline;       // root of the last full walk, "" if none yet
+    bool overflowed = false;    // events were lost since the baseline walk
+    bool incomplete = false;    // some part of the tree could not be watched at all
+    bool watching = false;      // all marks/watches are in place
+
+    // The full walk in progress: its root, start, and what it will leave behind
+    std::string walk_root;
+    time_t walk_started = 0;
+    bool walk_overflowed = false;   // events were lost since it started
+    bool walk_watching = false;     // every watch was in place when it started
+
+    std::map<std::pair<int, int>, int> mount_fds;   // fanotify: fsid -> fd on that filesystem
+    std::unordered_map<int, std::string> watches;   // inotify: wd -> directory
+};
+
+extern ChangeTracker change_tracker;
+
+// Where trackers publish their dirty set
+const std::string TRACKER_STATE_FILE = "dirty.txt";
+
+// Mount points of real filesystems under `root`, plus the one holding `root`
+// itself; proc, sysfs, cgroup and similar pseudo filesystems are left out
+std::vector<std::string> local_mounts(const std::string& root);
+
+// Changed paths a scan took from a tracker. They stay the tracker's until
+// consume_tracked_changes() says the scan is done with them.
+struct TrackedChanges {
+    std::vector<std::string> paths;
+    std::string root;
+    std::string state_file;     // set when they came from another process's tracker
+    time_t as_of = 0;
+};
+
+// Changed paths under `root` from the in-process tracker or, failing that,
+// from a fresh state file written by another process's tracker. Returns
+// false if a full walk is needed. Nothing is taken from the tracker yet.
+bool tracked_changes(const std::string& root, const std::string& state_file, TrackedChanges& out);
+// Tells the tracker `changes` were scanned, so it stops reporting them.
+// Call only after every one of them was looked at.
+void consume_tracked_changes(const TrackedChanges& changes);
+
+#endif
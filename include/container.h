@@ -0,0 +1,54 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <filesystem>
+#include <sys/types.h>
+
+// Scan running containers through their overlay layers on Fullscan
+extern std::atomic<bool> scan_containers;
+
+// One running container, as found through one of its processes
+struct Container {
+    std::string id;                         // first 12 hex digits, as docker ps shows it
+    pid_t pid = 0;
+    std::vector<std::string> lower_dirs;    // image layers, often shared with other containers
+    std::string upper_dir;                  // its own writable layer
+    std::string root;                       // walked instead when its layers aren't reachable from here
+};
+
+// Containers found from /proc: the cgroup of each process names its
+// container, its mountinfo the overlay layers behind its root. Image layers
+// are walked once however many containers stack them, so their files keep
+// their own (dev, ino) and fold together; the overlay views of the same
+// files (merged mounts, /proc/<pid>/root) are left out of the walk.
+class ContainerIndex {
+public:
+    // Rereads /proc. Returns false and sets msg if it can't be read.
+    bool discover();
+
+    const std::vector<Container>& containers() const { return found; }
+
+    // Layer directories to walk: each shared image layer once, then every upper dir
+    std::vector<std::string> layer_dirs() const;
+
+    // True if `dir` only shows files of a container another way: a merged
+    // overlay mount or a container process's /proc/<pid>/root
+    bool pruned(const std::string& dir) const { return pruned_dirs.count(dir) > 0; }
+
+    // IDs of the containers whose layers hold `path`
+    std::vector<std::string> owners(const std::filesystem::path& path) const;
+
+private:
+    std::vector<Container> found;
+    std::unordered_map<std::string, std::vector<std::string>> layer_owners;
+    std::unordered_set<std::string> pruned_dirs;
+};
+
+extern ContainerIndex container_index;
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <filesystem>
+#include <cstdint>
+#include <sys/stat.h>
+
+// One unit of hashing work: a file content and every path that reaches it
+struct ScanTarget {
+    std::filesystem::path path;                     // the path that gets read
+    std::vector<std::filesystem::path> aliases;     // hardlinks and reflinked copies
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    int64_t ctime_ns = 0;
+    uint32_t mode = 0;
+
+    ScanTarget() = default;
+    ScanTarget(const std::filesystem::path& p, const struct stat& st);
+};
+
+// Compare shared extent maps (FIEMAP) to fold reflinked copies together
+extern std::atomic<bool> reflink_dedup;
+
+// Folds paths that reach the same content into one ScanTarget: identical
+// (dev, ino) for hardlinks and, with reflink_dedup, identical physical
+// extent maps for reflinked copies on btrfs/XFS.
+class ContentDeduper {
+public:
+    // Returns false if this exact path was already added
+    bool add(const std::filesystem::path& path, const struct stat& st);
+
+    // Number of paths folded into an earlier target so far
+    size_t folded() const { return folded_paths; }
+
+    std::vector<ScanTarget> take();
+
+private:
+    std::map<std::pair<uint64_t, uint64_t>, size_t> by_inode;
+    std::unordered_map<std::string, size_t> by_extents;
+    std::vector<ScanTarget> targets;
+    size_t folded_paths = 0;
+};
+
+// Key describing the file's physical extents, or "" when the file has no
+// shared extents or its map can't be trusted (inline, delalloc, encoded)
+std::string extent_fingerprint(const std::string& path, const struct stat& st);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DIRSUMMARY_H
+#define DIRSUMMARY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+
+// Where full walks persist their directory summaries
+const std::string DIR_SUMMARY_FILE = "dirsummary.txt";
+
+// Per-directory digests of the regular files' (name, inode, size, mtime,
+// ctime), remembered from the last full walk whose files all came back
+// clean. A directory whose digest still matches under the same database
+// generation has nothing new to hash.
+class DirSummaryCache {
+public:
+    // Reads `file`; a file written for another database generation is ignored
+    bool load(const std::string& file, uint64_t db_generation);
+    bool save(const std::string& file) const;
+
+    // Digest recorded for `dir`, "" if none
+    std::string find(const std::string& dir) const;
+
+    // Records from this walk. `dir` is dropped again if invalidate() is
+    // called for it before commit().
+    void stage(const std::string& dir, const std::string& digest);
+    // A file under `dir` matched or could not be read; safe from any thread
+    void invalidate(const std::string& dir);
+    // Replaces every record under `root` with the surviving staged ones
+    void commit(const std::string& root);
+
+private:
+    uint64_t generation = 0;
+    std::unordered_map<std::string, std::string> records;
+    std::unordered_map<std::string, std::string> staged;
+    std::unordered_set<std::string> invalid;
+    mutable std::mutex mutex;
+};
+
+extern DirSummaryCache dir_summaries;
+
+// The regular files of one full walk grouped by directory
+class DirWalk {
+public:
+    void add_file(const std::string& path, const struct stat& st);
+
+    // Stages a summary for every directory seen and passes on the files of
+    // those whose digest differs from `cache`. Returns the number of files
+    // in unchanged directories.
+    size_t resolve(DirSummaryCache& cache,
+                   const std::function<void(const std::string&, const struct stat&)>& changed);
+
+    size_t directories() const { return dirs.size(); }
+    size_t unchanged_directories() const { return unchanged_dirs; }
+
+private:
+    struct Entry {
+        std::string path;
+        struct stat st;
+    };
+
+    std::unordered_map<std::string, std::vector<Entry>> dirs;
+    size_t unchanged_dirs = 0;
+};
+
+#endif
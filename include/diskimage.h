@@ -0,0 +1,59 @@
+#ifndef DISKIMAGE_H
+#define DISKIMAGE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "bytestream.h"
+
+// squashfs: the block sizes of a file with no fragment tail
+const uint32_t NO_FRAGMENT = 0xffffffff;
+
+// A contiguous run of a file's bytes in the image
+struct ImageExtent {
+    uint64_t start;
+    uint64_t length;
+};
+
+// A regular file inside a disk image
+struct ImageFile {
+    std::string path;
+    uint64_t size = 0;
+    uint64_t start = 0;                 // first byte of its data in the image
+    std::vector<ImageExtent> extents;   // ISO9660: every run of its data, in order
+    std::vector<uint32_t> blocks;       // squashfs: stored size of each data block
+    uint32_t fragment = NO_FRAGMENT;    // squashfs: fragment block holding the tail
+    uint32_t fragment_offset = 0;
+};
+
+// Read-only ISO9660 (with Joliet names) and squashfs readers, so installer
+// ISOs, snaps and AppImages are scanned without mounting them. Everything
+// is read with pread on the image's descriptor.
+class DiskImage {
+public:
+    virtual ~DiskImage() = default;
+
+    virtual const char* format() const = 0;
+
+    // Lists every regular file. Returns false if part of the directory tree
+    // is damaged; what could be listed is still in `files`.
+    virtual bool list(std::vector<ImageFile>& files) = 0;
+
+    // Reads one listed file front to back, charging what it produces to
+    // `limit`. Files may be read from several threads at once.
+    virtual std::unique_ptr<ByteStream> open_file(const ImageFile& file, InflateLimit& limit) = 0;
+};
+
+// Recognises an ISO9660 image, or a squashfs image at the start of the
+// file or behind an AppImage runtime, in the `size`-byte file behind `fd`.
+// Returns nullptr if there is none or it is one this build can't read
+// (squashfs compressed with lz4 or lzo).
+std::unique_ptr<DiskImage> open_disk_image(int fd, uint64_t size);
+
+// False if a `size`-byte file whose first bytes are `head` can't be one of
+// the images above, so most files are ruled out without another read. An
+// ISO's own magic lies 32 KiB in; its system area is zeros or a boot record.
+bool may_be_disk_image(const unsigned char* head, size_t len, uint64_t size);
+
+#endif
@@ -27,6 +27,14 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
  */
 bool downloadHashFile(const std::string& url, const std::string& outputPath);
 
+/**
+ * @brief Downloads one hash feed, keeping the previous copy if it fails
+ * @param url Source URL to download from
+ * @param outputPath Local path of the hash list
+ * @return true if the download succeeded, false otherwise
+ */
+bool updateHashFile(const std::string& url, const std::string& outputPath);
+
 /**
  * @brief Updates the hash database by downloading the latest hashes
  * @return true if update was successful, false otherwise
@@ -46,6 +54,12 @@ bool extractZipFile(const void* zipData, size_t zipSize, const std::string& outp
 namespace DownloadConfig {
     const std::string SHA256_FULL_URL = "https://bazaar.abuse.ch//export/txt/sha256/full/";
     const std::string DEFAULT_OUTPUT_PATH = "full_sha256.txt";
+    const std::string SHA1_FULL_URL = "https://bazaar.abuse.ch//export/txt/sha1/full/";
+    const std::string SHA1_OUTPUT_PATH = "full_sha1.txt";
+    const std::string MD5_FULL_URL = "https://bazaar.abuse.ch//export/txt/md5/full/";
+    const std::string MD5_OUTPUT_PATH = "full_md5.txt";
+    // Optional local signatures with sample sizes (.hdb/.hsb/.csv)
+    const std::string LOCAL_DB_DIR = "db";
     const std::string USER_AGENT = "Mozilla/5.0";
 }
 
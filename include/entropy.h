@@ -0,0 +1,61 @@
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Entropy is measured per window of this many bytes as well as per file, so
+// a packed payload inside an otherwise ordinary binary still stands out
+const size_t ENTROPY_WINDOW = 64 * 1024;
+// Bits per byte. Compiled code sits around 5.5-6.5; compressed or encrypted
+// data is close to 8.
+const double PACKED_FILE_ENTROPY = 7.2;
+const double HIGH_WINDOW_ENTROPY = 7.6;
+
+// Byte entropy of a native executable. `measured` is false for anything
+// else, and for files hashed without their bytes passing through us.
+struct EntropyStats {
+    bool measured = false;
+    double file = 0;            // bits per byte over the whole file
+    double max_window = 0;
+    uint32_t windows = 0;       // full windows, plus a last one of at least a quarter
+    uint32_t high_windows = 0;  // of those, at or above HIGH_WINDOW_ENTROPY
+
+    // Packed or encrypted by the look of it: high entropy overall, or in
+    // at least half of a file of several windows
+    bool suspicious() const;
+};
+
+// True if a file starting with `head` is a native executable, the only
+// kind EntropyMeter measures. The magic is in the first few bytes.
+bool entropy_measures(const unsigned char* head, size_t len);
+
+// Byte histograms of the buffers a hash pass reads anyway, from a fixed
+// sample of each window. The first bytes decide whether the file is a
+// native executable; for anything else update() returns at once.
+class EntropyMeter {
+public:
+    EntropyMeter();
+    void update(const unsigned char* data, size_t len);
+    EntropyStats finish() const;
+
+private:
+    void measure(const unsigned char* data, size_t len);
+    void count(const unsigned char* data, size_t len);
+    void close_window();
+
+    std::vector<unsigned char> head;    // held until there's enough to sniff
+    bool sniffed = false;
+    bool measuring = false;
+
+    // Four interleaved histograms of the current window, so consecutive
+    // bytes of the same value don't wait on each other's increments
+    uint32_t window[4][256];
+    size_t window_fill = 0;
+    uint64_t total[256];
+    uint64_t offset = 0;        // bytes measured so far
+    EntropyStats stats;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include <string>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+// Result of streaming a file through a chunk consumer
+enum class ReadStatus {
+    Ok,
+    OpenFailed,
+    ReadFailed,
+    Aborted     // the consumer returned false
+};
+
+// How scans interact with the page cache
+enum class CacheMode {
+    Normal,         // plain buffered reads
+    DropAfterRead,  // evict pages the scan brought in once they are hashed
+    Direct          // O_DIRECT into aligned buffers, DropAfterRead where refused
+};
+
+extern std::atomic<CacheMode> cache_mode;
+
+// Called once per chunk, in file order. Return false to stop reading early.
+using ChunkConsumer = std::function<bool(const unsigned char* data, size_t len)>;
+
+// Chunk size used for every read and the size above which reads are
+// double-buffered on a separate thread
+const size_t READ_CHUNK_SIZE = 1 << 20;
+const uint64_t PIPELINE_THRESHOLD = 8ull << 20;
+const size_t READ_ALIGNMENT = 4096;
+
+// Opens a file read-only with the flags the current cache_mode asks for.
+// Returns -1 on failure.
+int open_for_scan(const std::string& path);
+
+// Streams the file at `path` through `consume`. Files larger than
+// PIPELINE_THRESHOLD are read ahead on a helper thread so that disk wait and
+// the consumer's work overlap.
+ReadStatus read_file_chunks(const std::string& path, const ChunkConsumer& consume);
+
+// Same as above for bytes [offset, size) of an already opened descriptor;
+// anything appended past `size` meanwhile is not read. The descriptor is
+// not closed.
+ReadStatus read_fd_chunks(int fd, uint64_t offset, uint64_t size, const ChunkConsumer& consume);
+
+// For readers that can't go through read_fd_chunks, such as archive walks:
+// outside CacheMode::Normal, evicts on destruction the pages of the
+// `size`-byte file behind `fd` that weren't cached when it was constructed.
+// `fd` must stay open until then.
+class PageCacheGuard {
+public:
+    PageCacheGuard(int fd, uint64_t size);
+    ~PageCacheGuard();
+    PageCacheGuard(const PageCacheGuard&) = delete;
+    PageCacheGuard& operator=(const PageCacheGuard&) = delete;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FILETYPE_H
+#define FILETYPE_H
+
+#include <string>
+#include <cstddef>
+
+// What a file is, judged from its first bytes
+enum class FileType {
+    Unknown,
+    Elf,
+    Pe,             // MZ executables and DLLs
+    MachO,          // including fat binaries
+    JavaClass,
+    Script,         // anything with a #! line
+    Jar,
+    Apk,
+    Dex,
+    OfficeOle,      // Office 97-2003 compound files (VBA macros)
+    OfficeXml,      // OOXML/ODF packages (vbaProject.bin, Basic macros)
+    Zip,            // any other zip
+    Media,          // images, audio, video
+    Pdf
+};
+
+// Enough of the head for every signature and the first zip entry name
+const size_t SNIFF_SIZE = 4096;
+
+// Classifies `len` bytes from the start of a file
+FileType sniff_file_type(const unsigned char* head, size_t len);
+
+const char* file_type_name(FileType type);
+
+// Types a quick scan hashes: native and managed executables, scripts,
+// and documents able to carry macros
+bool is_executable_type(FileType type);
+
+#endif
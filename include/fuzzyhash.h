@@ -0,0 +1,90 @@
+#ifndef FUZZYHASH_H
+#define FUZZYHASH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+
+// TLSH with 128 buckets and a 1-byte checksum: "T1" and 70 hex digits
+const size_t TLSH_CODE_SIZE = 32;       // 128 buckets at 2 bits each
+const uint64_t TLSH_MIN_LENGTH = 50;
+// A file this close to a known sample counts as a variant of it. TLSH
+// distances start at 0 for identical digests and grow without bound.
+const int FUZZY_MATCH_DISTANCE = 40;
+
+// A parsed TLSH digest
+struct TlshDigest {
+    uint8_t checksum = 0;
+    uint8_t lvalue = 0;         // log-scaled length
+    uint8_t q1_ratio = 0;
+    uint8_t q2_ratio = 0;
+    uint8_t code[TLSH_CODE_SIZE] = {};
+
+    // Takes the hex form, with or without the "T1" prefix
+    static bool parse(const std::string& hex, TlshDigest& out);
+    std::string hex() const;
+};
+
+// TLSH distance, length difference included. Stops adding up once past
+// `cutoff` and returns what it had then.
+int tlsh_distance(const TlshDigest& a, const TlshDigest& b, int cutoff = INT_MAX);
+
+// Builds a TLSH digest from bytes streamed through update(), so it rides
+// along the read the other digests already make
+class FuzzyDigest {
+public:
+    void update(const unsigned char* data, size_t len);
+    // The digest, or "" if the input was too short or too uniform for one
+    std::string finish() const;
+
+private:
+    uint32_t buckets[256] = {};
+    uint8_t window[4] = {};     // the last bytes seen, newest first
+    uint8_t checksum = 0;
+    uint64_t length = 0;
+};
+
+struct FuzzyHit {
+    std::string name;
+    int distance = 0;
+};
+
+// Fuzzy digests of known samples. Lookups go through locality-sensitive
+// buckets: each of LSH_TABLES tables keys a digest by a different handful
+// of its 2-bit bucket codes, so a near variant shares a key with it in
+// some table while an unrelated digest rarely does. Only digests sharing
+// a key are compared in full.
+class FuzzyIndex {
+public:
+    // `name` is what a match reports; false if `digest` isn't TLSH
+    bool add(const std::string& digest, const std::string& name);
+    // Sorts the buckets; call once after loading
+    void build();
+
+    // The closest known digest within FUZZY_MATCH_DISTANCE of `digest`
+    bool nearest(const std::string& digest, FuzzyHit& hit) const;
+
+    bool empty() const { return digests.empty(); }
+    size_t size() const { return digests.size(); }
+
+private:
+    // Each of the 128 codes keys 3 tables. A variant at FUZZY_MATCH_DISTANCE
+    // that got there by 40 one-step code changes, the spread-out worst
+    // case, still shares a key in 99.98% of cases; 4096 buckets per table
+    // leave about 1.6% of unrelated digests compared.
+    static const size_t LSH_TABLES = 64;
+    static const size_t LSH_KEY_CODES = 6;
+
+    static const uint8_t* key_codes();
+    static uint32_t key(const TlshDigest& digest, size_t table);
+
+    std::vector<TlshDigest> digests;
+    std::vector<std::string> names;
+    // Per table, the digests of bucket b are ids[table][start[table][b] .. start[table][b + 1])
+    std::vector<uint32_t> start[LSH_TABLES];
+    std::vector<uint32_t> ids[LSH_TABLES];
+};
+
+#endif
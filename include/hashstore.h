@@ -0,0 +1,121 @@
+#ifndef HASHSTORE_H
+#define HASHSTORE_H
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <openssl/evp.h>
+#include "fuzzyhash.h"
+#include "entropy.h"
+
+// Digest algorithms the scanner can match on. Used as bit flags.
+enum DigestAlgo : unsigned {
+    DIGEST_SHA256 = 1u << 0,
+    DIGEST_SHA1   = 1u << 1,
+    DIGEST_MD5    = 1u << 2,
+    // Not a digest: match the content signatures in the same pass
+    DIGEST_CONTENT = 1u << 3,
+    // TLSH similarity digest, matched against known samples by distance
+    DIGEST_FUZZY  = 1u << 4,
+    // Not a digest: byte entropy of native executables, for the packer heuristic
+    DIGEST_ENTROPY = 1u << 5,
+};
+
+// Hex digests of one file. Algorithms that were not requested stay empty.
+struct FileDigests {
+    std::string sha256;
+    std::string sha1;
+    std::string md5;
+    std::string signature;      // content signature that matched, with DIGEST_CONTENT
+    std::string fuzzy;          // TLSH, "" if the file was too short or uniform for one
+    EntropyStats entropy;       // with DIGEST_ENTROPY
+};
+
+// Known digests of one algorithm. Those that came with their sample's size
+// are kept apart: only they can be ruled out by the size of a file.
+struct DigestTable {
+    std::unordered_set<std::string> sized;
+    std::unordered_set<std::string> unsized;
+
+    bool contains(const std::string& hex) const;
+    bool empty() const { return sized.empty() && unsized.empty(); }
+    size_t size() const { return sized.size() + unsized.size(); }
+};
+
+// Known-malicious digests, one table per algorithm
+struct HashStore {
+    DigestTable sha256;
+    DigestTable sha1;
+    DigestTable md5;
+    FuzzyIndex fuzzy;
+
+    // Sorted sizes of the samples in the sized tables
+    std::vector<uint64_t> sizes;
+
+    // Order-independent fingerprint of the loaded database. Anything that
+    // remembers "checked clean" must forget it when this changes.
+    uint64_t generation = 0;
+
+    // Adds a digest, picking the table from its length. `size` is the
+    // sample size in bytes, or -1 when the feed doesn't carry one.
+    bool add(const std::string& hex, int64_t size = -1);
+    // Adds a TLSH digest of a known sample, reported as `name` when a file
+    // comes close to it
+    bool add_fuzzy(const std::string& digest, const std::string& name);
+
+    // Sorts and dedups `sizes` and builds the fuzzy index; call once after loading
+    void finalize();
+
+    // DigestAlgo flags that can still match a file of this size: all of
+    // algorithms() when a sized sample has it, otherwise only the tables
+    // holding digests without a size, and fuzzy digests, since a variant
+    // can be any size. 0 means the file can't match and needn't be read.
+    unsigned algorithms_for_size(uint64_t size) const;
+
+    // DigestAlgo flags of the tables that have entries
+    unsigned algorithms() const;
+    size_t size() const;
+
+    // Name of the first algorithm whose table contains the file, else the
+    // content signature that matched, else the nearest known fuzzy digest
+    // with its distance; "" if none
+    std::string match(const FileDigests& digests) const;
+};
+
+// Updates every requested digest from the same buffers, so checking several
+// algorithms still reads each file once
+class MultiDigest {
+public:
+    explicit MultiDigest(unsigned algos);
+    // Copies the running state, so hashing can go on from the same point twice
+    MultiDigest(const MultiDigest& other);
+    ~MultiDigest();
+    MultiDigest& operator=(const MultiDigest&) = delete;
+
+    bool update(const unsigned char* data, size_t len);
+    bool finish(FileDigests& out);
+    unsigned algorithms() const;
+
+private:
+    EVP_MD_CTX* sha256 = nullptr;
+    EVP_MD_CTX* sha1 = nullptr;
+    EVP_MD_CTX* md5 = nullptr;
+    std::unique_ptr<FuzzyDigest> fuzzy;
+    std::unique_ptr<EntropyMeter> entropy;
+};
+
+// Adds the digests in `filename` (one hex digest per line) to `store`. The
+// algorithm is taken from the digest length. Returns false if the file
+// could not be opened.
+bool load_hashes(const std::string& filename, HashStore& store);
+
+// Adds a ClamAV hash signature file (.hdb/.hsb, "hash:size:name" per line),
+// a CSV export with sha256_hash/sha1_hash/md5_hash and optional file_size
+// and tlsh columns, or a TLSH list (.tlsh, "digest name" per line). Picks
+// the format from the extension.
+bool load_sized_hashes(const std::string& filename, HashStore& store);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef KERNELHASH_H
+#define KERNELHASH_H
+
+#include <string>
+#include <atomic>
+
+// Where SHA-256 of whole files is computed
+enum class HashBackend {
+    OpenSSL,    // read into userspace buffers and hash with libcrypto
+    KernelAlg   // splice file pages into an AF_ALG hash(sha256) socket
+};
+
+extern std::atomic<HashBackend> hash_backend;
+
+// True if the kernel exposes hash(sha256) through AF_ALG
+bool kernel_sha256_available();
+
+// Hashes the file without copying it into userspace. Returns an empty
+// string on any failure so the caller can fall back to OpenSSL.
+std::string kernel_sha256_file(const std::string& path);
+
+// Same for an open descriptor, hashed from offset 0. The descriptor is not closed.
+std::string kernel_sha256_fd(int fd);
+
+// The backend chosen last time, keyed by kernel release and OpenSSL version
+const std::string HASH_BACKEND_FILE = "hashbackend.txt";
+
+// Selects the faster backend. The choice is remembered in HASH_BACKEND_FILE;
+// only on a new kernel or OpenSSL are both timed on a scratch file again,
+// with the result printed to stdout.
+void select_hash_backend();
+
+#endif
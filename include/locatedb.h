@@ -0,0 +1,27 @@
+#ifndef LOCATEDB_H
+#define LOCATEDB_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+// Databases updatedb maintains, tried in this order
+const std::string MLOCATE_DB_PATH = "/var/lib/mlocate/mlocate.db";
+const std::string PLOCATE_DB_PATH = "/var/lib/plocate/plocate.db";
+
+// Enumerate full scans from the locate database instead of walking
+extern std::atomic<bool> use_locate_db;
+
+// What the locate database can vouch for under one scan root
+struct LocateListing {
+    std::string database;
+    std::vector<std::string> files;         // entries of directories unchanged since updatedb ran
+    std::vector<std::string> walk_dirs;     // changed or pruned directories; walk these normally
+};
+
+// Reads the database and checks every directory under `root` against its
+// current mtime/ctime. Returns false and sets msg if no usable database
+// covers `root`, in which case the caller walks the whole tree.
+bool locate_listing(const std::string& root, LocateListing& out);
+
+#endif
@@ -3,12 +3,13 @@
 
 #include <unordered_set>
 #include <string>
+#include "hashstore.h"
 #include <vector>
 #include "button.h"
 #include "widget.h"
 
-extern std::unordered_set<std::string> hash_set;
-extern std::vector<Button> scanButtons, sideButtons;
+extern HashStore hash_store;
+extern std::vector<Button> scanButtons, sideButtons, networkButtons;
 extern std::vector<Widget> scanRects, sideRects;
 
 #endif
\ No newline at end of file
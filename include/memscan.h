@@ -0,0 +1,73 @@
+#ifndef MEMSCAN_H
+#define MEMSCAN_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <tuple>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+
+// Bytes per second a memory scan may read from other processes, in MiB; 0 for no limit
+extern std::atomic<unsigned> memscan_rate_mib;
+
+// Most suspicious first
+enum class RegionClass {
+    ExecutableAnonymous,    // anonymous or memfd memory mapped executable: injected code, JIT
+    Memfd,                  // memfd contents, often a payload staged for fexecve
+    WritableAnonymous       // heap and anonymous data, read up to a per-process budget
+};
+
+// Part of another process's address space worth matching. File-backed
+// mappings are left to the file scans.
+struct MemoryRegion {
+    pid_t pid = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    std::string perms;
+    std::string name;       // as in maps: "", "[heap]", "/memfd:x (deleted)", ...
+    RegionClass kind = RegionClass::WritableAnonymous;
+    bool changed = false;   // new or re-protected since the last memory scan
+};
+
+struct MemoryHit {
+    pid_t pid = 0;
+    uint64_t address = 0;   // where the signature starts
+    std::string region;
+    std::string signature;
+};
+
+struct MemoryScanStats {
+    size_t regions = 0;     // done, read or given up
+    uint64_t bytes = 0;
+    size_t denied = 0;      // processes we may not read
+    size_t failed = 0;      // regions unmapped or unreadable part way
+};
+
+// Reads selected regions of live processes with batched process_vm_readv
+// calls and runs the byte signatures over them. Reads go one batch at a
+// time at the configured rate, so the targets' mmap lock is held briefly
+// and they are never stopped.
+class MemoryScanner {
+public:
+    using HitHandler = std::function<void(const MemoryHit&)>;
+
+    // Lists the regions of every other process, most suspicious first.
+    // Returns false and sets msg if /proc can't be read.
+    bool plan(std::vector<MemoryRegion>& regions);
+
+    // Matches `regions` in order, calling `hit` for the first match in each.
+    // `progress` is called after every region.
+    void scan(const std::vector<MemoryRegion>& regions, const HitHandler& hit, MemoryScanStats& stats,
+              const std::function<void()>& progress = nullptr);
+
+private:
+    // (pid, start, end, perms) of every region the last plan() listed
+    std::set<std::tuple<pid_t, uint64_t, uint64_t, std::string>> last_seen;
+};
+
+extern MemoryScanner memory_scanner;
+
+#endif
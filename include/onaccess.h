@@ -0,0 +1,22 @@
+#ifndef ONACCESS_H
+#define ONACCESS_H
+
+#include <string>
+#include "hashstore.h"
+
+// Settings for the on-access daemon
+struct OnAccessOptions {
+    std::string root = "/";     // every local filesystem under this is marked
+    bool all_opens = false;     // check every open, not only exec
+    int deadline_ms = 250;      // allow the access if no verdict by then (fail open)
+    unsigned workers = 0;       // hashing threads, 0 for one per core
+};
+
+// Answers fanotify permission events (FAN_OPEN_EXEC_PERM, and FAN_OPEN_PERM
+// with all_opens) with the verdict of the same digest engine as scan_file.
+// Unchanged files are answered from the verdict cache without reading them.
+// Blocks until SIGINT/SIGTERM; returns false if the kernel or our
+// privileges don't allow permission events.
+bool run_onaccess_daemon(const HashStore& hash_store, const OnAccessOptions& options);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PACKAGEINDEX_H
+#define PACKAGEINDEX_H
+
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include "dedup.h"
+#include "hashstore.h"
+
+// Leave files the package manager installed and nobody touched since unhashed
+extern std::atomic<bool> trust_packages;
+
+// Paths owned by installed dpkg/rpm packages, with what the package
+// manager recorded about them. Conffiles are left out since admins edit them.
+class PackageIndex {
+public:
+    // Rereads the package databases if they changed since the last load
+    void refresh();
+
+    // True if any path of `target` is package-owned and its metadata shows
+    // it untouched since install: its ctime is no later than the install,
+    // and its size and mtime are as recorded. Nothing is read. Only dpkg
+    // leaves an install time to compare with.
+    bool unchanged(const ScanTarget& target) const;
+
+    // For an owned file the metadata can't vouch for: the DigestAlgo its
+    // package recorded, to be computed in the scan's own pass. 0 if none.
+    unsigned digest_algo(const ScanTarget& target) const;
+    // True if `digests` carry the digest the package recorded for `target`
+    bool matches_digest(const ScanTarget& target, const FileDigests& digests) const;
+
+    size_t size() const { return files.size(); }
+
+private:
+    struct Owned {
+        int64_t installed_ns = -1;  // ctime of an untouched file is no later than this, -1 if unknown
+        int64_t size = -1;          // as recorded by the package, -1 if not
+        int64_t mtime = -1;         // seconds, as recorded by the package, -1 if not
+        unsigned algo = 0;          // DigestAlgo of `digest`
+        std::string digest;         // lowercase hex, empty if not recorded
+    };
+
+    const Owned* find(const ScanTarget& target) const;
+    void load_dpkg();
+    void load_rpm();
+    void add(const std::string& path, const Owned& owned);
+
+    std::unordered_map<std::string, Owned> files;
+    std::unordered_map<std::string, std::string> real_dirs;     // usrmerge: /bin -> /usr/bin
+    int64_t dpkg_stamp = -1;
+    int64_t rpm_stamp = -1;
+};
+
+extern PackageIndex package_index;
+
+#endif
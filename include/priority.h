@@ -0,0 +1,32 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include "dedup.h"
+
+// Where malware is most likely found first. Lower values are scanned first.
+enum class ScanPriority {
+    TempDir,        // world-writable scratch space: /tmp, /var/tmp, /dev/shm
+    Downloads,      // users' download folders
+    Executable,     // files with an exec bit and anything in bin/sbin/libexec
+    Recent,         // changed within RECENT_SECONDS
+    Rest,
+    Count
+};
+
+// ctime within this many seconds of the scan puts a file in Recent
+const time_t RECENT_SECONDS = 7 * 24 * 3600;
+
+const char* priority_name(ScanPriority priority);
+
+// Best class among every path of `target`
+ScanPriority scan_priority(const ScanTarget& target, time_t now);
+
+// Stable-sorts `targets` by class, most recently changed first within
+// Recent, so batches handed to the workers in order drain each class
+// before the next. Fills `counts` (indexed by class) when given.
+void order_by_priority(std::vector<ScanTarget>& targets, std::vector<size_t>* counts = nullptr);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef PROCSCAN_H
+#define PROCSCAN_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+// One executable or library that running processes have mapped, however
+// many of them map it
+struct ProcessImage {
+    std::string path;           // as the kernel names it, " (deleted)" included
+    std::string read_path;      // where its content can still be opened
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    std::vector<pid_t> pids;
+};
+
+// Collects /proc/<pid>/exe and the executable file-backed mappings in
+// /proc/<pid>/maps of every process, one entry per (dev, ino). Files that
+// were deleted or replaced since, or that live in another mount namespace,
+// are read back through /proc/<pid>/exe or /proc/<pid>/map_files. Returns
+// false and sets msg if /proc can't be read.
+bool list_process_images(std::vector<ProcessImage>& images, size_t* process_count = nullptr);
+
+// The command name of `pid`, "" once it has exited
+std::string process_name(pid_t pid);
+
+#endif
@@ -16,6 +16,14 @@
 #include <atomic>
 #include <unordered_set>
 #include <algorithm>
+#include <vector>
+#include "hashstore.h"
+#include "dedup.h"
+#include "dirsummary.h"
+#include "verdictcache.h"
+#include "sigengine.h"
+#include "yararules.h"
+#include "bytestream.h"
 
 // Declare global variables
 extern std::queue<std::filesystem::path> file_queue;
@@ -24,17 +32,84 @@ extern std::mutex output_mutex;
 extern std::atomic<bool> scanning;
 extern std::atomic<int> files_processed;
 extern std::atomic<int> total_files;
+extern std::atomic<int> files_skipped;
 extern std::string filePath;
 extern std::string hashString;
 extern std::string status;
 extern std::string numofthreat;
 extern std::string msg;
 
+// Full scans hash every file; quick scans only executable content
+enum class ScanMode {
+    Full,
+    Quick
+};
+
+std::string to_hex(const unsigned char* data, size_t len);
+// DigestAlgo flags a scan against `hash_store` needs, content signatures
+// included when any are loaded
+unsigned scan_algorithms(const HashStore& hash_store);
+
+// The content checks a DIGEST_CONTENT pass runs beside the digests
+struct ContentMatch {
+    SignatureScanner signatures{content_signatures};
+    RuleScanner rules{yara_rules};
+
+    void update(const unsigned char* data, size_t len);
+    // What matched, "" if nothing. Rules are only evaluated when no plain
+    // signature already matched; they read back through `fd` or `read`.
+    std::string finish(int fd, uint64_t size);
+    std::string finish(const RangeReader& read, uint64_t size);
+};
+
 std::string sha256_file(const std::string& path);
-std::unordered_set<std::string> load_hashes(const std::string& filename);
+// Files at least this large keep a midstate in the verdict cache, and
+// resuming from one first compares the last MIDSTATE_CHECK_SIZE bytes
+const uint64_t MIDSTATE_MIN_SIZE = 1 << 20;
+const uint64_t MIDSTATE_CHECK_SIZE = 4096;
+
+// First bytes of a file as a hash pass read them, so what the file is can
+// be told without reading it again. Left empty when nothing was read.
+struct FileHead {
+    unsigned char bytes[STREAM_SNIFF_SIZE];
+    size_t len = 0;
+};
+
+// Computes the requested DigestAlgo flags of an open file in one read pass,
+// keeping the state at midstate->offset along the way when asked to. Content
+// signatures are matched on the same buffers. With `head`, its bytes are
+// the file's first and hashing reads on from there.
+bool digest_fd(int fd, uint64_t size, unsigned algos, FileDigests& out, Midstate* midstate = nullptr,
+               const FileHead* head = nullptr);
+// Same, answered from the verdict cache when the file hasn't changed since
+// it was last hashed and resumed from its midstate when it has only grown.
+// `head`, when given, is filled whenever the file has to be read; if it
+// holds the head already, that isn't read again.
+bool digest_cached(int fd, unsigned algos, FileDigests& out, FileHead* head = nullptr);
+bool digest_file(const std::string& path, unsigned algos, FileDigests& out, FileHead* head = nullptr);
+// Quick scan: sniffs the first SNIFF_SIZE bytes and goes on to hash the
+// file from there only if it is executable content. Sets `skipped` and
+// returns false for anything else. `head` is filled when the file is read,
+// and for anything else only the first time it is seen unchanged.
+bool digest_if_executable(int fd, unsigned algos, FileDigests& out, bool& skipped, FileHead* head = nullptr);
 bool is_hash_in_set(const std::unordered_set<std::string>& hash_set, const std::string& hash);
-void process_files(const std::unordered_set<std::string>& hash_set);
-void scan_directory(const std::string& path, const std::unordered_set<std::string>& hash_set);
-void scan_file(const std::string& filePath, const std::unordered_set<std::string>& hash_set);
+// Hashes and matches `file_batch`, logging to `log_file` under output_mutex
+// so every worker can share the scan's one log stream
+void process_files(const HashStore& hash_store, const std::vector<ScanTarget>& file_batch,
+                   std::ofstream* log_file, ScanMode mode = ScanMode::Full);
+// Adds every regular file under `path` to `deduper`, or to `dir_walk` when
+// given so unchanged directories can be dropped first. Returns false and
+// sets msg if the walk could not be started.
+bool walk_directory(const std::string& path, ContentDeduper& deduper, std::ofstream* log_file,
+                    DirWalk* dir_walk = nullptr);
+void scan_directory(const std::string& path, const HashStore& hash_store,
+                    ScanMode mode = ScanMode::Full);
+void scan_file(const std::string& filePath, const HashStore& hash_store);
+// Hashes every executable and library running processes have mapped, each
+// distinct file once, and logs matches with the processes that map them
+void scan_processes(const HashStore& hash_store);
+// Matches the byte signatures against executable anonymous memory, memfd
+// contents and some heap of every other process
+void scan_memory();
 
 #endif
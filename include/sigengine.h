@@ -0,0 +1,135 @@
+#ifndef SIGENGINE_H
+#define SIGENGINE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include "filetype.h"
+
+// Where the compiled automaton is kept between runs
+const std::string SIGNATURE_CACHE_FILE = "sigcache.bin";
+
+// Longest pattern accepted, wildcards included
+const size_t MAX_PATTERN_LENGTH = 255;
+
+// One byte pattern. `mask` is 0xff where the byte must match and 0x00 for
+// a wildcard. The anchor is the longest literal run; only it is searched
+// for, the rest is verified around each hit.
+struct ContentSignature {
+    std::string name;
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+    uint32_t anchor_offset = 0;
+    uint32_t anchor_len = 0;
+    int64_t offset = -1;                // required start offset, -1 for anywhere
+    FileType target = FileType::Unknown;  // only files of this type, Unknown for all
+    uint32_t tag = 0;                   // the caller's id, passed to hit handlers
+};
+
+// Byte signatures compiled for streaming search. Anchors are found with a
+// Teddy-style SSSE3 prefilter while there are few of them and with an
+// Aho-Corasick DFA over byte classes otherwise.
+class ContentSignatures {
+public:
+    // Adds the usable lines of a ClamAV .ndb file
+    // (Name:TargetType:Offset:HexSignature). Signatures using features we
+    // don't support (alternatives, open ranges, offsets relative to EP or
+    // sections) are skipped and counted. Returns false and sets msg if the
+    // file can't be read.
+    bool load_ndb(const std::string& filename);
+
+    // Adds a pattern built by another compiler (YARA strings). Any literal
+    // byte will do as anchor. Returns false if it has none or is too long.
+    bool add(ContentSignature sig);
+
+    // Builds the automaton, or loads it from `cache_file` when that was
+    // built from the same signatures; writes the cache otherwise
+    void compile(const std::string& cache_file);
+
+    bool empty() const { return signatures.empty(); }
+    size_t size() const { return signatures.size(); }
+    size_t skipped() const { return unsupported; }
+    bool uses_teddy() const { return teddy; }
+
+    // Changes whenever the set of signatures does
+    uint64_t generation() const { return key; }
+
+private:
+    friend class SignatureScanner;
+
+    bool load_cache(const std::string& cache_file);
+    void save_cache(const std::string& cache_file) const;
+    void build_dfa();
+    void build_teddy();
+
+    std::vector<ContentSignature> signatures;
+    size_t unsupported = 0;
+    size_t max_length = 0;
+    uint64_t key = 0;
+
+    // Aho-Corasick DFA over byte classes. Each entry is the next state's row
+    // offset (state * classes) shifted left by one, with the low bit set if
+    // some anchor ends there; those signatures are listed at
+    // outputs[output_start[state] .. output_start[state + 1]).
+    uint8_t byte_class[256] = {};
+    uint32_t classes = 0;
+    std::vector<uint32_t> table;
+    std::vector<uint32_t> output_start;
+    std::vector<uint32_t> outputs;
+    // Bytes that keep the DFA at its root, skipped without the table walk
+    bool root_stays[256] = {};
+
+    // Teddy: per position k of the first three anchor bytes, which of the
+    // eight buckets accept a given low/high nibble
+    bool teddy = false;
+    alignas(16) uint8_t teddy_lo[3][16] = {};
+    alignas(16) uint8_t teddy_hi[3][16] = {};
+    std::vector<uint32_t> buckets[8];
+};
+
+// Matches one file's bytes as they stream past, chunk by chunk in file
+// order. Carries the tail of each chunk so patterns spanning two chunks
+// are found too.
+class SignatureScanner {
+public:
+    explicit SignatureScanner(const ContentSignatures& signatures);
+
+    void update(const unsigned char* data, size_t len);
+
+    // Name of the first signature that matched, "" if none
+    const std::string& result() const { return matched; }
+
+    // Reports every match, with its start offset, instead of stopping at
+    // the first; result() stays empty
+    using HitHandler = std::function<void(const ContentSignature& sig, uint64_t start)>;
+    void report_all(HitHandler handler) { on_hit = std::move(handler); }
+
+private:
+    void find_anchors(const unsigned char* data, size_t len);
+    void teddy_candidates(const unsigned char* data, size_t len);
+    void check_anchor_start(uint32_t sig, uint64_t anchor_pos);
+    void verify(uint32_t sig, uint64_t start);
+    int byte_at(uint64_t pos) const;
+
+    const ContentSignatures& sigs;
+    FileType type = FileType::Unknown;
+    uint64_t base = 0;                  // file offset of the current chunk
+    const unsigned char* chunk = nullptr;
+    size_t chunk_len = 0;
+    std::vector<unsigned char> carry;   // bytes just before `base`
+    std::vector<std::pair<uint32_t, uint64_t>> pending;   // waiting for the next chunk
+    uint32_t state = 0;                 // DFA row, as stored in the table
+    uint64_t next_start = 0;            // first position Teddy hasn't looked at
+    std::string matched;
+    HitHandler on_hit;
+};
+
+extern ContentSignatures content_signatures;
+
+// Times SHA-256 alone, the signatures alone and both over the files in
+// `dir` (up to 512 MiB, read into memory first) and prints GB/s
+void benchmark_content_scan(const std::string& dir);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef VERDICTCACHE_H
+#define VERDICTCACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include "hashstore.h"
+
+// What identifies one version of a file's content without reading it. A
+// change of any field means the cached digests no longer apply.
+struct FileIdentity {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint32_t generation = 0;    // FS_IOC_GETVERSION; guards against inode reuse
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    int64_t ctime_ns = 0;
+
+    // fstat() plus the inode generation where the filesystem reports one
+    static bool from_fd(int fd, FileIdentity& out);
+};
+
+// Hash state part way into a file. A file that has only grown since is
+// hashed from `offset` on instead of from the start.
+struct Midstate {
+    uint64_t offset = 0;        // bytes hashed into `state`, a multiple of READ_ALIGNMENT
+    std::string check;          // SHA-256 of the block just before `offset`
+    std::shared_ptr<const MultiDigest> state;
+};
+
+// In-memory cache of file digests keyed by (dev, ino). Digests rather than
+// verdicts are kept so that a database update doesn't invalidate it: the
+// verdict is a hash-set lookup away.
+class VerdictCache {
+public:
+    // Fills `out` if the file is unchanged and every algorithm in `algos`
+    // was computed last time
+    bool lookup(const FileIdentity& id, unsigned algos, FileDigests& out);
+    // True if the file hasn't changed since it was last stored, whatever was
+    // computed then. A file left unhashed is stored with no algorithms, so
+    // it gets looked at once per change.
+    bool unchanged(const FileIdentity& id);
+    // The saved midstate of the same inode if it has grown since and the
+    // midstate covers every algorithm in `algos`
+    bool midstate(const FileIdentity& id, unsigned algos, Midstate& out);
+    void store(const FileIdentity& id, unsigned algos, const FileDigests& digests,
+               const Midstate& midstate = Midstate());
+    void clear();
+    size_t size();
+
+private:
+    struct Entry {
+        FileIdentity id;
+        unsigned algos = 0;
+        FileDigests digests;
+        Midstate midstate;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Entry> entries;
+    };
+
+    static const size_t SHARDS = 64;
+    static const size_t MAX_ENTRIES_PER_SHARD = 1 << 16;
+
+    static uint64_t key(uint64_t dev, uint64_t ino);
+    Shard shards[SHARDS];
+};
+
+extern VerdictCache verdict_cache;
+
+#endif
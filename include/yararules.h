@@ -0,0 +1,132 @@
+#ifndef YARARULES_H
+#define YARARULES_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <functional>
+#include <cstdint>
+#include "sigengine.h"
+
+// Where the compiled atom automaton of the rules is kept between runs
+const std::string RULE_CACHE_FILE = "yaracache.bin";
+
+// Longest a hex string with jumps may span, so verifying one is one small read
+const size_t MAX_STRING_SPAN = 4096;
+
+// Rules in a practical subset of YARA:
+//
+//   strings:   "text" (ascii, wide), { hex ?? [n] [n-m] }
+//   condition: and or not ( ) true false, == != < <= > >= + -,
+//              $a, #a, @a[i], $a at N, $a in (N..M), N/any/all/none of them,
+//              N of ($a, $b*), filesize (KB, MB), uint8/16/32(be)(N),
+//              and earlier rules by name
+//
+// Every string feeds its literal bytes to one shared automaton. Conditions
+// are only evaluated for files where one of the rule's strings was seen,
+// except for the few rules that can match without any.
+class RuleSet {
+public:
+    // Compiles the rules in `filename`. A rule using anything outside the
+    // subset (modules, regexes, nocase, for loops, ...) is skipped and
+    // counted. Returns false and sets msg if the file can't be read.
+    bool load(const std::string& filename);
+
+    // Builds the atom automaton, reusing `cache_file` when it matches
+    void compile(const std::string& cache_file);
+
+    bool empty() const { return rules.empty(); }
+    size_t size() const { return rules.size(); }
+    size_t skipped() const { return unsupported; }
+
+    // Changes whenever the rules do
+    uint64_t generation() const { return key; }
+
+private:
+    friend class RuleParser;
+    friend class RuleScanner;
+
+    enum class Op {
+        Const, Filesize, Uint, Count, Offset, Found, FoundAt, FoundIn, Of, RuleRef,
+        Not, And, Or, Add, Sub, Eq, Ne, Lt, Le, Gt, Ge
+    };
+
+    // One node of a condition; operands are indexes into Rule::nodes
+    struct Node {
+        Op op = Op::Const;
+        int64_t value = 0;          // constant, string, rule, Uint width (negative: big endian), Of count
+        int a = -1, b = -1, c = -1;
+        std::vector<uint32_t> strings;  // Of: the set
+    };
+
+    // A fixed run of a hex string; `min_gap`..`max_gap` bytes come before it
+    struct Piece {
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> mask;
+        uint32_t min_gap = 0;
+        uint32_t max_gap = 0;
+    };
+
+    struct RuleString {
+        std::string id;             // "$a", or "$" if anonymous
+        uint32_t rule = 0;
+        std::vector<Piece> pieces;  // more than one only with jumps
+        uint32_t anchor = 0;        // the piece searched for
+    };
+
+    struct Rule {
+        std::string name;
+        bool is_private = false;
+        bool needs_hit = false;     // can't be true unless a string was seen
+        std::vector<uint32_t> strings;
+        std::vector<Node> nodes;
+        int root = -1;
+    };
+
+    std::vector<Rule> rules;
+    std::vector<RuleString> strings;
+    std::unordered_map<std::string, uint32_t> rule_index;
+    std::vector<uint32_t> always_evaluate;
+    ContentSignatures atoms;
+    size_t unsupported = 0;
+    uint64_t key = 14695981039346656037ull;
+};
+
+// Reads bytes [offset, end) of the content being scanned into `out`
+using RangeReader = std::function<bool(uint64_t offset, uint64_t end, std::vector<unsigned char>& out)>;
+
+// Runs the rules over one file: collects atom hits while its bytes stream
+// past, then evaluates the conditions worth evaluating
+class RuleScanner {
+public:
+    explicit RuleScanner(const RuleSet& rules);
+
+    void update(const unsigned char* data, size_t len);
+
+    // Name of the first public rule that matches the file behind `fd`
+    // (`size` bytes), "" if none. Reads back only the bytes a condition
+    // asks for.
+    std::string evaluate(int fd, uint64_t size);
+    // Same for content that isn't an open file (archive members). With an
+    // empty `read` nothing can be read back, and tests needing it are false.
+    std::string evaluate(const RangeReader& read, uint64_t size);
+
+private:
+    struct Context;
+
+    // Atom hits of one string: all of them counted, the first
+    // MAX_OFFSETS_PER_STRING kept
+    struct StringHits {
+        uint64_t count = 0;
+        std::vector<uint64_t> offsets;  // start of its anchor piece
+    };
+
+    const RuleSet& set;
+    SignatureScanner scanner;
+    std::unordered_map<uint32_t, StringHits> hits;
+};
+
+extern RuleSet yara_rules;
+
+#endif
@@ -0,0 +1,613 @@
+#include "archive.h"
+#include "scan.h"
+#include "filereader.h"
+#include "filetype.h"
+#include "bytestream.h"
+#include "diskimage.h"
+#include <zip.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+std::atomic<bool> scan_archives(true);
+
+// Workers hashing the files of one disk image; scans already run one
+// worker per core over the files of a walk
+static const unsigned IMAGE_WORKERS = 4;
+
+// Name records (GNU long names, pax headers, ar name tables) larger than
+// this are refused
+static const uint64_t MAX_NAME_RECORD = 64 * 1024;
+
+// What one outer archive and everything nested in it share
+struct ArchiveWalk {
+    unsigned algos;
+    bool executables_only;
+    const std::function<void(const ArchiveMember&)>& visit;
+    ArchiveStats& stats;
+    InflateLimit limit;
+    size_t members = 0;
+    std::vector<unsigned char> buffer = std::vector<unsigned char>(READ_CHUNK_SIZE);
+
+    ArchiveWalk(unsigned algos, bool executables_only, const std::function<void(const ArchiveMember&)>& visit,
+                ArchiveStats& stats, uint64_t outer_size)
+        : algos(algos), executables_only(executables_only), visit(visit), stats(stats) {
+        limit.remaining = MAX_ARCHIVE_BYTES + MAX_ARCHIVE_EXPANSION * outer_size;
+        limit.ratio = MAX_COMPRESSION_RATIO;
+    }
+
+    bool exhausted() const { return limit.remaining == 0 || members > MAX_ARCHIVE_MEMBERS; }
+
+    // Counts one more member; false once there are too many
+    bool admit() {
+        if (++members <= MAX_ARCHIVE_MEMBERS) return true;
+        if (members == MAX_ARCHIVE_MEMBERS + 1) stats.limited++;
+        return false;
+    }
+};
+
+// Passes a member's bytes through while hashing them, keeping a copy while
+// the member is small enough to hold
+class MemberStream : public ByteStream {
+public:
+    MemberStream(ByteStream& body, unsigned algos, bool keep) : body(body), keep(keep) {
+        if (algos) digest = std::make_unique<MultiDigest>(algos);
+        if (algos & DIGEST_CONTENT) content = std::make_unique<ContentMatch>();
+    }
+
+    ssize_t read(unsigned char* out, size_t len) override {
+        ssize_t n = body.read(out, len);
+        if (n <= 0) return n;
+        const size_t got = static_cast<size_t>(n);
+        total += got;
+        if (digest) digest->update(out, got);
+        if (content) content->update(out, got);
+        if (keep && kept.size() + got > MAX_BUFFERED_MEMBER) {
+            keep = false;
+            std::vector<unsigned char>().swap(kept);
+        } else if (keep) {
+            kept.insert(kept.end(), out, out + got);
+        }
+        return n;
+    }
+
+    // Reads whatever the walk of the member's contents left over
+    bool drain(std::vector<unsigned char>& buffer) {
+        for (;;) {
+            ssize_t n = read(buffer.data(), buffer.size());
+            if (n < 0) return false;
+            if (n == 0) return true;
+        }
+    }
+
+    ByteStream& body;
+    std::unique_ptr<MultiDigest> digest;
+    std::unique_ptr<ContentMatch> content;
+    bool keep;
+    std::vector<unsigned char> kept;
+    uint64_t total = 0;
+};
+
+// One ZIP member as it inflates
+class ZipMemberStream : public ByteStream {
+public:
+    ZipMemberStream(zip_file_t* zf, uint64_t compressed, InflateLimit& limit)
+        : zf(zf), compressed(compressed), limit(limit) {}
+    ~ZipMemberStream() override { zip_fclose(zf); }
+
+    ssize_t read(unsigned char* out, size_t len) override {
+        zip_int64_t n = zip_fread(zf, out, len);
+        if (n <= 0) return n < 0 ? -1 : 0;
+        // The declared sizes can lie; what actually comes out is what counts
+        produced += static_cast<uint64_t>(n);
+        if (!limit.charge(static_cast<uint64_t>(n), compressed, produced)) return -1;
+        return static_cast<ssize_t>(n);
+    }
+
+private:
+    zip_file_t* zf;
+    uint64_t compressed;
+    InflateLimit& limit;
+    uint64_t produced = 0;
+};
+
+// Lets YARA conditions read back from a member kept in memory
+static RangeReader kept_reader(const std::vector<unsigned char>& kept) {
+    return [&kept](uint64_t offset, uint64_t end, std::vector<unsigned char>& out) {
+        if (offset > end || end > kept.size()) return false;
+        out.assign(kept.begin() + static_cast<ptrdiff_t>(offset), kept.begin() + static_cast<ptrdiff_t>(end));
+        return true;
+    };
+}
+
+static bool is_container(StreamFormat format) {
+    return format == StreamFormat::Tar || format == StreamFormat::Ar ||
+           format == StreamFormat::Cpio || format == StreamFormat::Rpm;
+}
+
+static std::string leaf_name(const std::string& path) {
+    size_t slash = path.find_last_of("/!");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// "a.exe.gz" holds "a.exe"; without a known suffix the name stays
+static std::string decompressed_name(const std::string& name) {
+    static const char* suffixes[] = {".gz", ".xz", ".lzma", ".zst", ".z", ".Z"};
+    for (const char* suffix : suffixes) {
+        size_t len = strlen(suffix);
+        if (name.size() > len && name.compare(name.size() - len, len, suffix) == 0)
+            return name.substr(0, name.size() - len);
+    }
+    return name;
+}
+
+// Reads `len` bytes of a name record into `out`
+static bool read_record(ByteStream& in, uint64_t len, std::string& out) {
+    if (len > MAX_NAME_RECORD) return false;
+    out.assign(static_cast<size_t>(len), '\0');
+    return read_full(in, reinterpret_cast<unsigned char*>(&out[0]), out.size()) == static_cast<ssize_t>(out.size());
+}
+
+static void scan_zip(zip_t* za, const std::string& prefix, int depth, ArchiveWalk& walk);
+static void walk_stream(ByteStream& in, StreamFormat format, const std::string& prefix,
+                        const std::string& name, int depth, ArchiveWalk& walk);
+
+// Hashes one member as it streams past and walks what's inside it.
+// Returns false if `body` failed, which leaves its container unusable.
+static bool scan_member(ByteStream& body, const std::string& path, int depth, ArchiveWalk& walk) {
+    const size_t refused = walk.limit.refused;
+    auto failed = [&]() {
+        if (walk.limit.refused == refused) walk.stats.skipped++;
+        return false;
+    };
+
+    // The head decides what the member is and whether it's worth reporting
+    std::vector<unsigned char> head(SNIFF_SIZE);
+    ssize_t n = read_full(body, head.data(), head.size());
+    if (n < 0) return failed();
+    head.resize(static_cast<size_t>(n));
+    const StreamFormat format = sniff_stream_format(head.data(), head.size());
+    const bool report = !walk.executables_only || is_executable_type(sniff_file_type(head.data(), head.size()));
+    if (!report && format == StreamFormat::Unknown) {
+        walk.stats.skipped++;
+        return true;
+    }
+
+    PrefixStream whole(std::move(head), body);
+    const unsigned algos = report ? walk.algos : 0;
+    MemberStream member(whole, algos, format == StreamFormat::Zip || (algos & DIGEST_CONTENT));
+    if (format != StreamFormat::Unknown && format != StreamFormat::Zip) {
+        if (depth + 1 < MAX_ARCHIVE_DEPTH)
+            walk_stream(member, format, path + "!", leaf_name(path), depth + 1, walk);
+        else
+            walk.stats.limited++;
+    }
+    if (!member.drain(walk.buffer)) return failed();
+
+    ArchiveMember result;
+    result.path = path;
+    if (report && member.digest->finish(result.digests)) {
+        if (member.content) {
+            RangeReader read;
+            if (member.keep) read = kept_reader(member.kept);
+            result.digests.signature = member.content->finish(read, member.total);
+        }
+        walk.stats.members++;
+        walk.visit(result);
+    } else {
+        walk.stats.skipped++;
+    }
+
+    if (format != StreamFormat::Zip) return true;
+    if (!member.keep || depth + 1 >= MAX_ARCHIVE_DEPTH) {
+        walk.stats.limited++;
+        return true;
+    }
+
+    // A ZIP needs its central directory first: open it from the copy in memory
+    zip_error_t error;
+    zip_error_init(&error);
+    zip_source_t* src = zip_source_buffer_create(member.kept.data(), member.kept.size(), 0, &error);
+    zip_t* inner = src ? zip_open_from_source(src, ZIP_RDONLY, &error) : nullptr;
+    if (inner) {
+        scan_zip(inner, path + "!", depth + 1, walk);
+        zip_discard(inner);
+    } else {
+        if (src) zip_source_free(src);
+        walk.stats.skipped++;
+    }
+    zip_error_fini(&error);
+    return true;
+}
+
+// Scans the next `size` bytes of `in` as a member and moves past them
+static bool scan_slice(ByteStream& in, uint64_t size, const std::string& path, int depth, ArchiveWalk& walk) {
+    if (!walk.admit()) return false;
+    SliceStream body(in, size);
+    return scan_member(body, path, depth, walk) && skip_bytes(body, body.remaining());
+}
+
+static void scan_zip(zip_t* za, const std::string& prefix, int depth, ArchiveWalk& walk) {
+    zip_int64_t count = zip_get_num_entries(za, 0);
+    for (zip_int64_t i = 0; i < count && !walk.exhausted(); ++i) {
+        zip_stat_t st;
+        zip_stat_init(&st);
+        if (zip_stat_index(za, static_cast<zip_uint64_t>(i), 0, &st) != 0 || !(st.valid & ZIP_STAT_NAME)) {
+            walk.stats.skipped++;
+            continue;
+        }
+        std::string name = st.name;
+        if (name.empty() || name.back() == '/') continue;   // directory entry
+        if (!walk.admit()) break;
+
+        const uint64_t compressed = (st.valid & ZIP_STAT_COMP_SIZE) ? std::max<uint64_t>(st.comp_size, 1) : 1;
+        // A bomb that admits it in the directory isn't worth starting on
+        if ((st.valid & ZIP_STAT_SIZE) && st.size > (1u << 20) && st.size / compressed > MAX_COMPRESSION_RATIO) {
+            walk.stats.limited++;
+            continue;
+        }
+        if ((st.valid & ZIP_STAT_ENCRYPTION_METHOD) && st.encryption_method != ZIP_EM_NONE) {
+            walk.stats.skipped++;
+            continue;
+        }
+        zip_file_t* zf = zip_fopen_index(za, st.index, 0);
+        if (!zf) {
+            walk.stats.skipped++;
+            continue;
+        }
+        ZipMemberStream body(zf, compressed, walk.limit);
+        scan_member(body, prefix + name, depth, walk);
+    }
+}
+
+// Parses a tar number field: octal, or base-256 when the top bit is set
+static uint64_t tar_number(const unsigned char* field, size_t len) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < len; ++i) value = (value << 8) | field[i];
+        return value;
+    }
+    size_t i = 0;
+    while (i < len && field[i] == ' ') ++i;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+static std::string header_field(const unsigned char* field, size_t len) {
+    return std::string(reinterpret_cast<const char*>(field), strnlen(reinterpret_cast<const char*>(field), len));
+}
+
+// Picks `path` and `size` out of pax records ("<len> <key>=<value>\n")
+static void parse_pax(const std::string& data, std::string& path, uint64_t& size) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t space = data.find(' ', pos);
+        size_t len = std::strtoull(data.c_str() + pos, nullptr, 10);
+        if (space == std::string::npos || len == 0 || space + 2 > pos + len || pos + len > data.size()) return;
+        std::string record = data.substr(space + 1, pos + len - space - 2);
+        if (record.rfind("path=", 0) == 0) path = record.substr(5);
+        else if (record.rfind("size=", 0) == 0) size = std::strtoull(record.c_str() + 5, nullptr, 10);
+        pos += len;
+    }
+}
+
+static void walk_tar(ByteStream& in, const std::string& prefix, int depth, ArchiveWalk& walk) {
+    unsigned char block[512];
+    // From a GNU long name or pax header, for the entry that follows it
+    std::string next_path;
+    uint64_t next_size = 0;
+    while (!walk.exhausted()) {
+        ssize_t n = read_full(in, block, sizeof(block));
+        if (n == 0 || (n == sizeof(block) && block[0] == 0)) return;   // end of archive
+        if (n != sizeof(block) || !tar_checksum_ok(block)) {
+            walk.stats.skipped++;
+            return;
+        }
+        const char type = static_cast<char>(block[156]);
+        uint64_t size = tar_number(block + 124, 12);
+
+        if (type == 'L' || type == 'x') {
+            std::string data;
+            if (!read_record(in, size, data) || !skip_bytes(in, (512 - size % 512) % 512)) {
+                walk.stats.skipped++;
+                return;
+            }
+            if (type == 'L') next_path = data.c_str();
+            else parse_pax(data, next_path, next_size);
+            continue;
+        }
+
+        std::string path = next_path;
+        if (path.empty()) {
+            path = header_field(block, 100);
+            if (memcmp(block + 257, "ustar", 5) == 0 && block[345] != 0)
+                path = header_field(block + 345, 155) + "/" + path;
+        }
+        if (next_size) size = next_size;
+        next_path.clear();
+        next_size = 0;
+
+        // Only regular files have content; links, devices and directories don't
+        const uint64_t padding = (512 - size % 512) % 512;
+        if (type == '0' || type == '\0' || type == '7') {
+            if (!scan_slice(in, size, prefix + path, depth, walk) || !skip_bytes(in, padding)) return;
+        } else if (!skip_bytes(in, size + padding)) {
+            return;
+        }
+    }
+}
+
+static void walk_ar(ByteStream& in, const std::string& prefix, int depth, ArchiveWalk& walk) {
+    unsigned char header[60];
+    if (!skip_bytes(in, 8)) return;     // "!<arch>\n"
+    std::string long_names;             // the GNU "//" member
+    while (!walk.exhausted()) {
+        ssize_t n = read_full(in, header, sizeof(header));
+        if (n == 0) return;
+        if (n != sizeof(header) || header[58] != '`' || header[59] != '\n') {
+            walk.stats.skipped++;
+            return;
+        }
+        const uint64_t size = std::strtoull(header_field(header + 48, 10).c_str(), nullptr, 10);
+        std::string name = header_field(header, 16);
+        name.erase(name.find_last_not_of(' ') + 1);
+        uint64_t consumed = 0;          // of the member's data, by the branch below
+
+        if (name == "/" || name == "/SYM64/") {
+            // Symbol table
+        } else if (name == "//") {
+            if (!read_record(in, size, long_names)) return;
+            consumed = size;
+        } else {
+            if (name.rfind("#1/", 0) == 0) {
+                // BSD: the name is the first bytes of the data
+                consumed = std::strtoull(name.c_str() + 3, nullptr, 10);
+                if (consumed > size || !read_record(in, consumed, name)) return;
+                name = name.c_str();
+            } else if (name.size() > 1 && name[0] == '/') {
+                size_t offset = std::strtoull(name.c_str() + 1, nullptr, 10);
+                name = offset < long_names.size() ? long_names.substr(offset, long_names.find('\n', offset) - offset) : "";
+            }
+            if (!name.empty() && name.back() == '/') name.pop_back();
+            if (!scan_slice(in, size - consumed, prefix + name, depth, walk)) return;
+            consumed = size;
+        }
+        // Data is padded to an even length
+        if (!skip_bytes(in, size - consumed + size % 2)) return;
+    }
+}
+
+static uint64_t cpio_number(const unsigned char* field) {
+    return std::strtoull(header_field(field, 8).c_str(), nullptr, 16);
+}
+
+static void walk_cpio(ByteStream& in, const std::string& prefix, int depth, ArchiveWalk& walk) {
+    unsigned char header[110];
+    while (!walk.exhausted()) {
+        if (read_full(in, header, sizeof(header)) != sizeof(header) || memcmp(header, "07070", 5) != 0) {
+            walk.stats.skipped++;
+            return;
+        }
+        const uint64_t mode = cpio_number(header + 14);
+        const uint64_t size = cpio_number(header + 54);
+        const uint64_t name_size = cpio_number(header + 94);
+
+        // Header and name together are padded to 4 bytes, and so is the data
+        std::string name;
+        if (name_size == 0 || !read_record(in, name_size + (4 - (sizeof(header) + name_size) % 4) % 4, name)) {
+            walk.stats.skipped++;
+            return;
+        }
+        name = name.c_str();
+        if (name == "TRAILER!!!") return;
+
+        const uint64_t padding = (4 - size % 4) % 4;
+        if ((mode & S_IFMT) == S_IFREG) {
+            if (!scan_slice(in, size, prefix + name, depth, walk) || !skip_bytes(in, padding)) return;
+        } else if (!skip_bytes(in, size + padding)) {
+            return;
+        }
+    }
+}
+
+// Skips an RPM header structure; the signature header is padded to 8 bytes
+static bool skip_rpm_header(ByteStream& in, bool padded) {
+    unsigned char intro[16];
+    if (read_full(in, intro, sizeof(intro)) != sizeof(intro) || memcmp(intro, "\x8e\xad\xe8\x01", 4) != 0)
+        return false;
+    auto be32 = [](const unsigned char* p) {
+        return static_cast<uint64_t>(p[0]) << 24 | static_cast<uint64_t>(p[1]) << 16 | p[2] << 8 | p[3];
+    };
+    uint64_t len = 16 * be32(intro + 8) + be32(intro + 12);
+    if (padded) len += (8 - len % 8) % 8;
+    return skip_bytes(in, len);
+}
+
+// Walks `in`, already known to hold `format`. `name` names what a
+// compressed stream holds when that isn't an archive itself.
+static void walk_stream(ByteStream& in, StreamFormat format, const std::string& prefix,
+                        const std::string& name, int depth, ArchiveWalk& walk) {
+    const size_t refused = walk.limit.refused;
+    switch (format) {
+        case StreamFormat::Tar:
+            walk_tar(in, prefix, depth, walk);
+            break;
+        case StreamFormat::Ar:
+            walk_ar(in, prefix, depth, walk);
+            break;
+        case StreamFormat::Cpio:
+            walk_cpio(in, prefix, depth, walk);
+            break;
+        case StreamFormat::Rpm: {
+            // Lead, signature and header, then the compressed cpio payload
+            unsigned char head[STREAM_SNIFF_SIZE];
+            ssize_t n = -1;
+            if (skip_bytes(in, 96) && skip_rpm_header(in, true) && skip_rpm_header(in, false))
+                n = read_full(in, head, sizeof(head));
+            if (n <= 0) {
+                walk.stats.skipped++;
+                break;
+            }
+            PrefixStream payload(std::vector<unsigned char>(head, head + n), in);
+            walk_stream(payload, sniff_stream_format(head, static_cast<size_t>(n)), prefix, name, depth, walk);
+            break;
+        }
+        case StreamFormat::Gzip:
+        case StreamFormat::Xz:
+        case StreamFormat::Zstd: {
+            std::unique_ptr<ByteStream> inflated;
+            if (format == StreamFormat::Gzip) inflated = std::make_unique<GzipStream>(in, walk.limit);
+            else if (format == StreamFormat::Xz) inflated = std::make_unique<XzStream>(in, walk.limit);
+            else inflated = std::make_unique<ZstdStream>(in, walk.limit);
+
+            // A .tar.gz is one archive; a .gz of anything else holds one file
+            unsigned char head[STREAM_SNIFF_SIZE];
+            ssize_t n = read_full(*inflated, head, sizeof(head));
+            if (n <= 0) {
+                if (n < 0 && walk.limit.refused == refused) walk.stats.skipped++;
+                break;
+            }
+            StreamFormat inner = sniff_stream_format(head, static_cast<size_t>(n));
+            PrefixStream payload(std::vector<unsigned char>(head, head + n), *inflated);
+            if (is_container(inner)) {
+                walk_stream(payload, inner, prefix, name, depth, walk);
+            } else if (walk.admit()) {
+                scan_member(payload, prefix + decompressed_name(name), depth, walk);
+            }
+            break;
+        }
+        default:
+            // bzip2 has no decoder linked; the stream is still hashed as
+            // a whole
+            walk.stats.skipped++;
+            break;
+    }
+}
+
+// Disk images list their files up front, so those are hashed in parallel.
+// Each worker walks with its share of the limits.
+static void scan_image(DiskImage& image, const std::string& prefix, ArchiveWalk& walk) {
+    std::vector<ImageFile> files;
+    if (!image.list(files)) walk.stats.skipped++;
+    if (files.size() > MAX_ARCHIVE_MEMBERS) {
+        files.resize(MAX_ARCHIVE_MEMBERS);
+        walk.stats.limited++;
+    }
+    if (files.empty()) return;
+
+    const unsigned workers = static_cast<unsigned>(std::min<size_t>(IMAGE_WORKERS, files.size()));
+    std::mutex visit_mutex;
+    const std::function<void(const ArchiveMember&)> visit = [&](const ArchiveMember& member) {
+        std::lock_guard<std::mutex> lock(visit_mutex);
+        walk.visit(member);
+    };
+    std::vector<ArchiveStats> stats(workers);
+    std::vector<std::unique_ptr<ArchiveWalk>> walks;
+    for (unsigned w = 0; w < workers; ++w) {
+        walks.push_back(std::make_unique<ArchiveWalk>(walk.algos, walk.executables_only, visit, stats[w], 0));
+        walks.back()->limit.remaining = walk.limit.remaining / workers;
+        walks.back()->members = files.size();
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::future<void>> futures;
+    for (unsigned w = 0; w < workers; ++w) {
+        futures.push_back(std::async(std::launch::async, [&, w]() {
+            ArchiveWalk& local = *walks[w];
+            for (size_t i = next++; i < files.size() && !local.exhausted(); i = next++) {
+                auto body = image.open_file(files[i], local.limit);
+                scan_member(*body, prefix + files[i].path, 0, local);
+            }
+        }));
+    }
+    for (auto& future : futures) future.wait();
+
+    uint64_t used = 0;
+    for (unsigned w = 0; w < workers; ++w) {
+        walk.stats.members += stats[w].members;
+        walk.stats.skipped += stats[w].skipped;
+        walk.stats.limited += stats[w].limited + walks[w]->limit.refused;
+        used += walk.limit.remaining / workers - walks[w]->limit.remaining;
+    }
+    walk.limit.remaining -= used;
+}
+
+ArchiveKind sniff_archive(const unsigned char* head, size_t len, uint64_t size) {
+    switch (sniff_stream_format(head, len)) {
+        case StreamFormat::Unknown:
+            return may_be_disk_image(head, len, size) ? ArchiveKind::DiskImage : ArchiveKind::None;
+        case StreamFormat::Zip: return ArchiveKind::Zip;
+        case StreamFormat::Bzip2: return ArchiveKind::None;
+        default: return ArchiveKind::Stream;
+    }
+}
+
+// scan_archive on its open descriptor, with its head already sniffed
+static bool scan_archive_fd(int fd, const std::string& path, uint64_t size, StreamFormat format, ArchiveKind kind,
+                            ArchiveWalk& walk, FileDigests* outer) {
+    if (kind == ArchiveKind::DiskImage) {
+        // ISOs, snaps and AppImages: read in place through the descriptor
+        std::unique_ptr<DiskImage> image = open_disk_image(fd, size);
+        if (image) scan_image(*image, path + "!", walk);
+        return image != nullptr;
+    }
+
+    if (kind == ArchiveKind::Zip) {
+        // libzip wants the central directory at the end first
+        int error = 0;
+        zip_t* za = zip_open(path.c_str(), ZIP_RDONLY, &error);
+        if (!za) {
+            walk.stats.skipped++;
+            return true;
+        }
+        scan_zip(za, path + "!", 0, walk);
+        zip_discard(za);
+        walk.stats.limited += walk.limit.refused;
+        return true;
+    }
+
+    // Everything else is read once, front to back, members and all
+    FdStream file(fd);
+    MemberStream whole(file, outer ? walk.algos : 0, false);
+    walk_stream(whole, format, path + "!", leaf_name(path), 0, walk);
+    walk.stats.limited += walk.limit.refused;
+    if (outer && whole.drain(walk.buffer) && whole.total == size && whole.digest->finish(*outer)) {
+        if (whole.content) outer->signature = whole.content->finish(fd, whole.total);
+        walk.stats.outer_hashed = true;
+    }
+    return true;
+}
+
+bool scan_archive(const std::string& path, unsigned algos, bool executables_only,
+                  const std::function<void(const ArchiveMember&)>& visit, ArchiveStats& stats,
+                  FileDigests* outer) {
+    // Only the magic decides; extensions are whatever the sender wanted
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    unsigned char head[STREAM_SNIFF_SIZE];
+    ssize_t n = fstat(fd, &st) == 0 ? pread(fd, head, sizeof(head), 0) : -1;
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+    StreamFormat format = n > 0 ? sniff_stream_format(head, static_cast<size_t>(n)) : StreamFormat::Unknown;
+    ArchiveKind kind = n > 0 ? sniff_archive(head, static_cast<size_t>(n), size) : ArchiveKind::None;
+    if (kind == ArchiveKind::None) {
+        close(fd);
+        return false;
+    }
+
+    bool opened;
+    {
+        // Unaligned preads and libzip rule out O_DIRECT, so a page-cache
+        // neutral scan drops what the walk read instead
+        PageCacheGuard guard(fd, size);
+        ArchiveWalk walk(algos, executables_only, visit, stats, size);
+        opened = scan_archive_fd(fd, path, size, format, kind, walk, outer);
+    }
+    close(fd);
+    return opened;
+}
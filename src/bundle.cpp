@@ -0,0 +1,225 @@
+#include "bundle.h"
+#include "scan.h"
+#include "filereader.h"
+#include "verdictcache.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+
+BundleIndex imported_bundle;
+
+static const size_t FINGERPRINT_BLOCKS = 8;
+static const unsigned BUNDLE_ALGOS = DIGEST_SHA256 | DIGEST_SHA1 | DIGEST_MD5 | DIGEST_ENTROPY;
+
+static std::string format_entropy(const EntropyStats& entropy) {
+    if (!entropy.measured) return "-";
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(4) << entropy.file << ',' << entropy.max_window << ','
+        << entropy.windows << ',' << entropy.high_windows;
+    return out.str();
+}
+
+static EntropyStats parse_entropy(const std::string& field) {
+    EntropyStats entropy;
+    if (field == "-") return entropy;
+    char* end = nullptr;
+    entropy.file = std::strtod(field.c_str(), &end);
+    if (*end != ',') return EntropyStats();
+    entropy.max_window = std::strtod(end + 1, &end);
+    if (*end != ',') return EntropyStats();
+    entropy.windows = static_cast<uint32_t>(std::strtoul(end + 1, &end, 10));
+    if (*end != ',') return EntropyStats();
+    entropy.high_windows = static_cast<uint32_t>(std::strtoul(end + 1, &end, 10));
+    entropy.measured = true;
+    return entropy;
+}
+
+std::string sample_fingerprint(int fd, uint64_t size, FileHead* head) {
+    MultiDigest digest(DIGEST_SHA256);
+    std::string header = std::to_string(size) + '\n';
+    digest.update(reinterpret_cast<const unsigned char*>(header.data()), header.size());
+
+    // Block-aligned offsets from the first block to the last, so O_DIRECT works
+    uint64_t last = size > READ_ALIGNMENT ? (size - 1) & ~static_cast<uint64_t>(READ_ALIGNMENT - 1) : 0;
+    uint64_t previous = UINT64_MAX;
+    if (head) head->len = 0;
+    for (size_t i = 0; i < FINGERPRINT_BLOCKS && size > 0; ++i) {
+        uint64_t offset = (last / (FINGERPRINT_BLOCKS - 1) * i) & ~static_cast<uint64_t>(READ_ALIGNMENT - 1);
+        if (i == FINGERPRINT_BLOCKS - 1) offset = last;
+        if (offset == previous) continue;
+        previous = offset;
+
+        uint64_t end = std::min<uint64_t>(offset + READ_ALIGNMENT, size);
+        ReadStatus status = read_fd_chunks(fd, offset, end,
+            [&](const unsigned char* data, size_t len) {
+                if (head && offset == 0) {
+                    size_t take = std::min(len, sizeof(head->bytes) - head->len);
+                    memcpy(head->bytes + head->len, data, take);
+                    head->len += take;
+                }
+                return digest.update(data, len);
+            });
+        if (status != ReadStatus::Ok) return "";
+    }
+
+    FileDigests out;
+    if (!digest.finish(out)) return "";
+    return out.sha256;
+}
+
+bool export_bundle(const std::string& root, const std::string& file) {
+    ContentDeduper deduper;
+    std::ofstream log_file("log.txt", std::ios::app);
+    if (!walk_directory(root, deduper, &log_file)) return false;
+    std::vector<ScanTarget> targets = deduper.take();
+
+    // One record per path; hashed on every core, written sorted afterwards
+    std::vector<std::vector<std::string>> records(targets.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < targets.size(); i = next++) {
+            const ScanTarget& target = targets[i];
+            int fd = open_for_scan(target.path.string());
+            if (fd < 0) continue;
+
+            FileDigests digests;
+            bool ok = digest_fd(fd, target.size, BUNDLE_ALGOS, digests);
+            std::string fingerprint = ok ? sample_fingerprint(fd, target.size) : "";
+            close(fd);
+            if (fingerprint.empty()) continue;
+
+            std::vector<std::filesystem::path> paths = target.aliases;
+            paths.insert(paths.begin(), target.path);
+            for (const auto& path : paths) {
+                // Reflinked copies share content but not necessarily mtime
+                struct stat st;
+                if (lstat(path.c_str(), &st) != 0) continue;
+                int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+                int64_t ctime_ns = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+
+                // As seen from a host booted off the image, not from the build machine
+                std::string host_path = "/" + path.lexically_relative(root).string();
+
+                std::ostringstream line;
+                line << digests.sha256 << '\t' << digests.sha1 << '\t' << digests.md5 << '\t'
+                     << fingerprint << '\t' << target.size << '\t' << mtime_ns << '\t' << ctime_ns << '\t'
+                     << st.st_ino << '\t' << format_entropy(digests.entropy) << '\t' << host_path;
+                records[i].push_back(line.str());
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < num_threads; ++i) threads.emplace_back(worker);
+    for (auto& thread : threads) thread.join();
+
+    std::vector<std::string> lines;
+    for (auto& record : records)
+        for (auto& line : record) lines.push_back(std::move(line));
+    std::sort(lines.begin(), lines.end());
+
+    std::ofstream out(file, std::ios::trunc);
+    if (!out) {
+        msg = "Error opening file: " + file;
+        return false;
+    }
+    out << BUNDLE_HEADER << "\n";
+    for (const auto& line : lines) out << line << "\n";
+    if (!out.flush()) {
+        msg = "Error writing file: " + file;
+        return false;
+    }
+    return true;
+}
+
+bool BundleIndex::load(const std::string& file) {
+    std::ifstream in(file);
+    std::string line;
+    if (!in || !std::getline(in, line) || line != BUNDLE_HEADER) {
+        msg = "Not a verdict bundle: " + file;
+        return false;
+    }
+
+    std::unordered_map<std::string, uint32_t> by_sha256;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::istringstream parts(line);
+        std::string field;
+        while (fields.size() < 9 && std::getline(parts, field, '\t')) fields.push_back(field);
+        std::string path;
+        std::getline(parts, path);      // paths may contain tabs
+        if (fields.size() < 9 || path.empty() || fields[0].size() != 64) continue;
+
+        auto content = by_sha256.find(fields[0]);
+        if (content == by_sha256.end()) {
+            Content c;
+            c.digests.sha256 = fields[0];
+            c.digests.sha1 = fields[1];
+            c.digests.md5 = fields[2];
+            c.fingerprint = fields[3];
+            c.digests.entropy = parse_entropy(fields[8]);
+            content = by_sha256.emplace(fields[0], static_cast<uint32_t>(contents.size())).first;
+            contents.push_back(std::move(c));
+        }
+
+        Entry& entry = entries[path];
+        entry.content = content->second;
+        entry.size = std::strtoull(fields[4].c_str(), nullptr, 10);
+        entry.mtime_ns = std::strtoll(fields[5].c_str(), nullptr, 10);
+        entry.ctime_ns = std::strtoll(fields[6].c_str(), nullptr, 10);
+        entry.ino = std::strtoull(fields[7].c_str(), nullptr, 10);
+    }
+    return true;
+}
+
+bool BundleIndex::lookup(const ScanTarget& target, unsigned algos, FileDigests& out, FileHead* head) const {
+    if (entries.empty()) return false;
+
+    auto it = entries.find(target.path.string());
+    for (size_t i = 0; it == entries.end() && i < target.aliases.size(); ++i)
+        it = entries.find(target.aliases[i].string());
+    if (it == entries.end()) return false;
+
+    const Entry& entry = it->second;
+    const Content& content = contents[entry.content];
+    if (entry.size != target.size || entry.mtime_ns != target.mtime_ns || entry.ctime_ns != target.ctime_ns)
+        return false;
+    // Bundles carry digests only; content signatures and fuzzy digests need the file read
+    if (((algos & DIGEST_SHA1) && content.digests.sha1.empty()) ||
+        ((algos & DIGEST_MD5) && content.digests.md5.empty()) || (algos & (DIGEST_CONTENT | DIGEST_FUZZY)))
+        return false;
+
+    // Same name, size, times and inode as on the image: nothing wrote to it
+    // since, as ctime can't be put back. The sampled blocks catch an image
+    // edited underneath the filesystem.
+    int fd = open_for_scan(target.path.string());
+    if (fd < 0) return false;
+    FileIdentity id;
+    if (!FileIdentity::from_fd(fd, id) || id.size != entry.size || id.ino != entry.ino ||
+        id.ctime_ns != entry.ctime_ns) {
+        close(fd);
+        return false;
+    }
+    if (verdict_cache.lookup(id, algos, out)) {
+        close(fd);
+        return true;
+    }
+    bool same = sample_fingerprint(fd, id.size, head) == content.fingerprint;
+    close(fd);
+    if (!same) {
+        if (head) head->len = 0;
+        return false;
+    }
+
+    out = content.digests;
+    unsigned stored = DIGEST_SHA256 | DIGEST_ENTROPY;
+    if (!out.sha1.empty()) stored |= DIGEST_SHA1;
+    if (!out.md5.empty()) stored |= DIGEST_MD5;
+    verdict_cache.store(id, stored, out);
+    return true;
+}
@@ -0,0 +1,321 @@
+#include "bytestream.h"
+#include <zlib.h>
+#include <lzma.h>
+#include <zstd.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Input buffered per decompressor
+static const size_t INFLATE_INPUT_SIZE = 64 * 1024;
+// Below this much output a high ratio is just well-compressed data
+static const uint64_t MIN_RATIO_CHECK_SIZE = 1 << 20;
+
+ssize_t read_full(ByteStream& in, unsigned char* out, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = in.read(out + got, len - got);
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += static_cast<size_t>(n);
+    }
+    return static_cast<ssize_t>(got);
+}
+
+bool skip_bytes(ByteStream& in, uint64_t len) {
+    unsigned char scratch[16 * 1024];
+    while (len > 0) {
+        ssize_t n = in.read(scratch, static_cast<size_t>(std::min<uint64_t>(len, sizeof(scratch))));
+        if (n <= 0) return false;
+        len -= static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool InflateLimit::charge(uint64_t produced, uint64_t in_total, uint64_t out_total) {
+    if (produced > remaining ||
+        (out_total > MIN_RATIO_CHECK_SIZE && out_total / std::max<uint64_t>(in_total, 1) > ratio)) {
+        if (produced > remaining) remaining = 0;
+        refused++;
+        return false;
+    }
+    remaining -= produced;
+    return true;
+}
+
+FdStream::FdStream(int fd) : fd(fd) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+ssize_t FdStream::read(unsigned char* out, size_t len) {
+    for (;;) {
+        ssize_t n = ::read(fd, out, len);
+        if (n >= 0 || errno != EINTR) return n;
+    }
+}
+
+ssize_t MemoryStream::read(unsigned char* out, size_t want) {
+    size_t n = std::min(want, len - pos);
+    memcpy(out, data + pos, n);
+    pos += n;
+    return static_cast<ssize_t>(n);
+}
+
+ssize_t PrefixStream::read(unsigned char* out, size_t len) {
+    if (pos < head.size()) {
+        size_t n = std::min(len, head.size() - pos);
+        memcpy(out, head.data() + pos, n);
+        pos += n;
+        return static_cast<ssize_t>(n);
+    }
+    return rest.read(out, len);
+}
+
+ssize_t SliceStream::read(unsigned char* out, size_t len) {
+    if (left == 0) return 0;
+    ssize_t n = parent.read(out, static_cast<size_t>(std::min<uint64_t>(len, left)));
+    if (n <= 0) return -1;  // the container ended inside a member
+    left -= static_cast<uint64_t>(n);
+    return n;
+}
+
+struct GzipStream::State {
+    ByteStream& in;
+    InflateLimit& limit;
+    z_stream zs{};
+    std::vector<unsigned char> input = std::vector<unsigned char>(INFLATE_INPUT_SIZE);
+    uint64_t in_total = 0;
+    uint64_t out_total = 0;
+    bool member_ended = false;
+    bool finished = false;
+    bool failed = false;
+
+    State(ByteStream& in, InflateLimit& limit) : in(in), limit(limit) {
+        // 32: take gzip or zlib headers, whichever is there
+        failed = inflateInit2(&zs, 15 + 32) != Z_OK;
+    }
+    ~State() { inflateEnd(&zs); }
+
+    // Tops up the input; false at the end of `in`
+    bool refill() {
+        ssize_t n = in.read(input.data(), input.size());
+        if (n < 0) failed = true;
+        if (n <= 0) return false;
+        zs.next_in = input.data();
+        zs.avail_in = static_cast<uInt>(n);
+        in_total += static_cast<uint64_t>(n);
+        return true;
+    }
+};
+
+GzipStream::GzipStream(ByteStream& in, InflateLimit& limit) : state(std::make_unique<State>(in, limit)) {}
+GzipStream::~GzipStream() = default;
+
+ssize_t GzipStream::read(unsigned char* out, size_t len) {
+    State& s = *state;
+    if (s.failed) return -1;
+    if (s.finished) return 0;
+    s.zs.next_out = out;
+    s.zs.avail_out = static_cast<uInt>(std::min<size_t>(len, 1u << 30));
+    const uInt want = s.zs.avail_out;
+    while (s.zs.avail_out == want) {
+        if (s.zs.avail_in == 0 && !s.refill()) {
+            // Ending between members is the normal end; inside one it isn't
+            if (s.failed || !s.member_ended) {
+                s.failed = true;
+                return -1;
+            }
+            s.finished = true;
+            return 0;
+        }
+        if (s.member_ended) {
+            // Another gzip member may follow; anything else is trailing padding
+            if (s.zs.next_in[0] != 0x1f) {
+                s.finished = true;
+                return 0;
+            }
+            inflateReset(&s.zs);
+            s.member_ended = false;
+        }
+        int rc = inflate(&s.zs, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            s.member_ended = true;
+        } else if (rc != Z_OK && !(rc == Z_BUF_ERROR && s.zs.avail_in == 0)) {
+            s.failed = true;
+            return -1;
+        }
+    }
+    size_t produced = want - s.zs.avail_out;
+    s.out_total += produced;
+    if (!s.limit.charge(produced, s.in_total, s.out_total)) {
+        s.failed = true;
+        return -1;
+    }
+    return static_cast<ssize_t>(produced);
+}
+
+struct XzStream::State {
+    ByteStream& in;
+    InflateLimit& limit;
+    lzma_stream xz = LZMA_STREAM_INIT;
+    std::vector<unsigned char> input = std::vector<unsigned char>(INFLATE_INPUT_SIZE);
+    uint64_t in_total = 0;
+    uint64_t out_total = 0;
+    bool input_ended = false;
+    bool ended = false;
+    bool failed = false;
+
+    State(ByteStream& in, InflateLimit& limit) : in(in), limit(limit) {
+        // The dictionary an archive can ask for is capped by the memory limit
+        failed = lzma_auto_decoder(&xz, 256ull << 20, LZMA_CONCATENATED) != LZMA_OK;
+    }
+    ~State() { lzma_end(&xz); }
+};
+
+XzStream::XzStream(ByteStream& in, InflateLimit& limit) : state(std::make_unique<State>(in, limit)) {}
+XzStream::~XzStream() = default;
+
+ssize_t XzStream::read(unsigned char* out, size_t len) {
+    State& s = *state;
+    if (s.failed) return -1;
+    if (s.ended) return 0;
+    s.xz.next_out = out;
+    s.xz.avail_out = len;
+    while (s.xz.avail_out == len) {
+        if (s.xz.avail_in == 0 && !s.input_ended) {
+            ssize_t n = s.in.read(s.input.data(), s.input.size());
+            if (n < 0) {
+                s.failed = true;
+                return -1;
+            }
+            if (n == 0) s.input_ended = true;
+            s.xz.next_in = s.input.data();
+            s.xz.avail_in = static_cast<size_t>(n);
+            s.in_total += static_cast<uint64_t>(n);
+        }
+        lzma_ret rc = lzma_code(&s.xz, s.input_ended ? LZMA_FINISH : LZMA_RUN);
+        if (rc == LZMA_STREAM_END) {
+            s.ended = true;
+            break;
+        }
+        if (rc != LZMA_OK) {
+            s.failed = true;
+            return -1;
+        }
+    }
+    size_t produced = len - s.xz.avail_out;
+    s.out_total += produced;
+    if (!s.limit.charge(produced, s.in_total, s.out_total)) {
+        s.failed = true;
+        return -1;
+    }
+    return static_cast<ssize_t>(produced);
+}
+
+struct ZstdStream::State {
+    ByteStream& in;
+    InflateLimit& limit;
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    std::vector<unsigned char> input = std::vector<unsigned char>(INFLATE_INPUT_SIZE);
+    ZSTD_inBuffer src = {nullptr, 0, 0};
+    uint64_t in_total = 0;
+    uint64_t out_total = 0;
+    bool input_ended = false;
+    bool frame_ended = false;
+    bool ended = false;
+    bool failed = false;
+
+    State(ByteStream& in, InflateLimit& limit) : in(in), limit(limit) {
+        // Frames asking for a window over 128 MiB are refused, as xz
+        // dictionaries are by the memory limit
+        failed = !zs || ZSTD_isError(ZSTD_initDStream(zs)) ||
+                 ZSTD_isError(ZSTD_DCtx_setParameter(zs, ZSTD_d_windowLogMax, 27));
+    }
+    ~State() { ZSTD_freeDStream(zs); }
+};
+
+ZstdStream::ZstdStream(ByteStream& in, InflateLimit& limit) : state(std::make_unique<State>(in, limit)) {}
+ZstdStream::~ZstdStream() = default;
+
+ssize_t ZstdStream::read(unsigned char* out, size_t len) {
+    State& s = *state;
+    if (s.failed) return -1;
+    if (s.ended) return 0;
+    ZSTD_outBuffer dst = {out, len, 0};
+    while (dst.pos == 0) {
+        if (s.src.pos == s.src.size && !s.input_ended) {
+            ssize_t n = s.in.read(s.input.data(), s.input.size());
+            if (n < 0) {
+                s.failed = true;
+                return -1;
+            }
+            if (n == 0) s.input_ended = true;
+            s.src = {s.input.data(), static_cast<size_t>(n), 0};
+            s.in_total += static_cast<uint64_t>(n);
+        }
+        const size_t consumed = s.src.pos;
+        size_t rc = ZSTD_decompressStream(s.zs, &dst, &s.src);
+        if (ZSTD_isError(rc)) {
+            s.failed = true;
+            return -1;
+        }
+        // 0: a frame is complete and all of it flushed. A call that did
+        // nothing says nothing about that.
+        if (s.src.pos != consumed || dst.pos != 0) s.frame_ended = rc == 0;
+        if (dst.pos == 0 && s.src.pos == s.src.size && s.input_ended) {
+            // Ending between frames is the normal end; inside one it isn't
+            if (!s.frame_ended) {
+                s.failed = true;
+                return -1;
+            }
+            s.ended = true;
+            break;
+        }
+    }
+    s.out_total += dst.pos;
+    if (!s.limit.charge(dst.pos, s.in_total, s.out_total)) {
+        s.failed = true;
+        return -1;
+    }
+    return static_cast<ssize_t>(dst.pos);
+}
+
+bool tar_checksum_ok(const unsigned char* block) {
+    // The stored sum is octal, taken with the checksum field as spaces
+    unsigned long stored = 0;
+    bool digits = false;
+    for (int i = 148; i < 156; ++i) {
+        if (block[i] >= '0' && block[i] <= '7') {
+            stored = stored * 8 + (block[i] - '0');
+            digits = true;
+        } else if (digits || (block[i] != ' ' && block[i] != 0)) {
+            break;
+        }
+    }
+    if (!digits) return false;
+    unsigned long sum = 0;
+    for (int i = 0; i < 512; ++i) sum += (i >= 148 && i < 156) ? ' ' : block[i];
+    return sum == stored;
+}
+
+StreamFormat sniff_stream_format(const unsigned char* head, size_t len) {
+    auto starts = [&](const char* magic, size_t n) { return len >= n && memcmp(head, magic, n) == 0; };
+    if (starts("\x1f\x8b", 2)) return StreamFormat::Gzip;
+    if (starts("\xfd" "7zXZ\0", 6)) return StreamFormat::Xz;
+    if (starts("\x28\xb5\x2f\xfd", 4)) return StreamFormat::Zstd;
+    if (starts("BZh", 3)) return StreamFormat::Bzip2;
+    if (starts("!<arch>\n", 8)) return StreamFormat::Ar;
+    if (starts("070701", 6) || starts("070702", 6)) return StreamFormat::Cpio;
+    if (starts("\xed\xab\xee\xdb", 4)) return StreamFormat::Rpm;
+    if (starts("PK\x03\x04", 4)) return StreamFormat::Zip;
+    if (len >= 512 && (memcmp(head + 257, "ustar", 5) == 0 || tar_checksum_ok(head)) && head[0] != 0)
+        return StreamFormat::Tar;
+    return StreamFormat::Unknown;
+}
+
+bool is_compressed_format(StreamFormat format) {
+    return format == StreamFormat::Gzip || format == StreamFormat::Xz ||
+           format == StreamFormat::Zstd || format == StreamFormat::Bzip2;
+}
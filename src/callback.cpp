@@ -22,6 +22,29 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     mouseY = HEIGHT - ypos; // Flip y-coordinate to match OpenGL's coordinate system
 }
 
+// Opens log.txt in the platform's text viewer
+static void open_log() {
+    const char* logFileName = "log.txt";
+
+#ifdef _WIN32
+    // Windows
+    std::string command = "notepad " + std::string(logFileName);
+#elif __APPLE__
+    // macOS
+    std::string command = "open -e " + std::string(logFileName);
+#elif __linux__
+    // Linux
+    std::string command = "xdg-open " + std::string(logFileName);
+#else
+    #error "Unsupported operating system"
+#endif
+
+    int result = system(command.c_str());
+    if (result != 0) {
+        std::cerr << "Failed to open the log file." << std::endl;
+    }
+}
+
 // Callback for mouse button events
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
@@ -60,14 +83,14 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
                         if (file) {
                             std::cout << "Selected file: " << file << std::endl;
                             // Start scanning the selected file
-                            std::thread scan_thread(scan_file, file, std::ref(hash_set));
+                            std::thread scan_thread(scan_file, file, std::ref(hash_store));
                             scan_thread.detach();  // Detach the thread so it can run independently
                         }
                         else {
                             std::cout << "No file selected" << std::endl;
                         }
                     }
-                    else if (button.getId() == "Fullscan") {
+                    else if (button.getId() == "Fullscan" || button.getId() == "Quick") {
                         std::string path = "";
 #ifdef __linux__
                         std::string pcName = getenv("USER");
@@ -80,30 +103,36 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 #endif
 
                         // Start scanning in a separate thread
-                        std::thread scan_thread(scan_directory, path, std::ref(hash_set));
+                        // Quick only hashes executables, scripts and macro documents
+                        ScanMode mode = button.getId() == "Quick" ? ScanMode::Quick : ScanMode::Full;
+                        std::thread scan_thread(scan_directory, path, std::ref(hash_store), mode);
                         scan_thread.detach();  // Detach the thread so it can run independently
                     }
                     else if (button.getId() == "Log")
                     {
-                        const char* logFileName = "log.txt";
-    
-#ifdef _WIN32
-                        // Windows
-                        std::string command = "notepad " + std::string(logFileName);
-#elif __APPLE__
-                        // macOS
-                        std::string command = "open -e " + std::string(logFileName);
-#elif __linux__
-                        // Linux
-                        std::string command = "xdg-open " + std::string(logFileName);
-#else
-                        #error "Unsupported operating system"
-#endif
-
-                        int result = system(command.c_str());
-                        if (result != 0) {
-                            std::cerr << "Failed to open the log file." << std::endl;
-                        }
+                        open_log();
+                    }
+                }
+            }
+        }
+        else if (network)
+        {
+            for (const auto& button : networkButtons) {
+                if (mouseX >= button.getX() && mouseX <= button.getX() + button.getWidth() &&
+                    mouseY >= button.getY() && mouseY <= button.getY() + button.getHeight()) {
+                    if (button.getId() == "Processes") {
+                        // Check what is running right now: executables and their libraries
+                        std::thread scan_thread(scan_processes, std::ref(hash_store));
+                        scan_thread.detach();
+                    }
+                    else if (button.getId() == "Memory") {
+                        // Injected code and fileless payloads that no file holds
+                        std::thread scan_thread(scan_memory);
+                        scan_thread.detach();
+                    }
+                    else if (button.getId() == "Log")
+                    {
+                        open_log();
                     }
                 }
             }
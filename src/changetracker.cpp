@@ -0,0 +1,474 @@
+#include "changetracker.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <mntent.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#endif
+
+ChangeTracker change_tracker;
+
+// How often the state file is rewritten, and how old it may be before a
+// reader stops trusting it
+static const int SAVE_INTERVAL_MS = 5000;
+static const time_t STATE_MAX_AGE = 30;
+
+static bool under_root(const std::string& path, const std::string& root) {
+    if (root == "/") return !path.empty() && path[0] == '/';
+    return path.compare(0, root.size(), root) == 0 &&
+           (path.size() == root.size() || path[root.size()] == '/');
+}
+
+static bool line_safe(const std::string& path) {
+    return path.find_first_of("\n\t") == std::string::npos;
+}
+
+ChangeTracker::~ChangeTracker() {
+    stop();
+}
+
+std::string ChangeTracker::backend() const {
+    switch (mode) {
+        case Backend::Fanotify: return "fanotify";
+        case Backend::Inotify: return "inotify";
+        default: return "none";
+    }
+}
+
+void ChangeTracker::mark_dirty(const std::string& path) {
+    if (!under_root(path, root)) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    dirty[path] = time(nullptr);
+}
+
+void ChangeTracker::begin_full_walk(const std::string& root_path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running()) return;
+    walk_root = root_path;
+    walk_started = time(nullptr);
+    walk_overflowed = false;
+    // A walk that starts before every watch is in place can't be a baseline
+    walk_watching = watching;
+}
+
+void ChangeTracker::end_full_walk(const std::string& root_path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running() || walk_root != root_path) return;
+    // What changed before the walk started was seen by it. From its first
+    // second on the walk may have looked too early, so that stays.
+    for (auto it = dirty.begin(); it != dirty.end();) {
+        if (under_root(it->first, walk_root) && it->second < walk_started) it = dirty.erase(it);
+        else ++it;
+    }
+    overflowed = walk_overflowed;
+    baseline = walk_watching ? walk_root : "";
+    walk_root.clear();
+}
+
+bool ChangeTracker::peek_dirty(const std::string& scan_root, std::vector<std::string>& out, time_t& as_of) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running() || !watching || overflowed || incomplete || baseline.empty() ||
+        !under_root(scan_root, baseline))
+        return false;
+
+    as_of = time(nullptr);
+    for (const auto& entry : dirty)
+        if (under_root(entry.first, scan_root)) out.push_back(entry.first);
+    return true;
+}
+
+void ChangeTracker::drop_dirty(const std::string& scan_root, time_t as_of) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Changed again since the scan took it, or in that same second: keep
+    for (auto it = dirty.begin(); it != dirty.end();) {
+        if (under_root(it->first, scan_root) && it->second < as_of) it = dirty.erase(it);
+        else ++it;
+    }
+}
+
+void ChangeTracker::save_state() {
+    if (state_path.empty()) return;
+
+    // Drop what another process has already scanned from our last save
+    time_t consumed = 0;
+    std::ifstream marker(state_path + ".consumed");
+    if (marker >> consumed) {
+        marker.close();
+        std::remove((state_path + ".consumed").c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (consumed > 0) {
+        for (auto it = dirty.begin(); it != dirty.end();) {
+            if (it->second < consumed) it = dirty.erase(it);
+            else ++it;
+        }
+    }
+
+    // One line per path: a name with a newline or tab in it can't be
+    // written, so readers are told to walk instead of missing it
+    bool unwritable = !line_safe(baseline);
+    for (const auto& entry : dirty)
+        if (!line_safe(entry.first)) unwritable = true;
+
+    std::string tmp = state_path + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out) return;
+    out << "# AntiVirus change tracker state\n";
+    out << "root " << root << "\n";
+    out << "heartbeat " << time(nullptr) << "\n";
+    out << "overflow " << ((overflowed || incomplete || !watching || unwritable) ? 1 : 0) << "\n";
+    out << "baseline " << (baseline.empty() || unwritable ? "-" : baseline) << "\n";
+    if (!unwritable) {
+        for (const auto& entry : dirty)
+            out << entry.second << "\t" << entry.first << "\n";
+    }
+    out.close();
+    std::rename(tmp.c_str(), state_path.c_str());
+}
+
+#ifdef __linux__
+
+std::vector<std::string> local_mounts(const std::string& root) {
+    static const char* pseudo[] = {
+        "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "mqueue", "debugfs",
+        "tracefs", "securityfs", "pstore", "bpf", "autofs", "configfs", "fusectl",
+        "hugetlbfs", "binfmt_misc", "nsfs", "efivarfs", "selinuxfs", "rpc_pipefs"
+    };
+
+    std::vector<std::string> dirs;
+    FILE* mounts = setmntent("/proc/self/mounts", "r");
+    if (!mounts) return dirs;
+
+    while (struct mntent* m = getmntent(mounts)) {
+        std::string dir = m->mnt_dir;
+        // Mounts below the root, and the one the root itself lives on
+        if (!under_root(dir, root) && !under_root(root, dir)) continue;
+
+        bool skip = false;
+        for (const char* type : pseudo) skip = skip || strcmp(m->mnt_type, type) == 0;
+        if (!skip) dirs.push_back(dir);
+    }
+    endmntent(mounts);
+    return dirs;
+}
+
+bool ChangeTracker::start(const std::string& watch_root, const std::string& state_file) {
+    if (running()) return true;
+    root = watch_root;
+    state_path = state_file;
+
+    // Paths left over from the previous session still need a look, but the
+    // gap since then means the next scan must be a full walk anyway
+    std::ifstream previous(state_path);
+    std::string line;
+    while (std::getline(previous, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos) continue;
+        dirty[line.substr(tab + 1)] = static_cast<time_t>(std::atoll(line.c_str()));
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) return false;
+
+    if (start_fanotify()) mode = Backend::Fanotify;
+    else if (start_inotify()) mode = Backend::Inotify;
+    else {
+        close(stop_fd);
+        stop_fd = -1;
+        return false;
+    }
+
+    worker = std::thread(&ChangeTracker::run, this);
+    return true;
+}
+
+void ChangeTracker::stop() {
+    if (!running()) return;
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) { /* the worker also polls on a timeout */ }
+    worker.join();
+    save_state();
+
+    for (auto& mount : mount_fds) close(mount.second);
+    mount_fds.clear();
+    watches.clear();
+    close(notify_fd);
+    close(stop_fd);
+    notify_fd = stop_fd = -1;
+    mode = Backend::None;
+    watching = false;
+}
+
+bool ChangeTracker::start_fanotify() {
+    notify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+                              O_RDONLY | O_LARGEFILE);
+    if (notify_fd < 0) return false;
+
+    const uint64_t mask = FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_CREATE |
+                          FAN_MOVED_TO | FAN_ONDIR;
+
+    bool ok = true;
+    for (const std::string& dir : local_mounts(root)) {
+        if (fanotify_mark(notify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, dir.c_str()) != 0) {
+            ok = false;
+            break;
+        }
+
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct statfs sfs;
+        if (fd >= 0 && fstatfs(fd, &sfs) == 0) {
+            int fsid[2];
+            memcpy(fsid, &sfs.f_fsid, sizeof(fsid));
+            if (!mount_fds.emplace(std::make_pair(fsid[0], fsid[1]), fd).second) close(fd);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    if (!ok || mount_fds.empty()) {
+        for (auto& mount : mount_fds) close(mount.second);
+        mount_fds.clear();
+        close(notify_fd);
+        notify_fd = -1;
+        return false;
+    }
+
+    watching = true;
+    return true;
+}
+
+bool ChangeTracker::start_inotify() {
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return notify_fd >= 0;
+}
+
+void ChangeTracker::add_inotify_tree(const std::string& dir) {
+    const uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_MOVED_TO | IN_DONT_FOLLOW;
+
+    auto watch = [&](const std::string& path) {
+        int wd = inotify_add_watch(notify_fd, path.c_str(), mask);
+        if (wd < 0) {
+            // Out of watches (ENOSPC): this tree can't be tracked completely
+            if (errno == ENOSPC || errno == ENOMEM) {
+                std::lock_guard<std::mutex> lock(mutex);
+                incomplete = true;
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        watches[wd] = path;
+    };
+
+    watch(dir);
+    std::error_code ec;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(dir, options, ec);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+        if (it->is_directory(ec) && !it->is_symlink(ec)) {
+            std::string path = it->path().string();
+            if (path == "/proc" || path == "/sys") {
+                it.disable_recursion_pending();
+                continue;
+            }
+            watch(path);
+        }
+    }
+}
+
+void ChangeTracker::read_fanotify() {
+    alignas(struct fanotify_event_metadata) char buffer[64 * 1024];
+    for (;;) {
+        ssize_t len = read(notify_fd, buffer, sizeof(buffer));
+        if (len <= 0) return;
+
+        auto* md = reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+        for (; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+            if (md->mask & FAN_Q_OVERFLOW) {
+                std::lock_guard<std::mutex> lock(mutex);
+                overflowed = walk_overflowed = true;
+                continue;
+            }
+
+            auto* info = reinterpret_cast<struct fanotify_event_info_fid*>(md + 1);
+            if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) continue;
+
+            auto mount = mount_fds.find(std::make_pair(info->fsid.val[0], info->fsid.val[1]));
+            if (mount == mount_fds.end()) continue;
+
+            auto* handle = reinterpret_cast<struct file_handle*>(info->handle);
+            const char* name = reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes);
+
+            int dir_fd = open_by_handle_at(mount->second, handle, O_PATH | O_CLOEXEC);
+            if (dir_fd < 0) {
+                // Directory already gone or unresolvable: we can't name what changed
+                if (errno != ESTALE) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    overflowed = walk_overflowed = true;
+                }
+                continue;
+            }
+
+            char dir_path[PATH_MAX];
+            std::string link = "/proc/self/fd/" + std::to_string(dir_fd);
+            ssize_t n = readlink(link.c_str(), dir_path, sizeof(dir_path) - 1);
+            close(dir_fd);
+            if (n <= 0) continue;
+            dir_path[n] = '\0';
+
+            std::string path = dir_path;
+            if (strcmp(name, ".") != 0) path += (path == "/" ? "" : "/") + std::string(name);
+            mark_dirty(path);
+        }
+    }
+}
+
+void ChangeTracker::read_inotify() {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        ssize_t len = read(notify_fd, buffer, sizeof(buffer));
+        if (len <= 0) return;
+
+        for (char* p = buffer; p < buffer + len;) {
+            auto* ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                std::lock_guard<std::mutex> lock(mutex);
+                overflowed = walk_overflowed = true;
+                continue;
+            }
+
+            std::string dir;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = watches.find(ev->wd);
+                if (it == watches.end()) continue;
+                dir = it->second;
+                if (ev->mask & IN_IGNORED) {
+                    watches.erase(it);
+                    continue;
+                }
+            }
+
+            std::string path = ev->len ? dir + (dir == "/" ? "" : "/") + ev->name : dir;
+            mark_dirty(path);
+
+            // New directories need watches of their own before anything lands in them
+            if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                add_inotify_tree(path);
+        }
+    }
+}
+
+void ChangeTracker::run() {
+    if (mode == Backend::Inotify) {
+        add_inotify_tree(root);
+        std::lock_guard<std::mutex> lock(mutex);
+        watching = true;
+    }
+
+    struct pollfd fds[2] = { { notify_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+    auto last_save = std::chrono::steady_clock::now();
+    for (;;) {
+        int rc = poll(fds, 2, SAVE_INTERVAL_MS);
+        if (rc < 0 && errno != EINTR) break;
+        if (fds[1].revents & POLLIN) break;
+
+        if (fds[0].revents & POLLIN) {
+            if (mode == Backend::Fanotify) read_fanotify();
+            else read_inotify();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_save >= std::chrono::milliseconds(SAVE_INTERVAL_MS)) {
+            save_state();
+            last_save = now;
+        }
+    }
+}
+
+#else
+
+std::vector<std::string> local_mounts(const std::string&) { return {}; }
+bool ChangeTracker::start(const std::string&, const std::string&) { return false; }
+void ChangeTracker::stop() {}
+void ChangeTracker::run() {}
+bool ChangeTracker::start_fanotify() { return false; }
+bool ChangeTracker::start_inotify() { return false; }
+void ChangeTracker::add_inotify_tree(const std::string&) {}
+void ChangeTracker::read_fanotify() {}
+void ChangeTracker::read_inotify() {}
+
+#endif
+
+bool tracked_changes(const std::string& scan_root, const std::string& state_file, TrackedChanges& out) {
+    out = TrackedChanges();
+    out.root = scan_root;
+    if (change_tracker.running()) return change_tracker.peek_dirty(scan_root, out.paths, out.as_of);
+
+    // A tracker in another process (e.g. the daemon) publishes its set here
+    std::ifstream in(state_file);
+    if (!in) return false;
+
+    std::string line, key, value;
+    time_t heartbeat = 0;
+    bool overflow = true;
+    std::string baseline;
+    std::vector<std::string> paths;
+    bool in_entries = false;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            in_entries = true;
+            std::string path = line.substr(tab + 1);
+            if (under_root(path, scan_root)) paths.push_back(path);
+            continue;
+        }
+        // Keys only come before the entries; anything else there is a torn file
+        if (in_entries) return false;
+        std::istringstream fields(line);
+        fields >> key;
+        std::getline(fields >> std::ws, value);
+        if (key == "heartbeat") heartbeat = static_cast<time_t>(std::atoll(value.c_str()));
+        else if (key == "overflow") overflow = value != "0";
+        else if (key == "baseline") baseline = value;
+    }
+
+    if (overflow || baseline == "-" || !under_root(scan_root, baseline) ||
+        time(nullptr) - heartbeat > STATE_MAX_AGE)
+        return false;
+
+    out.paths = std::move(paths);
+    out.state_file = state_file;
+    out.as_of = heartbeat;
+    return true;
+}
+
+void consume_tracked_changes(const TrackedChanges& changes) {
+    if (changes.state_file.empty()) {
+        change_tracker.drop_dirty(changes.root, changes.as_of);
+        return;
+    }
+    // Tell the other tracker everything up to that heartbeat has been looked at
+    std::ofstream consumed(changes.state_file + ".consumed", std::ios::trunc);
+    consumed << changes.as_of << "\n";
+}
@@ -0,0 +1,227 @@
+#include "container.h"
+#include "scan.h"
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <cctype>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+
+std::atomic<bool> scan_containers(false);
+ContainerIndex container_index;
+
+// Length of the IDs docker, containerd, CRI-O and podman put in cgroup paths
+static const size_t FULL_ID_LENGTH = 64;
+static const size_t SHORT_ID_LENGTH = 12;
+
+struct OverlayMount {
+    std::string mount_point;
+    std::vector<std::string> lower_dirs;
+    std::string upper_dir;
+};
+
+// mountinfo writes space, tab, newline, backslash and (in mount options)
+// comma as \ooo; overlay additionally escapes ':' inside layer paths as "\:"
+static std::string unescape(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 3 < s.size() && isdigit(static_cast<unsigned char>(s[i + 1])) &&
+            isdigit(static_cast<unsigned char>(s[i + 2])) && isdigit(static_cast<unsigned char>(s[i + 3]))) {
+            out += static_cast<char>((s[i + 1] - '0') * 64 + (s[i + 2] - '0') * 8 + (s[i + 3] - '0'));
+            i += 3;
+        } else if (s[i] == '\\' && i + 1 < s.size()) {
+            out += s[++i];
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+// Splits at every `sep` not escaped by a backslash, dropping empty parts
+// (overlay's "::" marks data-only layers, which hold files too)
+static std::vector<std::string> split_escaped(const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 1 < s.size()) {
+            part += s[i];
+            part += s[++i];
+        } else if (s[i] == sep) {
+            if (!part.empty()) parts.push_back(part);
+            part.clear();
+        } else {
+            part += s[i];
+        }
+    }
+    if (!part.empty()) parts.push_back(part);
+    return parts;
+}
+
+// The overlay mounts of one mount namespace. mountinfo(5) lines read
+// "id parent major:minor root mount-point options [tags...] - fstype source superoptions".
+static std::vector<OverlayMount> overlay_mounts(const std::string& mountinfo_path) {
+    std::vector<OverlayMount> mounts;
+    std::ifstream mountinfo(mountinfo_path);
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        std::istringstream fields(line);
+        std::string id, parent, dev, root, mount_point, field;
+        if (!(fields >> id >> parent >> dev >> root >> mount_point)) continue;
+        while (fields >> field && field != "-") {}
+        std::string fstype, source, options;
+        if (!(fields >> fstype >> source >> options) || fstype != "overlay") continue;
+
+        OverlayMount mount;
+        mount.mount_point = unescape(mount_point);
+        for (const auto& option : split_escaped(options, ',')) {
+            size_t eq = option.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = option.substr(0, eq), value = option.substr(eq + 1);
+            if (key == "lowerdir") {
+                for (const auto& dir : split_escaped(value, ':')) mount.lower_dirs.push_back(unescape(dir));
+            } else if (key == "lowerdir+" || key == "datadir+") {
+                // Kernels since 6.8 may list one layer per option instead
+                mount.lower_dirs.push_back(unescape(value));
+            } else if (key == "upperdir") {
+                mount.upper_dir = unescape(value);
+            }
+        }
+        mounts.push_back(std::move(mount));
+    }
+    return mounts;
+}
+
+// The container a process runs in, from the last 64-hex-digit name in its
+// cgroup path (docker-<id>.scope, /docker/<id>, cri-containerd-<id>.scope,
+// crio-<id>.scope, libpod-<id>.scope, /kubepods/.../<id>). "" on the host.
+static std::string container_id(const std::string& pid) {
+    std::ifstream cgroup("/proc/" + pid + "/cgroup");
+    std::string line, id;
+    while (std::getline(cgroup, line)) {
+        size_t colon = line.find(':', line.find(':') + 1);
+        if (colon == std::string::npos) continue;
+        std::string path = line.substr(colon + 1);
+        size_t run = 0;
+        for (size_t i = 0; i <= path.size(); ++i) {
+            char c = i < path.size() ? path[i] : '/';
+            if (isdigit(static_cast<unsigned char>(c)) || (c >= 'a' && c <= 'f')) {
+                run++;
+                continue;
+            }
+            if (run == FULL_ID_LENGTH) id = path.substr(i - run, SHORT_ID_LENGTH);
+            run = 0;
+        }
+    }
+    return id;
+}
+
+// Layer paths as the runtime's own namespace saw them, made absolute and
+// free of symlinks (docker's lowerdirs are short links under overlay2/l)
+// so they match the paths a walk of the host reaches
+static bool resolve_layer(std::string& dir, const std::filesystem::path& base) {
+    std::filesystem::path path = dir;
+    if (path.is_relative()) {
+        if (base.empty()) return false;
+        path = base / path;
+    }
+    std::error_code ec;
+    auto real = std::filesystem::canonical(path, ec);
+    if (ec || !std::filesystem::is_directory(real, ec)) return false;
+    dir = real.string();
+    return true;
+}
+
+bool ContainerIndex::discover() {
+    found.clear();
+    layer_owners.clear();
+    pruned_dirs.clear();
+
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        msg = "Error: Cannot read /proc to find containers";
+        return false;
+    }
+    // Where the host sees each container's merged root, by upper dir
+    std::unordered_map<std::string, std::vector<std::string>> merged_views;
+    for (auto& mount : overlay_mounts("/proc/self/mountinfo")) {
+        if (!mount.upper_dir.empty() && resolve_layer(mount.upper_dir, {}))
+            merged_views[mount.upper_dir].push_back(mount.mount_point);
+    }
+    // Running inside a container, our own one is what the main walk sees
+    struct stat host_root;
+    if (stat("/", &host_root) != 0) host_root = {};
+    const std::string own_id = container_id("self");
+    std::set<std::string> seen;
+    while (dirent* entry = readdir(proc)) {
+        std::string pid = entry->d_name;
+        if (pid.empty() || pid.find_first_not_of("0123456789") != std::string::npos) continue;
+        std::string id = container_id(pid);
+        if (id.empty() || id == own_id) continue;
+        // Every process of a container shows its whole filesystem again
+        pruned_dirs.insert("/proc/" + pid + "/root");
+        if (!seen.insert(id).second) continue;
+
+        Container container;
+        container.id = id;
+        container.pid = static_cast<pid_t>(std::atoi(pid.c_str()));
+        for (auto& mount : overlay_mounts("/proc/" + pid + "/mountinfo")) {
+            if (mount.mount_point != "/" || mount.upper_dir.empty()) continue;
+            // Relative lowerdirs are relative to the storage root the runtime
+            // mounted from: overlay2/ for docker, two levels above the upper dir
+            std::filesystem::path base = std::filesystem::path(mount.upper_dir).parent_path().parent_path();
+            bool reachable = resolve_layer(mount.upper_dir, {});
+            for (auto& dir : mount.lower_dirs) reachable = reachable && resolve_layer(dir, base);
+            if (reachable) {
+                container.lower_dirs = std::move(mount.lower_dirs);
+                container.upper_dir = std::move(mount.upper_dir);
+            }
+        }
+
+        if (container.upper_dir.empty()) {
+            // Not overlay, or its layers live in another mount namespace
+            // (rootless podman): read it through the process's view instead,
+            // unless that is just the host's own root
+            container.root = "/proc/" + pid + "/root";
+            struct stat root_st;
+            if (stat(container.root.c_str(), &root_st) != 0 ||
+                (root_st.st_dev == host_root.st_dev && root_st.st_ino == host_root.st_ino))
+                continue;
+            layer_owners[container.root].push_back(id);
+        } else {
+            for (const auto& dir : container.lower_dirs) layer_owners[dir].push_back(id);
+            layer_owners[container.upper_dir].push_back(id);
+            // The merged view the host sees of its root shows the same files
+            // under the overlay's own device numbers
+            for (const auto& view : merged_views[container.upper_dir]) pruned_dirs.insert(view);
+        }
+        found.push_back(std::move(container));
+    }
+    closedir(proc);
+    return true;
+}
+
+std::vector<std::string> ContainerIndex::layer_dirs() const {
+    std::vector<std::string> dirs;
+    std::set<std::string> listed;
+    for (const auto& container : found) {
+        for (const auto& dir : container.lower_dirs)
+            if (listed.insert(dir).second) dirs.push_back(dir);
+    }
+    for (const auto& container : found) {
+        const std::string& dir = container.upper_dir.empty() ? container.root : container.upper_dir;
+        if (listed.insert(dir).second) dirs.push_back(dir);
+    }
+    return dirs;
+}
+
+std::vector<std::string> ContainerIndex::owners(const std::filesystem::path& path) const {
+    if (layer_owners.empty()) return {};
+    for (auto dir = path.parent_path(); !dir.empty(); dir = dir.parent_path()) {
+        auto it = layer_owners.find(dir.string());
+        if (it != layer_owners.end()) return it->second;
+        if (dir == dir.root_path()) break;
+    }
+    return {};
+}
@@ -0,0 +1,108 @@
+#include "dedup.h"
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+std::atomic<bool> reflink_dedup(false);
+
+// Reflinking only pays off for files bigger than a few blocks
+static const uint64_t MIN_REFLINK_SIZE = 64 * 1024;
+
+ScanTarget::ScanTarget(const std::filesystem::path& p, const struct stat& st)
+    : path(p),
+      dev(static_cast<uint64_t>(st.st_dev)),
+      ino(static_cast<uint64_t>(st.st_ino)),
+      size(static_cast<uint64_t>(st.st_size)),
+      mtime_ns(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec),
+      ctime_ns(static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec),
+      mode(static_cast<uint32_t>(st.st_mode)) {}
+
+bool ContentDeduper::add(const std::filesystem::path& path, const struct stat& st) {
+    auto inode = std::make_pair(static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino));
+    auto it = by_inode.find(inode);
+    if (it != by_inode.end()) {
+        ScanTarget& target = targets[it->second];
+        // The same path reported twice (e.g. a changed file inside a new directory)
+        if (target.path == path ||
+            std::find(target.aliases.begin(), target.aliases.end(), path) != target.aliases.end())
+            return false;
+        target.aliases.push_back(path);
+        folded_paths++;
+        return true;
+    }
+
+    if (reflink_dedup && static_cast<uint64_t>(st.st_size) >= MIN_REFLINK_SIZE) {
+        std::string key = extent_fingerprint(path.string(), st);
+        if (!key.empty()) {
+            auto ext = by_extents.find(key);
+            if (ext != by_extents.end()) {
+                targets[ext->second].aliases.push_back(path);
+                by_inode.emplace(inode, ext->second);
+                folded_paths++;
+                return true;
+            }
+            by_extents.emplace(key, targets.size());
+        }
+    }
+
+    by_inode.emplace(inode, targets.size());
+    targets.emplace_back(path, st);
+    return true;
+}
+
+std::vector<ScanTarget> ContentDeduper::take() {
+    by_inode.clear();
+    by_extents.clear();
+    folded_paths = 0;
+    return std::move(targets);
+}
+
+#ifdef __linux__
+
+std::string extent_fingerprint(const std::string& path, const struct stat& st) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) return "";
+
+    const unsigned MAX_EXTENTS = 256;
+    std::vector<char> buffer(sizeof(struct fiemap) + MAX_EXTENTS * sizeof(struct fiemap_extent));
+    struct fiemap* map = reinterpret_cast<struct fiemap*>(buffer.data());
+    map->fm_start = 0;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    // SYNC flushes dirty pages first so the map reflects what a read returns
+    map->fm_flags = FIEMAP_FLAG_SYNC;
+    map->fm_extent_count = MAX_EXTENTS;
+
+    int rc = ioctl(fd, FS_IOC_FIEMAP, map);
+    close(fd);
+    if (rc != 0 || map->fm_mapped_extents == 0 || map->fm_mapped_extents >= MAX_EXTENTS) return "";
+
+    const unsigned untrusted = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |
+                               FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED |
+                               FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_DATA_INLINE |
+                               FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_UNWRITTEN;
+
+    std::ostringstream key;
+    key << st.st_dev << ':' << st.st_size;
+    for (unsigned i = 0; i < map->fm_mapped_extents; ++i) {
+        const struct fiemap_extent& e = map->fm_extents[i];
+        // Only extents shared with another file can make two files identical
+        if ((e.fe_flags & untrusted) || !(e.fe_flags & FIEMAP_EXTENT_SHARED)) return "";
+        key << ';' << e.fe_logical << ',' << e.fe_physical << ',' << e.fe_length;
+    }
+    // Holes sit at the same logical offsets too, so equal keys mean equal bytes
+    return key.str();
+}
+
+#else
+
+std::string extent_fingerprint(const std::string&, const struct stat&) { return ""; }
+
+#endif
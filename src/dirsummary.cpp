@@ -0,0 +1,135 @@
+#include "dirsummary.h"
+#include "hashstore.h"
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+
+DirSummaryCache dir_summaries;
+
+static std::string parent_dir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    if (slash == 0) return "/";
+    return path.substr(0, slash);
+}
+
+static bool under_dir(const std::string& path, const std::string& root) {
+    if (root == "/") return true;
+    return path.compare(0, root.size(), root) == 0 &&
+           (path.size() == root.size() || path[root.size()] == '/');
+}
+
+bool DirSummaryCache::load(const std::string& file, uint64_t db_generation) {
+    std::lock_guard<std::mutex> lock(mutex);
+    records.clear();
+    staged.clear();
+    invalid.clear();
+    generation = db_generation;
+
+    std::ifstream in(file);
+    if (!in) return false;
+
+    std::string line;
+    if (!std::getline(in, line) || line.rfind("generation ", 0) != 0) return false;
+    // Clean under another database says nothing about this one
+    if (std::strtoull(line.c_str() + 11, nullptr, 10) != db_generation) return false;
+
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        records[line.substr(tab + 1)] = line.substr(0, tab);
+    }
+    return true;
+}
+
+bool DirSummaryCache::save(const std::string& file) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        out << "generation " << generation << "\n";
+        for (const auto& record : records)
+            out << record.second << "\t" << record.first << "\n";
+        if (!out.flush()) return false;
+    }
+    return std::rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+std::string DirSummaryCache::find(const std::string& dir) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = records.find(dir);
+    return it == records.end() ? "" : it->second;
+}
+
+void DirSummaryCache::stage(const std::string& dir, const std::string& digest) {
+    std::lock_guard<std::mutex> lock(mutex);
+    staged[dir] = digest;
+}
+
+void DirSummaryCache::invalidate(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    invalid.insert(dir);
+}
+
+void DirSummaryCache::commit(const std::string& root) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string base = root;
+    while (base.size() > 1 && base.back() == '/') base.pop_back();
+
+    // Directories under root that this walk didn't stage are gone or empty
+    for (auto it = records.begin(); it != records.end();) {
+        if (under_dir(it->first, base)) it = records.erase(it);
+        else ++it;
+    }
+    for (auto& record : staged) {
+        if (!invalid.count(record.first)) records[record.first] = std::move(record.second);
+    }
+    staged.clear();
+    invalid.clear();
+}
+
+void DirWalk::add_file(const std::string& path, const struct stat& st) {
+    dirs[parent_dir(path)].push_back({path, st});
+}
+
+size_t DirWalk::resolve(DirSummaryCache& cache,
+                        const std::function<void(const std::string&, const struct stat&)>& changed) {
+    size_t unchanged_files = 0;
+    unchanged_dirs = 0;
+
+    for (auto& dir : dirs) {
+        std::vector<Entry>& files = dir.second;
+        std::sort(files.begin(), files.end(),
+                  [](const Entry& a, const Entry& b) { return a.path < b.path; });
+
+        // ctime too: utimes() can put mtime back, but not ctime
+        MultiDigest digest(DIGEST_SHA256);
+        for (const Entry& file : files) {
+            std::string name = file.path.substr(file.path.rfind('/') + 1);
+            std::string tuple = name + '\0' +
+                std::to_string(file.st.st_ino) + ' ' +
+                std::to_string(file.st.st_size) + ' ' +
+                std::to_string(file.st.st_mtim.tv_sec) + '.' + std::to_string(file.st.st_mtim.tv_nsec) + ' ' +
+                std::to_string(file.st.st_ctim.tv_sec) + '.' + std::to_string(file.st.st_ctim.tv_nsec) + '\n';
+            digest.update(reinterpret_cast<const unsigned char*>(tuple.data()), tuple.size());
+        }
+        FileDigests summary;
+        if (!digest.finish(summary)) summary.sha256.clear();
+
+        if (summary.sha256.empty()) {
+            for (const Entry& file : files) changed(file.path, file.st);
+            continue;
+        }
+
+        cache.stage(dir.first, summary.sha256);
+        if (cache.find(dir.first) == summary.sha256) {
+            unchanged_dirs++;
+            unchanged_files += files.size();
+            continue;
+        }
+        for (const Entry& file : files) changed(file.path, file.st);
+    }
+    return unchanged_files;
+}
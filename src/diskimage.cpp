@@ -0,0 +1,587 @@
+#include "diskimage.h"
+#include <zlib.h>
+#include <lzma.h>
+#include <zstd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+static const uint64_t ISO_SECTOR = 2048;
+static const int MAX_DIRECTORY_DEPTH = 64;
+// Larger directories are refused rather than read into memory
+static const uint64_t MAX_DIRECTORY_SIZE = 16ull << 20;
+// squashfs metadata blocks hold at most this much once decompressed
+static const size_t SQUASHFS_METADATA_SIZE = 8192;
+// Decompressed fragment blocks kept around for the files that share them
+static const size_t FRAGMENT_CACHE_SIZE = 32;
+
+static uint16_t le16(const unsigned char* p) { return static_cast<uint16_t>(p[0] | p[1] << 8); }
+static uint32_t le32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | static_cast<uint64_t>(le32(p + 4)) << 32; }
+
+static bool pread_full(int fd, void* out, size_t len, uint64_t offset) {
+    unsigned char* dst = static_cast<unsigned char*>(out);
+    while (len > 0) {
+        ssize_t n = pread(fd, dst, len, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        dst += n;
+        len -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+// Reads the runs of the image in `extents` one after another
+class ExtentStream : public ByteStream {
+public:
+    ExtentStream(int fd, const std::vector<ImageExtent>& extents, InflateLimit& limit)
+        : fd(fd), extents(extents), limit(limit) {}
+
+    ssize_t read(unsigned char* out, size_t len) override {
+        while (index < extents.size() && offset == extents[index].length) {
+            ++index;
+            offset = 0;
+        }
+        if (index == extents.size()) return 0;
+        const ImageExtent& extent = extents[index];
+        size_t n = static_cast<size_t>(std::min<uint64_t>(len, extent.length - offset));
+        if (n == 0) return 0;
+        if (!pread_full(fd, out, n, extent.start + offset)) return -1;
+        offset += n;
+        done += n;
+        if (!limit.charge(n, done, done)) return -1;
+        return static_cast<ssize_t>(n);
+    }
+
+private:
+    int fd;
+    std::vector<ImageExtent> extents;
+    size_t index = 0;                   // extent being read
+    uint64_t offset = 0;                // into it
+    uint64_t done = 0;
+    InflateLimit& limit;
+};
+
+class IsoImage : public DiskImage {
+public:
+    IsoImage(int fd, uint64_t size) : fd(fd), size(size) {}
+
+    const char* format() const override { return "ISO9660"; }
+
+    bool list(std::vector<ImageFile>& files) override {
+        // Volume descriptors start at sector 16; Joliet's supplementary one
+        // carries the long names
+        unsigned char root[34];
+        bool have_root = false;
+        joliet = false;
+        for (uint64_t sector = 16; sector < 16 + 32; ++sector) {
+            unsigned char desc[ISO_SECTOR];
+            if (!pread_full(fd, desc, sizeof(desc), sector * ISO_SECTOR) || memcmp(desc + 1, "CD001", 5) != 0) break;
+            if (desc[0] == 255) break;
+            const bool is_joliet = desc[0] == 2 && desc[88] == 0x25 && desc[89] == 0x2f &&
+                                   (desc[90] == 0x40 || desc[90] == 0x43 || desc[90] == 0x45);
+            if ((desc[0] == 1 && !have_root) || is_joliet) {
+                memcpy(root, desc + 156, sizeof(root));
+                have_root = true;
+                joliet = joliet || is_joliet;
+            }
+        }
+        if (!have_root) return false;
+
+        struct Pending { uint64_t lba, length; std::string path; int depth; };
+        std::vector<Pending> dirs{{le32(root + 2), le32(root + 10), "", 0}};
+        std::unordered_set<uint64_t> seen;
+        bool ok = true;
+        while (!dirs.empty()) {
+            Pending dir = dirs.back();
+            dirs.pop_back();
+            if (!seen.insert(dir.lba).second) continue;     // loops in a crafted image
+            std::vector<unsigned char> data;
+            if (dir.length > MAX_DIRECTORY_SIZE || dir.lba * ISO_SECTOR + dir.length > size) {
+                ok = false;
+                continue;
+            }
+            data.resize(dir.length);
+            if (!pread_full(fd, data.data(), data.size(), dir.lba * ISO_SECTOR)) {
+                ok = false;
+                continue;
+            }
+
+            ImageFile* extending = nullptr;     // a multi-extent file still growing
+            for (size_t pos = 0; pos < data.size();) {
+                const size_t len = data[pos];
+                if (len == 0) {
+                    // Records don't cross sectors; the rest of this one is padding
+                    pos = (pos / ISO_SECTOR + 1) * ISO_SECTOR;
+                    continue;
+                }
+                if (len < 34 || pos + len > data.size() || 33u + data[pos + 32] > len) {
+                    ok = false;
+                    break;
+                }
+                const unsigned char* rec = data.data() + pos;
+                pos += len;
+                const uint64_t lba = le32(rec + 2);
+                const uint64_t length = le32(rec + 10);
+                const unsigned char flags = rec[25];
+                const size_t name_len = rec[32];
+                if (name_len == 1 && (rec[33] == 0 || rec[33] == 1)) continue;   // "." and ".."
+                std::string path = dir.path + decode_name(rec + 33, name_len);
+
+                if (flags & 0x02) {
+                    if (dir.depth + 1 < MAX_DIRECTORY_DEPTH) dirs.push_back({lba, length, path + "/", dir.depth + 1});
+                    continue;
+                }
+                if (lba * ISO_SECTOR + length > size) {
+                    ok = false;
+                    continue;
+                }
+                // Files over 4 GiB come as several records of one name, in
+                // order, each pointing at its own run of sectors
+                if (extending && extending->path == path) {
+                    extending->size += length;
+                    extending->extents.push_back({lba * ISO_SECTOR, length});
+                } else {
+                    ImageFile file;
+                    file.path = path;
+                    file.start = lba * ISO_SECTOR;
+                    file.size = length;
+                    file.extents.push_back({file.start, length});
+                    files.push_back(file);
+                }
+                extending = (flags & 0x80) ? &files.back() : nullptr;
+            }
+        }
+        return ok;
+    }
+
+    std::unique_ptr<ByteStream> open_file(const ImageFile& file, InflateLimit& limit) override {
+        return std::make_unique<ExtentStream>(fd, file.extents, limit);
+    }
+
+private:
+    // Joliet names are UCS-2 big endian; plain ones end in ";1"
+    std::string decode_name(const unsigned char* name, size_t len) const {
+        std::string out;
+        if (joliet) {
+            for (size_t i = 0; i + 1 < len; i += 2) {
+                unsigned c = static_cast<unsigned>(name[i]) << 8 | name[i + 1];
+                if (c < 0x80) {
+                    out += static_cast<char>(c);
+                } else if (c < 0x800) {
+                    out += static_cast<char>(0xc0 | c >> 6);
+                    out += static_cast<char>(0x80 | (c & 0x3f));
+                } else {
+                    out += static_cast<char>(0xe0 | c >> 12);
+                    out += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+                    out += static_cast<char>(0x80 | (c & 0x3f));
+                }
+            }
+        } else {
+            out.assign(reinterpret_cast<const char*>(name), len);
+        }
+        size_t version = out.rfind(';');
+        if (version != std::string::npos) out.erase(version);
+        if (!out.empty() && out.back() == '.') out.pop_back();
+        return out;
+    }
+
+    int fd;
+    uint64_t size;
+    bool joliet = false;
+};
+
+class SquashfsImage;
+
+// One squashfs file: its data blocks in order, then its fragment tail
+class SquashfsFileStream : public ByteStream {
+public:
+    SquashfsFileStream(SquashfsImage& image, const ImageFile& file, InflateLimit& limit)
+        : image(image), file(file), limit(limit), pos(file.start) {}
+    ssize_t read(unsigned char* out, size_t len) override;
+
+private:
+    bool next_block();
+
+    SquashfsImage& image;
+    const ImageFile& file;
+    InflateLimit& limit;
+    uint64_t pos;                       // of the next data block in the image
+    size_t block = 0;                   // next of file.blocks
+    bool tail_done = false;
+    std::vector<unsigned char> data;    // the current block, decompressed
+    std::shared_ptr<const std::vector<unsigned char>> fragment;
+    const unsigned char* current = nullptr;
+    size_t current_left = 0;
+    uint64_t produced = 0;
+    uint64_t stored = 0;
+};
+
+class SquashfsImage : public DiskImage {
+public:
+    SquashfsImage(int fd, uint64_t base, const unsigned char* super) : fd(fd), base(base) {
+        block_size = le32(super + 12);
+        fragment_count = le32(super + 16);
+        compressor = le16(super + 20);
+        root_inode = le64(super + 32);
+        bytes_used = le64(super + 40);
+        inode_table = le64(super + 64);
+        directory_table = le64(super + 72);
+        fragment_table = le64(super + 80);
+    }
+
+    const char* format() const override { return "squashfs"; }
+
+    bool valid() const {
+        return block_size >= 4096 && block_size <= (1u << 20) && (block_size & (block_size - 1)) == 0 &&
+               inode_table < bytes_used && directory_table < bytes_used;
+    }
+
+    // gzip, xz and zstd; lz4 and lzo have no decoder linked
+    bool supported() const { return compressor == 1 || compressor == 4 || compressor == 6; }
+
+    bool list(std::vector<ImageFile>& files) override {
+        if (!load_fragments()) return false;
+        struct Pending { uint64_t inode; std::string path; int depth; };
+        std::vector<Pending> dirs{{root_inode, "", 0}};
+        std::unordered_set<uint64_t> seen;
+        bool ok = true;
+        while (!dirs.empty()) {
+            Pending dir = dirs.back();
+            dirs.pop_back();
+            if (!seen.insert(dir.inode).second) continue;
+            if (!list_directory(dir.inode, [&](uint64_t inode, uint16_t type, const std::string& name) {
+                    const std::string path = dir.path + name;
+                    if (type == 1 || type == 8) {
+                        if (dir.depth + 1 < MAX_DIRECTORY_DEPTH) dirs.push_back({inode, path + "/", dir.depth + 1});
+                    } else if (type == 2 || type == 9) {
+                        ImageFile file;
+                        file.path = path;
+                        if (read_file_inode(inode, file)) files.push_back(std::move(file));
+                        else ok = false;
+                    }
+                })) {
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    std::unique_ptr<ByteStream> open_file(const ImageFile& file, InflateLimit& limit) override {
+        return std::make_unique<SquashfsFileStream>(*this, file, limit);
+    }
+
+private:
+    friend class SquashfsFileStream;
+
+    struct MetadataBlock {
+        std::vector<unsigned char> data;
+        uint64_t next = 0;              // where the following block starts
+    };
+
+    struct Fragment {
+        uint64_t start;
+        uint32_t size;
+    };
+
+    // Decompresses one block with the image's compressor
+    bool decompress(const std::vector<unsigned char>& in, std::vector<unsigned char>& out, size_t limit) const {
+        out.resize(limit);
+        if (compressor == 1) {
+            uLongf len = static_cast<uLongf>(limit);
+            if (uncompress(out.data(), &len, in.data(), static_cast<uLong>(in.size())) != Z_OK) return false;
+            out.resize(len);
+            return true;
+        }
+        if (compressor == 6) {
+            size_t len = ZSTD_decompress(out.data(), limit, in.data(), in.size());
+            if (ZSTD_isError(len)) return false;
+            out.resize(len);
+            return true;
+        }
+        uint64_t memlimit = 64ull << 20;
+        size_t in_pos = 0, out_pos = 0;
+        if (lzma_stream_buffer_decode(&memlimit, 0, nullptr, in.data(), &in_pos, in.size(),
+                                      out.data(), &out_pos, limit) != LZMA_OK)
+            return false;
+        out.resize(out_pos);
+        return true;
+    }
+
+    // Reads a stored block of `word` (size, plus bit 24 if uncompressed) at `pos`
+    bool read_block(uint64_t pos, uint32_t word, std::vector<unsigned char>& out) const {
+        const uint32_t stored = word & 0xffffff;
+        if (stored > block_size || pos + stored > bytes_used) return false;
+        std::vector<unsigned char> raw(stored);
+        if (!pread_full(fd, raw.data(), raw.size(), base + pos)) return false;
+        if (word & (1u << 24)) {
+            out.swap(raw);
+            return true;
+        }
+        return decompress(raw, out, block_size);
+    }
+
+    // Each metadata block is decompressed once, whatever reads it
+    std::shared_ptr<const MetadataBlock> metadata_block(uint64_t pos) {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = metadata.find(pos);
+            if (it != metadata.end()) return it->second;
+        }
+        unsigned char header[2];
+        if (pos + 2 > bytes_used || !pread_full(fd, header, 2, base + pos)) return nullptr;
+        const uint16_t word = le16(header);
+        const size_t stored = word & 0x7fff;
+        auto block = std::make_shared<MetadataBlock>();
+        std::vector<unsigned char> raw(stored);
+        if (stored == 0 || pos + 2 + stored > bytes_used || !pread_full(fd, raw.data(), stored, base + pos + 2))
+            return nullptr;
+        if (word & 0x8000) block->data.swap(raw);
+        else if (!decompress(raw, block->data, SQUASHFS_METADATA_SIZE)) return nullptr;
+        if (block->data.empty()) return nullptr;
+        block->next = pos + 2 + stored;
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        metadata.emplace(pos, block);
+        return block;
+    }
+
+    // Reads `len` bytes of metadata at `block` + `offset`, moving past them
+    bool read_metadata(uint64_t& block, size_t& offset, unsigned char* out, size_t len) {
+        while (len > 0) {
+            auto mb = metadata_block(block);
+            if (!mb) return false;
+            if (offset >= mb->data.size()) {
+                offset -= mb->data.size();
+                block = mb->next;
+                continue;
+            }
+            size_t n = std::min(len, mb->data.size() - offset);
+            memcpy(out, mb->data.data() + offset, n);
+            out += n;
+            len -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    // Positions a cursor on the inode `ref` points at (block << 16 | offset)
+    void inode_cursor(uint64_t ref, uint64_t& block, size_t& offset) const {
+        block = inode_table + (ref >> 16);
+        offset = ref & 0xffff;
+    }
+
+    bool load_fragments() {
+        if (fragment_count == 0) return true;
+        if (fragment_count > bytes_used / 16) return false;
+        const size_t tables = (fragment_count + 511) / 512;
+        std::vector<unsigned char> pointers(tables * 8);
+        if (fragment_table + pointers.size() > bytes_used ||
+            !pread_full(fd, pointers.data(), pointers.size(), base + fragment_table))
+            return false;
+        fragments.resize(fragment_count);
+        for (size_t t = 0; t < tables; ++t) {
+            uint64_t block = le64(pointers.data() + t * 8);
+            size_t offset = 0;
+            for (size_t i = t * 512; i < std::min<size_t>(fragment_count, (t + 1) * 512); ++i) {
+                unsigned char entry[16];
+                if (!read_metadata(block, offset, entry, sizeof(entry))) return false;
+                fragments[i] = {le64(entry), le32(entry + 8)};
+            }
+        }
+        return true;
+    }
+
+    bool read_file_inode(uint64_t ref, ImageFile& file) {
+        uint64_t block;
+        size_t offset;
+        inode_cursor(ref, block, offset);
+        unsigned char header[16], body[40];
+        if (!read_metadata(block, offset, header, sizeof(header))) return false;
+        if (le16(header) == 2) {
+            if (!read_metadata(block, offset, body, 16)) return false;
+            file.start = le32(body);
+            file.fragment = le32(body + 4);
+            file.fragment_offset = le32(body + 8);
+            file.size = le32(body + 12);
+        } else {
+            if (!read_metadata(block, offset, body, 40)) return false;
+            file.start = le64(body);
+            file.size = le64(body + 8);
+            file.fragment = le32(body + 28);
+            file.fragment_offset = le32(body + 32);
+        }
+        uint64_t count = file.size / block_size;
+        if (file.fragment == NO_FRAGMENT && file.size % block_size) count++;
+        // Every block has a size word in the metadata; more can't be real
+        if (count > bytes_used / 4 || (file.fragment != NO_FRAGMENT && file.fragment >= fragment_count))
+            return false;
+        std::vector<unsigned char> sizes(count * 4);
+        if (!read_metadata(block, offset, sizes.data(), sizes.size())) return false;
+        file.blocks.resize(count);
+        for (uint64_t i = 0; i < count; ++i) file.blocks[i] = le32(sizes.data() + i * 4);
+        return true;
+    }
+
+    template <typename Visit>
+    bool list_directory(uint64_t ref, const Visit& visit) {
+        uint64_t block;
+        size_t offset;
+        inode_cursor(ref, block, offset);
+        unsigned char header[16], body[24];
+        if (!read_metadata(block, offset, header, sizeof(header))) return false;
+        uint32_t start;
+        uint64_t listing;
+        if (le16(header) == 1) {
+            if (!read_metadata(block, offset, body, 16)) return false;
+            start = le32(body);
+            listing = le16(body + 8);
+            offset = le16(body + 10);
+        } else if (le16(header) == 8) {
+            if (!read_metadata(block, offset, body, 24)) return false;
+            listing = le32(body + 4);
+            start = le32(body + 8);
+            offset = le16(body + 18);
+        } else {
+            return false;
+        }
+        // The size counts three bytes for "." and ".." that aren't stored
+        if (listing < 3) return true;
+        int64_t left = static_cast<int64_t>(listing) - 3;
+        block = directory_table + start;
+        while (left > 0) {
+            unsigned char run[12];
+            if (!read_metadata(block, offset, run, sizeof(run))) return false;
+            const uint32_t count = le32(run) + 1;
+            const uint64_t inode_block = le32(run + 4);
+            if (count > 256) return false;
+            left -= sizeof(run);
+            for (uint32_t i = 0; i < count && left > 0; ++i) {
+                unsigned char entry[8];
+                if (!read_metadata(block, offset, entry, sizeof(entry))) return false;
+                std::string name(le16(entry + 6) + 1u, '\0');
+                if (!read_metadata(block, offset, reinterpret_cast<unsigned char*>(&name[0]), name.size())) return false;
+                left -= static_cast<int64_t>(sizeof(entry) + name.size());
+                if (name.find('/') != std::string::npos) return false;
+                visit(inode_block << 16 | le16(entry), le16(entry + 4), name);
+            }
+        }
+        return true;
+    }
+
+    // Fragment blocks are shared by many small files; each is decompressed once
+    // while it stays in the cache
+    std::shared_ptr<const std::vector<unsigned char>> fragment_block(uint32_t index) {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            auto it = fragment_cache.find(index);
+            if (it != fragment_cache.end()) return it->second;
+        }
+        auto data = std::make_shared<std::vector<unsigned char>>();
+        if (index >= fragments.size() || !read_block(fragments[index].start, fragments[index].size, *data))
+            return nullptr;
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (fragment_cache.size() >= FRAGMENT_CACHE_SIZE) fragment_cache.clear();
+        fragment_cache.emplace(index, data);
+        return data;
+    }
+
+    int fd;
+    uint64_t base;                      // where the image starts in the file
+    uint32_t block_size;
+    uint32_t fragment_count;
+    uint16_t compressor;
+    uint64_t root_inode;
+    uint64_t bytes_used;
+    uint64_t inode_table;
+    uint64_t directory_table;
+    uint64_t fragment_table;
+    std::vector<Fragment> fragments;
+
+    std::mutex cache_mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<const MetadataBlock>> metadata;
+    std::unordered_map<uint32_t, std::shared_ptr<const std::vector<unsigned char>>> fragment_cache;
+};
+
+bool SquashfsFileStream::next_block() {
+    if (block < file.blocks.size()) {
+        const uint32_t word = file.blocks[block++];
+        const uint64_t want = std::min<uint64_t>(image.block_size, file.size - produced);
+        if ((word & 0xffffff) == 0) {
+            data.assign(want, 0);       // sparse
+        } else {
+            if (!image.read_block(pos, word, data) || data.size() < want) return false;
+            pos += word & 0xffffff;
+            stored += word & 0xffffff;
+        }
+        current = data.data();
+        current_left = want;
+        return true;
+    }
+    if (tail_done || file.fragment == NO_FRAGMENT) return false;
+    tail_done = true;
+    fragment = image.fragment_block(file.fragment);
+    const uint64_t tail = file.size % image.block_size;
+    if (!fragment || file.fragment_offset + tail > fragment->size()) return false;
+    stored += tail;
+    current = fragment->data() + file.fragment_offset;
+    current_left = tail;
+    return true;
+}
+
+ssize_t SquashfsFileStream::read(unsigned char* out, size_t len) {
+    if (current_left == 0) {
+        if (produced >= file.size) return 0;
+        if (!next_block()) return -1;
+    }
+    size_t n = std::min<size_t>(len, current_left);
+    memcpy(out, current, n);
+    current += n;
+    current_left -= n;
+    produced += n;
+    if (!limit.charge(n, stored, produced)) return -1;
+    return static_cast<ssize_t>(n);
+}
+
+// AppImages are an ELF runtime with the squashfs image right after its
+// section headers
+static uint64_t appimage_offset(const unsigned char* head, size_t len) {
+    if (len < 64 || memcmp(head, "\x7f" "ELF", 4) != 0 || memcmp(head + 8, "AI\x02", 3) != 0) return 0;
+    if (head[4] == 2) return le64(head + 0x28) + static_cast<uint64_t>(le16(head + 0x3a)) * le16(head + 0x3c);
+    return le32(head + 0x20) + static_cast<uint64_t>(le16(head + 0x2e)) * le16(head + 0x30);
+}
+
+std::unique_ptr<DiskImage> open_disk_image(int fd, uint64_t size) {
+    unsigned char head[96];
+    if (size < sizeof(head) || !pread_full(fd, head, sizeof(head), 0)) return nullptr;
+
+    uint64_t base = memcmp(head, "hsqs", 4) == 0 ? 0 : appimage_offset(head, sizeof(head));
+    if (base > 0 && (base + sizeof(head) > size || !pread_full(fd, head, sizeof(head), base))) return nullptr;
+    if (memcmp(head, "hsqs", 4) == 0 && le16(head + 28) == 4) {
+        auto image = std::make_unique<SquashfsImage>(fd, base, head);
+        if (!image->valid() || !image->supported() || le64(head + 40) > size - base) return nullptr;
+        return image;
+    }
+
+    unsigned char magic[5];
+    if (size >= 17 * ISO_SECTOR && pread_full(fd, magic, sizeof(magic), 16 * ISO_SECTOR + 1) &&
+        memcmp(magic, "CD001", 5) == 0)
+        return std::make_unique<IsoImage>(fd, size);
+    return nullptr;
+}
+
+bool may_be_disk_image(const unsigned char* head, size_t len, uint64_t size) {
+    if (len >= 4 && memcmp(head, "hsqs", 4) == 0) return true;
+    if (appimage_offset(head, len) > 0) return true;
+    if (size < 17 * ISO_SECTOR || len < 512) return false;
+    if (head[510] == 0x55 && head[511] == 0xaa) return true;    // isohybrid
+    for (size_t i = 0; i < 512; ++i)
+        if (head[i]) return false;
+    return true;
+}
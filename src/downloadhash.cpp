@@ -84,10 +84,7 @@ bool extractZipFile(const void* zipData, size_t zipSize, const std::string& outp
     return true;
 }
 
-bool updateHashDatabase() {
-    const auto& url = DownloadConfig::SHA256_FULL_URL;
-    const auto& outputPath = DownloadConfig::DEFAULT_OUTPUT_PATH;
-    
+bool updateHashFile(const std::string& url, const std::string& outputPath) {
     // Create a timestamp for backup
     std::time_t now = std::time(nullptr);
     std::string backupPath = outputPath + ".txt";
@@ -105,4 +102,14 @@ bool updateHashDatabase() {
     }
 
     return success;
-}
\ No newline at end of file
+}
+
+bool updateHashDatabase() {
+    bool success = updateHashFile(DownloadConfig::SHA256_FULL_URL, DownloadConfig::DEFAULT_OUTPUT_PATH);
+
+    // MD5- and SHA-1-only indicators are a bonus; a failure here keeps the old copy
+    updateHashFile(DownloadConfig::SHA1_FULL_URL, DownloadConfig::SHA1_OUTPUT_PATH);
+    updateHashFile(DownloadConfig::MD5_FULL_URL, DownloadConfig::MD5_OUTPUT_PATH);
+
+    return success;
+}
@@ -0,0 +1,188 @@
+#include "entropy.h"
+#include "filetype.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Below this the histogram says more about the length than the content
+static const uint64_t MIN_MEASURED_LENGTH = 4096;
+// The first SAMPLE_RUN bytes of every SAMPLE_STRIDE, by file offset, are
+// counted. Counting every byte would cost more than the SHA-256 it rides
+// along with; 2 KiB of samples per window still puts random data above
+// 7.9 bits and leaves compiled code where it was.
+static const uint64_t SAMPLE_STRIDE = 256;
+static const uint64_t SAMPLE_RUN = 8;
+static const size_t WINDOW_SAMPLES = ENTROPY_WINDOW / SAMPLE_STRIDE * SAMPLE_RUN;
+
+bool EntropyStats::suspicious() const {
+    if (!measured) return false;
+    return file >= PACKED_FILE_ENTROPY || (windows >= 4 && high_windows * 2 >= windows);
+}
+
+bool entropy_measures(const unsigned char* head, size_t len) {
+    FileType type = sniff_file_type(head, len);
+    return type == FileType::Elf || type == FileType::Pe || type == FileType::MachO;
+}
+
+// c * log2(c) for every count a window can hold, so closing a window
+// takes no logarithms
+static const double* window_terms() {
+    static const std::vector<double> terms = [] {
+        std::vector<double> t(WINDOW_SAMPLES + 1, 0.0);
+        for (size_t c = 1; c <= WINDOW_SAMPLES; ++c) t[c] = static_cast<double>(c) * std::log2(static_cast<double>(c));
+        return t;
+    }();
+    return terms.data();
+}
+
+// Shannon entropy in bits per byte of one window's histogram
+static double window_entropy(const uint32_t counts[256]) {
+    const double* terms = window_terms();
+    uint32_t n = 0;
+    double sum = 0;
+    for (int b = 0; b < 256; ++b) {
+        n += counts[b];
+        sum += terms[counts[b]];
+    }
+    if (n == 0) return 0;
+    return std::log2(static_cast<double>(n)) - sum / n;
+}
+
+// Same over the whole file
+static double file_entropy(const uint64_t counts[256]) {
+    uint64_t n = 0;
+    double sum = 0;
+    for (int b = 0; b < 256; ++b) {
+        if (!counts[b]) continue;
+        n += counts[b];
+        sum += static_cast<double>(counts[b]) * std::log2(static_cast<double>(counts[b]));
+    }
+    if (n == 0) return 0;
+    return std::log2(static_cast<double>(n)) - sum / static_cast<double>(n);
+}
+
+// Sums the four interleaved histograms into `merged` and adds them to
+// `total`, four bins per step
+static void fold_window(const uint32_t window[4][256], uint32_t merged[256], uint64_t total[256]) {
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (int b = 0; b < 256; b += 4) {
+        __m128i sum = _mm_add_epi32(
+            _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&window[0][b])),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&window[1][b]))),
+            _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&window[2][b])),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&window[3][b]))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&merged[b]), sum);
+        __m128i* t = reinterpret_cast<__m128i*>(&total[b]);
+        _mm_storeu_si128(t, _mm_add_epi64(_mm_loadu_si128(t), _mm_unpacklo_epi32(sum, zero)));
+        _mm_storeu_si128(t + 1, _mm_add_epi64(_mm_loadu_si128(t + 1), _mm_unpackhi_epi32(sum, zero)));
+    }
+#else
+    for (int b = 0; b < 256; ++b) {
+        merged[b] = window[0][b] + window[1][b] + window[2][b] + window[3][b];
+        total[b] += merged[b];
+    }
+#endif
+}
+
+EntropyMeter::EntropyMeter() {
+    memset(window, 0, sizeof(window));
+    memset(total, 0, sizeof(total));
+}
+
+void EntropyMeter::update(const unsigned char* data, size_t len) {
+    if (sniffed && !measuring) return;
+    if (!sniffed) {
+        // Hash passes may start with a few bytes, so gather a full sniff first
+        if (head.size() + len < SNIFF_SIZE) {
+            head.insert(head.end(), data, data + len);
+            return;
+        }
+        sniffed = true;
+        std::vector<unsigned char> first;
+        first.swap(head);
+        size_t from_data = std::min(len, SNIFF_SIZE - first.size());
+        first.insert(first.end(), data, data + from_data);
+        measuring = entropy_measures(first.data(), first.size());
+        if (!measuring) return;
+        measure(first.data(), first.size());
+        data += from_data;
+        len -= from_data;
+    }
+    measure(data, len);
+}
+
+void EntropyMeter::measure(const unsigned char* data, size_t len) {
+    while (len > 0) {
+        size_t take = std::min(len, ENTROPY_WINDOW - window_fill);
+        count(data, take);
+        window_fill += take;
+        offset += take;
+        if (window_fill == ENTROPY_WINDOW) close_window();
+        data += take;
+        len -= take;
+    }
+}
+
+// Counts the sampled bytes of `len` bytes at `offset`, a whole run per
+// load when it lies inside the buffer, spread over the four histograms
+void EntropyMeter::count(const unsigned char* data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        uint64_t phase = (offset + i) % SAMPLE_STRIDE;
+        if (phase >= SAMPLE_RUN) {
+            i += static_cast<size_t>(SAMPLE_STRIDE - phase);
+        } else if (phase == 0 && i + SAMPLE_RUN <= len) {
+            uint64_t v;
+            memcpy(&v, data + i, 8);
+            window[0][v & 0xff]++;
+            window[1][(v >> 8) & 0xff]++;
+            window[2][(v >> 16) & 0xff]++;
+            window[3][(v >> 24) & 0xff]++;
+            window[0][(v >> 32) & 0xff]++;
+            window[1][(v >> 40) & 0xff]++;
+            window[2][(v >> 48) & 0xff]++;
+            window[3][v >> 56]++;
+            i += SAMPLE_STRIDE;
+        } else {
+            window[phase & 3][data[i]]++;
+            ++i;
+        }
+    }
+}
+
+void EntropyMeter::close_window() {
+    uint32_t merged[256];
+    fold_window(window, merged, total);
+    double e = window_entropy(merged);
+    stats.windows++;
+    if (e >= HIGH_WINDOW_ENTROPY) stats.high_windows++;
+    if (e > stats.max_window) stats.max_window = e;
+    memset(window, 0, sizeof(window));
+    window_fill = 0;
+}
+
+EntropyStats EntropyMeter::finish() const {
+    // A file shorter than a sniff never got classified
+    if (!measuring || offset < MIN_MEASURED_LENGTH) return EntropyStats();
+
+    // The last, partial window, counted on a copy so hashing can go on
+    EntropyStats out = stats;
+    uint32_t merged[256];
+    uint64_t sums[256];
+    memcpy(sums, total, sizeof(sums));
+    fold_window(window, merged, sums);
+    if (window_fill >= ENTROPY_WINDOW / 4) {
+        double e = window_entropy(merged);
+        out.windows++;
+        if (e >= HIGH_WINDOW_ENTROPY) out.high_windows++;
+        if (e > out.max_window) out.max_window = e;
+    }
+    out.file = file_entropy(sums);
+    out.measured = true;
+    return out;
+}
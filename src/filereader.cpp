@@ -0,0 +1,338 @@
+#include "filereader.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+std::atomic<CacheMode> cache_mode(CacheMode::Normal);
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+#if defined(__linux__) && !defined(__NR_cachestat)
+#define __NR_cachestat 451
+#endif
+
+// Pool of READ_CHUNK_SIZE buffers aligned for O_DIRECT. Buffers are reused
+// across files and threads instead of being allocated per read.
+class BufferPool {
+public:
+    unsigned char* acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_list.empty()) {
+                unsigned char* buf = free_list.back();
+                free_list.pop_back();
+                return buf;
+            }
+        }
+        void* buf = nullptr;
+        if (posix_memalign(&buf, READ_ALIGNMENT, READ_CHUNK_SIZE) != 0)
+            throw std::bad_alloc();
+        return static_cast<unsigned char*>(buf);
+    }
+
+    void release(unsigned char* buf) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_list.size() < MAX_POOLED) free_list.push_back(buf);
+        else free(buf);
+    }
+
+    ~BufferPool() {
+        for (unsigned char* buf : free_list) free(buf);
+    }
+
+private:
+    static const size_t MAX_POOLED = 64;
+    std::mutex mutex;
+    std::vector<unsigned char*> free_list;
+};
+
+static BufferPool buffer_pool;
+
+struct PooledBuffer {
+    unsigned char* data;
+    PooledBuffer() : data(buffer_pool.acquire()) {}
+    ~PooledBuffer() { buffer_pool.release(data); }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+};
+
+// Which pages of a file were in the page cache before we started reading it,
+// so that DropAfterRead only evicts what the scan itself brought in.
+struct Residency {
+    bool all = false;
+    bool none = false;
+    size_t page_size = 4096;
+    std::vector<unsigned char> pages;   // mincore() map when partially cached
+};
+
+static Residency probe_residency(int fd, uint64_t size) {
+    Residency res;
+    res.page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (size == 0) {
+        res.all = true;
+        return res;
+    }
+    uint64_t num_pages = (size + res.page_size - 1) / res.page_size;
+
+#ifdef __linux__
+    // cachestat (Linux 6.5+) answers the common all/nothing cases without
+    // mapping the file
+    struct { uint64_t off, len; } range = { 0, size };
+    struct { uint64_t nr_cache, nr_dirty, nr_writeback, nr_evicted, nr_recently_evicted; } cs = {};
+    if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0) {
+        if (cs.nr_cache == 0) { res.none = true; return res; }
+        if (cs.nr_cache >= num_pages) { res.all = true; return res; }
+    }
+#endif
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        // Can't tell; never evict pages that might belong to someone else
+        res.all = true;
+        return res;
+    }
+    res.pages.resize(num_pages);
+    if (mincore(map, size, res.pages.data()) != 0) {
+        res.pages.clear();
+        res.all = true;
+    }
+    munmap(map, size);
+    return res;
+}
+
+// Evicts the pages of [off, off + len) that were not resident before the scan
+static void drop_range(int fd, const Residency& res, uint64_t off, uint64_t len) {
+    if (res.all || len == 0) return;
+    if (res.none) {
+        posix_fadvise(fd, static_cast<off_t>(off), static_cast<off_t>(len), POSIX_FADV_DONTNEED);
+        return;
+    }
+
+    uint64_t first = off / res.page_size;
+    uint64_t last = std::min<uint64_t>((off + len + res.page_size - 1) / res.page_size, res.pages.size());
+    uint64_t run_start = last;
+    for (uint64_t page = first; page <= last; ++page) {
+        bool evict = page < last && !(res.pages[page] & 1);
+        if (evict && run_start == last) {
+            run_start = page;
+        } else if (!evict && run_start != last) {
+            posix_fadvise(fd, static_cast<off_t>(run_start * res.page_size),
+                          static_cast<off_t>((page - run_start) * res.page_size), POSIX_FADV_DONTNEED);
+            run_start = last;
+        }
+    }
+}
+
+// pread that retries on EINTR and keeps going until `len` bytes or EOF
+static ssize_t pread_full(int fd, unsigned char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // O_DIRECT refused by this filesystem: drop the flag and retry buffered
+            if (errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) break;
+        done += static_cast<size_t>(n);
+        // An O_DIRECT read must stay block aligned; a short read means EOF
+        if (done % READ_ALIGNMENT != 0 && (fcntl(fd, F_GETFL) & O_DIRECT)) break;
+    }
+    return static_cast<ssize_t>(done);
+}
+
+// `want` bounds the bytes read, rounded up to READ_ALIGNMENT for O_DIRECT
+static ReadStatus read_sequential(int fd, uint64_t offset, size_t skip, uint64_t want,
+                                  const ChunkConsumer& consume) {
+    PooledBuffer buffer;
+    for (;;) {
+        uint64_t aligned_want = (want + READ_ALIGNMENT - 1) & ~static_cast<uint64_t>(READ_ALIGNMENT - 1);
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(READ_CHUNK_SIZE, aligned_want));
+        ssize_t n = pread_full(fd, buffer.data, chunk, offset);
+        if (n < 0) return ReadStatus::ReadFailed;
+        if (static_cast<size_t>(n) <= skip) return ReadStatus::Ok;
+        if (!consume(buffer.data + skip, static_cast<size_t>(n) - skip)) return ReadStatus::Aborted;
+        skip = 0;
+        offset += static_cast<uint64_t>(n);
+        want -= std::min<uint64_t>(want, static_cast<uint64_t>(n));
+        if (static_cast<size_t>(n) < chunk || want == 0) return ReadStatus::Ok;
+    }
+}
+
+// Two-slot handoff between the reader thread and the consumer. The reader
+// fills slot (i % 2) while the consumer digests the other one.
+struct ReadAhead {
+    struct Slot {
+        PooledBuffer buffer;
+        ssize_t len = 0;        // -1 on read error, 0 on EOF
+        bool ready = false;
+    };
+
+    Slot slots[2];
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+
+    void produce(int fd, uint64_t offset) {
+        for (size_t i = 0;; ++i) {
+            Slot& slot = slots[i % 2];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || !slot.ready; });
+                if (stop) return;
+            }
+
+            ssize_t n = pread_full(fd, slot.buffer.data, READ_CHUNK_SIZE, offset);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.len = n;
+                slot.ready = true;
+            }
+            cv.notify_all();
+
+            if (n <= 0 || static_cast<size_t>(n) < READ_CHUNK_SIZE) return;
+            offset += static_cast<uint64_t>(n);
+        }
+    }
+};
+
+static ReadStatus read_pipelined(int fd, uint64_t offset, size_t skip, const ChunkConsumer& consume) {
+    ReadAhead ahead;
+    std::thread reader(&ReadAhead::produce, &ahead, fd, offset);
+
+    ReadStatus result = ReadStatus::Ok;
+    for (size_t i = 0;; ++i) {
+        ReadAhead::Slot& slot = ahead.slots[i % 2];
+        {
+            std::unique_lock<std::mutex> lock(ahead.mutex);
+            ahead.cv.wait(lock, [&] { return slot.ready; });
+        }
+
+        if (slot.len < 0) { result = ReadStatus::ReadFailed; break; }
+        if (static_cast<size_t>(slot.len) <= skip) break;
+
+        bool more = consume(slot.buffer.data + skip, static_cast<size_t>(slot.len) - skip);
+        bool last = static_cast<size_t>(slot.len) < READ_CHUNK_SIZE;
+        skip = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(ahead.mutex);
+            slot.ready = false;
+            if (!more) ahead.stop = true;
+        }
+        ahead.cv.notify_all();
+
+        if (!more) { result = ReadStatus::Aborted; break; }
+        if (last) break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ahead.mutex);
+        ahead.stop = true;
+    }
+    ahead.cv.notify_all();
+    reader.join();
+    return result;
+}
+
+ReadStatus read_fd_chunks(int fd, uint64_t offset, uint64_t size, const ChunkConsumer& consume) {
+    // Reads start on an aligned offset so the same path works for O_DIRECT
+    uint64_t aligned = offset & ~static_cast<uint64_t>(READ_ALIGNMENT - 1);
+    size_t skip = static_cast<size_t>(offset - aligned);
+
+    // Stop at `size` even if the file has grown since, so the bytes seen
+    // are the ones the caller's fstat() described
+    uint64_t remaining = size - std::min(size, offset);
+    if (remaining == 0) return ReadStatus::Ok;
+    bool reached_end = false;
+    ChunkConsumer bounded = [&](const unsigned char* data, size_t len) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(len, remaining));
+        if (!consume(data, n)) return false;
+        remaining -= n;
+        reached_end = remaining == 0;
+        return !reached_end;
+    };
+
+    ReadStatus result;
+    CacheMode mode = cache_mode.load();
+    if (mode == CacheMode::Normal) {
+        if (remaining > PIPELINE_THRESHOLD)
+            result = read_pipelined(fd, aligned, skip, bounded);
+        else
+            result = read_sequential(fd, aligned, skip, skip + remaining, bounded);
+        return reached_end ? ReadStatus::Ok : result;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    Residency res = probe_residency(fd, size);
+    uint64_t pos = offset;
+    ChunkConsumer dropping = [&](const unsigned char* data, size_t len) {
+        bool more = bounded(data, len);
+        drop_range(fd, res, pos, len);
+        pos += len;
+        return more;
+    };
+
+    if (remaining > PIPELINE_THRESHOLD)
+        result = read_pipelined(fd, aligned, skip, dropping);
+    else
+        result = read_sequential(fd, aligned, skip, skip + remaining, dropping);
+    return reached_end ? ReadStatus::Ok : result;
+}
+
+struct PageCacheGuard::State {
+    int fd;
+    uint64_t size;
+    Residency res;
+};
+
+PageCacheGuard::PageCacheGuard(int fd, uint64_t size) {
+    if (cache_mode.load() == CacheMode::Normal) return;
+    state = std::make_unique<State>(State{fd, size, probe_residency(fd, size)});
+}
+
+PageCacheGuard::~PageCacheGuard() {
+    if (state) drop_range(state->fd, state->res, 0, state->size);
+}
+
+int open_for_scan(const std::string& path) {
+    int flags = O_RDONLY | O_CLOEXEC;
+    if (cache_mode.load() == CacheMode::Direct) flags |= O_DIRECT;
+
+    int fd = open(path.c_str(), flags);
+    if (fd < 0 && (flags & O_DIRECT) && errno == EINVAL)
+        fd = open(path.c_str(), flags & ~O_DIRECT);
+    return fd;
+}
+
+ReadStatus read_file_chunks(const std::string& path, const ChunkConsumer& consume) {
+    int fd = open_for_scan(path);
+    if (fd < 0) return ReadStatus::OpenFailed;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ReadStatus::ReadFailed;
+    }
+
+    ReadStatus result = read_fd_chunks(fd, 0, static_cast<uint64_t>(st.st_size), consume);
+    close(fd);
+    return result;
+}
@@ -0,0 +1,162 @@
+#include "filetype.h"
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+// Magic numbers. '?' in `mask` matches any byte at that position.
+struct Signature {
+    const char* bytes;
+    size_t len;
+    const char* mask;
+    FileType type;
+};
+
+#define SIG(b, t) { b, sizeof(b) - 1, nullptr, t }
+#define SIG_MASK(b, m, t) { b, sizeof(b) - 1, m, t }
+
+static const Signature SIGNATURES[] = {
+    SIG("\x7f" "ELF", FileType::Elf),
+    SIG("MZ", FileType::Pe),
+    SIG("\xfe\xed\xfa\xce", FileType::MachO),
+    SIG("\xfe\xed\xfa\xcf", FileType::MachO),
+    SIG("\xce\xfa\xed\xfe", FileType::MachO),
+    SIG("\xcf\xfa\xed\xfe", FileType::MachO),
+    SIG("\xca\xfe\xba\xbe", FileType::JavaClass),   // also fat Mach-O; both executable
+    SIG("#!", FileType::Script),
+    SIG("dex\n", FileType::Dex),
+    SIG("PK\x03\x04", FileType::Zip),
+    SIG("\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", FileType::OfficeOle),
+    SIG("%PDF-", FileType::Pdf),
+    SIG("\xff\xd8\xff", FileType::Media),
+    SIG("\x89PNG\r\n\x1a\n", FileType::Media),
+    SIG("GIF87a", FileType::Media),
+    SIG("GIF89a", FileType::Media),
+    SIG("RIFF", FileType::Media),
+    SIG("ID3", FileType::Media),
+    SIG("OggS", FileType::Media),
+    SIG("fLaC", FileType::Media),
+    SIG("\x1a\x45\xdf\xa3", FileType::Media),      // Matroska/WebM
+    SIG_MASK("????ftyp", "????....", FileType::Media),
+};
+
+// The signatures compiled into a byte trie, so classification is one walk
+// down the tree however many signatures there are
+class SignatureTree {
+public:
+    SignatureTree() {
+        nodes.emplace_back();
+        for (const Signature& sig : SIGNATURES) insert(sig);
+    }
+
+    FileType match(const unsigned char* head, size_t len) const {
+        FileType best = FileType::Unknown;
+        walk(0, head, len, 0, best);
+        return best;
+    }
+
+private:
+    struct Node {
+        std::array<int32_t, 256> next;
+        int32_t any = -1;       // wildcard edge
+        FileType type = FileType::Unknown;
+        Node() { next.fill(-1); }
+    };
+
+    void insert(const Signature& sig) {
+        int32_t node = 0;
+        for (size_t i = 0; i < sig.len; ++i) {
+            bool wildcard = sig.mask && sig.mask[i] == '?';
+            int32_t child = wildcard ? nodes[node].any
+                                     : nodes[node].next[static_cast<unsigned char>(sig.bytes[i])];
+            if (child < 0) {
+                child = static_cast<int32_t>(nodes.size());
+                nodes.emplace_back();
+                if (wildcard) nodes[node].any = child;
+                else nodes[node].next[static_cast<unsigned char>(sig.bytes[i])] = child;
+            }
+            node = child;
+        }
+        nodes[node].type = sig.type;
+    }
+
+    // Deepest match wins, so longer signatures override their prefixes
+    void walk(int32_t node, const unsigned char* head, size_t len, size_t depth, FileType& best) const {
+        if (nodes[node].type != FileType::Unknown) best = nodes[node].type;
+        if (depth >= len) return;
+        int32_t child = nodes[node].next[head[depth]];
+        if (child >= 0) walk(child, head, len, depth + 1, best);
+        if (nodes[node].any >= 0) walk(nodes[node].any, head, len, depth + 1, best);
+    }
+
+    std::vector<Node> nodes;
+};
+
+static const SignatureTree& signature_tree() {
+    static const SignatureTree tree;
+    return tree;
+}
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// JAR, APK and Office packages are all zips; the first member tells them apart
+static FileType refine_zip(const unsigned char* head, size_t len) {
+    // Local file header: name length at 26, name at 30
+    if (len < 30) return FileType::Zip;
+    size_t name_len = head[26] | (head[27] << 8);
+    if (30 + name_len > len) return FileType::Zip;
+    std::string name(reinterpret_cast<const char*>(head + 30), name_len);
+
+    if (name == "AndroidManifest.xml" || name == "classes.dex" || name == "resources.arsc")
+        return FileType::Apk;
+    if (starts_with(name, "META-INF/")) return FileType::Jar;
+    if (name == "[Content_Types].xml" || starts_with(name, "_rels/") || name == "mimetype" ||
+        starts_with(name, "word/") || starts_with(name, "xl/") || starts_with(name, "ppt/"))
+        return FileType::OfficeXml;
+    return FileType::Zip;
+}
+
+FileType sniff_file_type(const unsigned char* head, size_t len) {
+    FileType type = signature_tree().match(head, len);
+    if (type == FileType::Zip) type = refine_zip(head, len);
+    return type;
+}
+
+const char* file_type_name(FileType type) {
+    switch (type) {
+        case FileType::Elf: return "ELF";
+        case FileType::Pe: return "PE";
+        case FileType::MachO: return "Mach-O";
+        case FileType::JavaClass: return "Java class";
+        case FileType::Script: return "script";
+        case FileType::Jar: return "JAR";
+        case FileType::Apk: return "APK";
+        case FileType::Dex: return "DEX";
+        case FileType::OfficeOle: return "Office (OLE)";
+        case FileType::OfficeXml: return "Office (XML)";
+        case FileType::Zip: return "zip";
+        case FileType::Media: return "media";
+        case FileType::Pdf: return "PDF";
+        default: return "unknown";
+    }
+}
+
+bool is_executable_type(FileType type) {
+    switch (type) {
+        case FileType::Elf:
+        case FileType::Pe:
+        case FileType::MachO:
+        case FileType::JavaClass:
+        case FileType::Script:
+        case FileType::Jar:
+        case FileType::Apk:
+        case FileType::Dex:
+        case FileType::OfficeOle:
+        case FileType::OfficeXml:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,289 @@
+#include "fuzzyhash.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Pearson's permutation, as TLSH uses it for every bucket mapping
+static const uint8_t PEARSON[256] = {
+    1, 87, 49, 12, 176, 178, 102, 166, 121, 193, 6, 84, 249, 230, 44, 163,
+    14, 197, 213, 181, 161, 85, 218, 80, 64, 239, 24, 226, 236, 142, 38, 200,
+    110, 177, 104, 103, 141, 253, 255, 50, 77, 101, 81, 18, 45, 96, 31, 222,
+    25, 107, 190, 70, 86, 237, 240, 34, 72, 242, 20, 214, 244, 227, 149, 235,
+    97, 234, 57, 22, 60, 250, 82, 175, 208, 5, 127, 199, 111, 62, 135, 248,
+    174, 169, 211, 58, 66, 154, 106, 195, 245, 171, 17, 187, 182, 179, 0, 243,
+    132, 56, 148, 75, 128, 133, 158, 100, 130, 126, 91, 13, 153, 246, 216, 219,
+    119, 68, 223, 78, 83, 88, 201, 99, 122, 11, 92, 32, 136, 114, 52, 10,
+    138, 30, 48, 183, 156, 35, 61, 26, 143, 74, 251, 94, 129, 162, 63, 152,
+    170, 7, 115, 167, 241, 206, 3, 150, 55, 59, 151, 220, 90, 53, 23, 131,
+    125, 173, 15, 238, 79, 95, 89, 16, 105, 137, 225, 224, 217, 160, 37, 123,
+    118, 73, 2, 157, 46, 116, 9, 145, 134, 228, 207, 212, 202, 215, 69, 229,
+    27, 188, 67, 124, 168, 252, 42, 4, 29, 108, 21, 247, 19, 205, 39, 203,
+    233, 40, 186, 147, 198, 192, 155, 33, 164, 191, 98, 204, 165, 180, 117, 76,
+    140, 36, 210, 172, 41, 54, 159, 8, 185, 232, 113, 196, 231, 47, 146, 120,
+    51, 65, 28, 144, 254, 221, 93, 189, 194, 139, 112, 43, 71, 109, 184, 209,
+};
+
+// Buckets that make up the digest; the other half of the 256 only dilute
+static const size_t EFFECTIVE_BUCKETS = 128;
+
+static inline uint8_t pearson(uint8_t salt, uint8_t i, uint8_t j, uint8_t k) {
+    return PEARSON[PEARSON[PEARSON[salt ^ i] ^ j] ^ k];
+}
+
+static inline uint8_t swap_nibbles(uint8_t b) {
+    return static_cast<uint8_t>((b << 4) | (b >> 4));
+}
+
+void FuzzyDigest::update(const unsigned char* data, size_t len) {
+    // Every byte with the four before it feeds six of the window's
+    // triplets into the buckets (salts are PEARSON[2, 3, 5, 7, 11, 13])
+    uint8_t w1 = window[0], w2 = window[1], w3 = window[2], w4 = window[3];
+    uint8_t sum = checksum;
+    uint64_t fed = length;
+    for (size_t i = 0; i < len; ++i, ++fed) {
+        const uint8_t w0 = data[i];
+        if (fed >= 4) {
+            sum = pearson(1, w0, w1, sum);
+            buckets[pearson(49, w0, w1, w2)]++;
+            buckets[pearson(12, w0, w1, w3)]++;
+            buckets[pearson(178, w0, w2, w3)]++;
+            buckets[pearson(166, w0, w2, w4)]++;
+            buckets[pearson(84, w0, w1, w4)]++;
+            buckets[pearson(230, w0, w3, w4)]++;
+        }
+        w4 = w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = w0;
+    }
+    window[0] = w1;
+    window[1] = w2;
+    window[2] = w3;
+    window[3] = w4;
+    checksum = sum;
+    length = fed;
+}
+
+// Log-scaled length, finer for small files
+static uint8_t length_code(uint64_t len) {
+    double l = std::log(static_cast<double>(len));
+    int code;
+    if (len <= 656) code = static_cast<int>(std::floor(l / 0.4054651));
+    else if (len <= 3199) code = static_cast<int>(std::floor(l / 0.26236426 - 8.72777));
+    else code = static_cast<int>(std::floor(l / 0.0953102 - 62.5472));
+    return static_cast<uint8_t>(code & 0xff);
+}
+
+std::string FuzzyDigest::finish() const {
+    if (length < TLSH_MIN_LENGTH) return "";
+
+    uint32_t sorted[EFFECTIVE_BUCKETS];
+    std::copy(buckets, buckets + EFFECTIVE_BUCKETS, sorted);
+    std::nth_element(sorted, sorted + 31, sorted + EFFECTIVE_BUCKETS);
+    const uint32_t q1 = sorted[31];
+    std::nth_element(sorted + 32, sorted + 63, sorted + EFFECTIVE_BUCKETS);
+    const uint32_t q2 = sorted[63];
+    std::nth_element(sorted + 64, sorted + 95, sorted + EFFECTIVE_BUCKETS);
+    const uint32_t q3 = sorted[95];
+    size_t nonzero = 0;
+    for (size_t i = 0; i < EFFECTIVE_BUCKETS; ++i) nonzero += buckets[i] > 0;
+    // Too little variety to say anything about similarity
+    if (q3 == 0 || nonzero <= EFFECTIVE_BUCKETS / 2) return "";
+
+    TlshDigest digest;
+    digest.checksum = checksum;
+    digest.lvalue = length_code(length);
+    digest.q1_ratio = static_cast<uint8_t>(static_cast<uint32_t>(q1 * 100.0f / q3) % 16);
+    digest.q2_ratio = static_cast<uint8_t>(static_cast<uint32_t>(q2 * 100.0f / q3) % 16);
+    for (size_t i = 0; i < TLSH_CODE_SIZE; ++i) {
+        uint8_t h = 0;
+        for (size_t j = 0; j < 4; ++j) {
+            uint32_t k = buckets[4 * i + j];
+            if (q3 < k) h |= 3 << (j * 2);
+            else if (q2 < k) h |= 2 << (j * 2);
+            else if (q1 < k) h |= 1 << (j * 2);
+        }
+        digest.code[TLSH_CODE_SIZE - 1 - i] = h;
+    }
+    return digest.hex();
+}
+
+std::string TlshDigest::hex() const {
+    static const char DIGITS[] = "0123456789ABCDEF";
+    std::string out = "T1";
+    auto put = [&](uint8_t b) {
+        out += DIGITS[b >> 4];
+        out += DIGITS[b & 0xf];
+    };
+    put(swap_nibbles(checksum));
+    put(swap_nibbles(lvalue));
+    put(static_cast<uint8_t>((q1_ratio << 4) | q2_ratio));
+    for (uint8_t b : code) put(b);
+    return out;
+}
+
+bool TlshDigest::parse(const std::string& hex, TlshDigest& out) {
+    size_t pos = hex.size() == 2 * (TLSH_CODE_SIZE + 3) + 2 && (hex[0] == 'T' || hex[0] == 't') ? 2 : 0;
+    if (hex.size() - pos != 2 * (TLSH_CODE_SIZE + 3)) return false;
+    uint8_t bytes[TLSH_CODE_SIZE + 3];
+    for (size_t i = 0; i < sizeof(bytes); ++i, pos += 2) {
+        int value = 0;
+        for (size_t d = 0; d < 2; ++d) {
+            char c = hex[pos + d];
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) return false;
+            value = value * 16 + digit;
+        }
+        bytes[i] = static_cast<uint8_t>(value);
+    }
+    out.checksum = swap_nibbles(bytes[0]);
+    out.lvalue = swap_nibbles(bytes[1]);
+    out.q1_ratio = bytes[2] >> 4;
+    out.q2_ratio = bytes[2] & 0xf;
+    std::copy(bytes + 3, bytes + sizeof(bytes), out.code);
+    return true;
+}
+
+// Distance between two values on a circle of `range`
+static int mod_diff(int x, int y, int range) {
+    int d = std::abs(x - y);
+    return std::min(d, range - d);
+}
+
+// Summed code distance of two digest bytes: 1 per step between 2-bit
+// codes, 6 for opposite ends
+static const uint8_t* byte_distances() {
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> t(256 * 256);
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                int d = 0;
+                for (int s = 0; s < 8; s += 2) {
+                    int step = std::abs(((a >> s) & 3) - ((b >> s) & 3));
+                    d += step == 3 ? 6 : step;
+                }
+                t[a * 256 + b] = static_cast<uint8_t>(d);
+            }
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+int tlsh_distance(const TlshDigest& a, const TlshDigest& b, int cutoff) {
+    int diff = 0;
+    int ldiff = mod_diff(a.lvalue, b.lvalue, 256);
+    diff += ldiff <= 1 ? ldiff : ldiff * 12;
+    int q1diff = mod_diff(a.q1_ratio, b.q1_ratio, 16);
+    diff += q1diff <= 1 ? q1diff : (q1diff - 1) * 12;
+    int q2diff = mod_diff(a.q2_ratio, b.q2_ratio, 16);
+    diff += q2diff <= 1 ? q2diff : (q2diff - 1) * 12;
+    if (a.checksum != b.checksum) diff++;
+
+    const uint8_t* distances = byte_distances();
+    for (size_t i = 0; i < TLSH_CODE_SIZE && diff <= cutoff; i += 8) {
+        for (size_t j = i; j < i + 8; ++j) diff += distances[a.code[j] * 256 + b.code[j]];
+    }
+    return diff;
+}
+
+// Which 2-bit codes key each table: shuffled passes over all of them, so
+// every code keys the same number of tables
+const uint8_t* FuzzyIndex::key_codes() {
+    static const std::vector<uint8_t> codes = [] {
+        const size_t all = TLSH_CODE_SIZE * 4;
+        std::vector<uint8_t> order;
+        // Fixed seed: the tables must key the same way every run
+        uint32_t state = 0x9e3779b9u;
+        while (order.size() < LSH_TABLES * LSH_KEY_CODES) {
+            std::vector<uint8_t> pass(all);
+            for (size_t i = 0; i < all; ++i) pass[i] = static_cast<uint8_t>(i);
+            for (size_t i = all - 1; i > 0; --i) {
+                state = state * 1664525u + 1013904223u;
+                std::swap(pass[i], pass[(state >> 8) % (i + 1)]);
+            }
+            order.insert(order.end(), pass.begin(), pass.end());
+        }
+        order.resize(LSH_TABLES * LSH_KEY_CODES);
+        // A table across two passes may get a code twice; trade it for a later one
+        for (size_t i = 0; i < order.size(); ++i) {
+            const size_t first = i - i % LSH_KEY_CODES;
+            auto in_table = [&](uint8_t code, size_t end) {
+                return std::find(order.begin() + first, order.begin() + end, code) != order.begin() + end;
+            };
+            if (!in_table(order[i], i)) continue;
+            for (size_t j = first + LSH_KEY_CODES; j < order.size(); ++j) {
+                if (!in_table(order[j], i)) {
+                    std::swap(order[i], order[j]);
+                    break;
+                }
+            }
+        }
+        return order;
+    }();
+    return codes.data();
+}
+
+uint32_t FuzzyIndex::key(const TlshDigest& digest, size_t table) {
+    const uint8_t* codes = key_codes() + table * LSH_KEY_CODES;
+    uint32_t k = 0;
+    for (size_t i = 0; i < LSH_KEY_CODES; ++i)
+        k = (k << 2) | ((digest.code[codes[i] / 4] >> ((codes[i] % 4) * 2)) & 3);
+    return k;
+}
+
+bool FuzzyIndex::add(const std::string& digest, const std::string& name) {
+    TlshDigest parsed;
+    if (!TlshDigest::parse(digest, parsed)) return false;
+    digests.push_back(parsed);
+    names.push_back(name);
+    return true;
+}
+
+void FuzzyIndex::build() {
+    const size_t buckets = size_t(1) << (2 * LSH_KEY_CODES);
+    for (size_t t = 0; t < LSH_TABLES; ++t) {
+        // Counting sort of the digest ids by key
+        std::vector<uint32_t> keys(digests.size());
+        start[t].assign(buckets + 1, 0);
+        for (size_t i = 0; i < digests.size(); ++i) {
+            keys[i] = key(digests[i], t);
+            start[t][keys[i] + 1]++;
+        }
+        for (size_t b = 0; b < buckets; ++b) start[t][b + 1] += start[t][b];
+        ids[t].resize(digests.size());
+        std::vector<uint32_t> next(start[t].begin(), start[t].end() - 1);
+        for (size_t i = 0; i < digests.size(); ++i) ids[t][next[keys[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+bool FuzzyIndex::nearest(const std::string& digest, FuzzyHit& hit) const {
+    TlshDigest query;
+    if (digests.empty() || !TlshDigest::parse(digest, query)) return false;
+
+    int best = FUZZY_MATCH_DISTANCE + 1;
+    size_t best_id = 0;
+    auto consider = [&](size_t id) {
+        int d = tlsh_distance(query, digests[id], best);
+        if (d < best) {
+            best = d;
+            best_id = id;
+        }
+    };
+    if (start[0].empty()) {
+        // Not built: compare with everything
+        for (size_t id = 0; id < digests.size(); ++id) consider(id);
+    } else {
+        // A digest in several of the query's buckets is compared more than
+        // once; cheaper than remembering which were seen
+        for (size_t t = 0; t < LSH_TABLES; ++t) {
+            uint32_t k = key(query, t);
+            for (uint32_t i = start[t][k]; i < start[t][k + 1]; ++i) consider(ids[t][i]);
+        }
+    }
+    if (best > FUZZY_MATCH_DISTANCE) return false;
+    hit.name = names[best_id];
+    hit.distance = best;
+    return true;
+}
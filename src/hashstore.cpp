@@ -0,0 +1,339 @@
+#include "hashstore.h"
+#include "scan.h"
+#include <stdexcept>
+
+bool HashStore::add(const std::string& hex, int64_t sample_size) {
+    std::string digest = hex;
+    std::transform(digest.begin(), digest.end(), digest.begin(), ::tolower);
+    if (digest.find_first_not_of("0123456789abcdef") != std::string::npos) return false;
+
+    DigestTable* table;
+    switch (digest.length()) {
+        case 64: table = &sha256; break;
+        case 40: table = &sha1; break;
+        case 32: table = &md5; break;
+        default: return false;
+    }
+
+    if (sample_size >= 0) {
+        table->sized.insert(digest);
+        sizes.push_back(static_cast<uint64_t>(sample_size));
+    } else {
+        table->unsized.insert(digest);
+    }
+
+    // FNV-1a of the entry, summed so load order doesn't matter
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : digest + ":" + std::to_string(sample_size)) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    generation += h;
+    return true;
+}
+
+bool HashStore::add_fuzzy(const std::string& digest, const std::string& name) {
+    if (!fuzzy.add(digest, name)) return false;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : digest) {
+        h ^= static_cast<unsigned char>(::toupper(c));
+        h *= 0x100000001b3ull;
+    }
+    generation += h;
+    return true;
+}
+
+void HashStore::finalize() {
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    sizes.shrink_to_fit();
+    fuzzy.build();
+}
+
+bool DigestTable::contains(const std::string& hex) const {
+    return (!sized.empty() && is_hash_in_set(sized, hex)) || (!unsized.empty() && is_hash_in_set(unsized, hex));
+}
+
+unsigned HashStore::algorithms_for_size(uint64_t file_size) const {
+    if (std::binary_search(sizes.begin(), sizes.end(), file_size)) return algorithms();
+    unsigned algos = 0;
+    if (!sha256.unsized.empty()) algos |= DIGEST_SHA256;
+    if (!sha1.unsized.empty()) algos |= DIGEST_SHA1;
+    if (!md5.unsized.empty()) algos |= DIGEST_MD5;
+    if (!fuzzy.empty()) algos |= DIGEST_FUZZY;
+    return algos;
+}
+
+unsigned HashStore::algorithms() const {
+    unsigned algos = 0;
+    if (!sha256.empty()) algos |= DIGEST_SHA256;
+    if (!sha1.empty()) algos |= DIGEST_SHA1;
+    if (!md5.empty()) algos |= DIGEST_MD5;
+    if (!fuzzy.empty()) algos |= DIGEST_FUZZY;
+    return algos;
+}
+
+size_t HashStore::size() const {
+    return sha256.size() + sha1.size() + md5.size() + fuzzy.size();
+}
+
+std::string HashStore::match(const FileDigests& digests) const {
+    if (!digests.sha256.empty() && sha256.contains(digests.sha256)) return "sha256";
+    if (!digests.sha1.empty() && sha1.contains(digests.sha1)) return "sha1";
+    if (!digests.md5.empty() && md5.contains(digests.md5)) return "md5";
+    if (!digests.signature.empty()) return "signature " + digests.signature;
+    FuzzyHit hit;
+    if (!digests.fuzzy.empty() && fuzzy.nearest(digests.fuzzy, hit))
+        return "tlsh " + hit.name + " (distance " + std::to_string(hit.distance) + ")";
+    return "";
+}
+
+static EVP_MD_CTX* new_digest(const EVP_MD* md) {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) throw std::runtime_error("Failed to create digest context");
+    if (1 != EVP_DigestInit_ex(ctx, md, nullptr)) {
+        EVP_MD_CTX_free(ctx);
+        throw std::runtime_error("Failed to initialize digest");
+    }
+    return ctx;
+}
+
+MultiDigest::MultiDigest(unsigned algos) {
+    try {
+        if (algos & DIGEST_SHA256) sha256 = new_digest(EVP_sha256());
+        if (algos & DIGEST_SHA1) sha1 = new_digest(EVP_sha1());
+        if (algos & DIGEST_MD5) md5 = new_digest(EVP_md5());
+        if (algos & DIGEST_FUZZY) fuzzy = std::make_unique<FuzzyDigest>();
+        if (algos & DIGEST_ENTROPY) entropy = std::make_unique<EntropyMeter>();
+    } catch (...) {
+        EVP_MD_CTX_free(sha256);
+        EVP_MD_CTX_free(sha1);
+        EVP_MD_CTX_free(md5);
+        throw;
+    }
+}
+
+static EVP_MD_CTX* copy_digest(const EVP_MD_CTX* from) {
+    if (!from) return nullptr;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx || 1 != EVP_MD_CTX_copy_ex(ctx, from)) {
+        EVP_MD_CTX_free(ctx);
+        throw std::runtime_error("Failed to copy digest context");
+    }
+    return ctx;
+}
+
+MultiDigest::MultiDigest(const MultiDigest& other) {
+    try {
+        sha256 = copy_digest(other.sha256);
+        sha1 = copy_digest(other.sha1);
+        md5 = copy_digest(other.md5);
+        if (other.fuzzy) fuzzy = std::make_unique<FuzzyDigest>(*other.fuzzy);
+        if (other.entropy) entropy = std::make_unique<EntropyMeter>(*other.entropy);
+    } catch (...) {
+        EVP_MD_CTX_free(sha256);
+        EVP_MD_CTX_free(sha1);
+        EVP_MD_CTX_free(md5);
+        throw;
+    }
+}
+
+MultiDigest::~MultiDigest() {
+    EVP_MD_CTX_free(sha256);
+    EVP_MD_CTX_free(sha1);
+    EVP_MD_CTX_free(md5);
+}
+
+bool MultiDigest::update(const unsigned char* data, size_t len) {
+    if (sha256 && 1 != EVP_DigestUpdate(sha256, data, len)) return false;
+    if (sha1 && 1 != EVP_DigestUpdate(sha1, data, len)) return false;
+    if (md5 && 1 != EVP_DigestUpdate(md5, data, len)) return false;
+    if (fuzzy) fuzzy->update(data, len);
+    if (entropy) entropy->update(data, len);
+    return true;
+}
+
+static bool final_hex(EVP_MD_CTX* ctx, std::string& out) {
+    if (!ctx) return true;
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_len = 0;
+    if (1 != EVP_DigestFinal_ex(ctx, hash, &hash_len)) return false;
+    out = to_hex(hash, hash_len);
+    return true;
+}
+
+bool MultiDigest::finish(FileDigests& out) {
+    if (fuzzy) out.fuzzy = fuzzy->finish();
+    if (entropy) out.entropy = entropy->finish();
+    return final_hex(sha256, out.sha256) && final_hex(sha1, out.sha1) && final_hex(md5, out.md5);
+}
+
+unsigned MultiDigest::algorithms() const {
+    unsigned algos = 0;
+    if (sha256) algos |= DIGEST_SHA256;
+    if (sha1) algos |= DIGEST_SHA1;
+    if (md5) algos |= DIGEST_MD5;
+    if (fuzzy) algos |= DIGEST_FUZZY;
+    if (entropy) algos |= DIGEST_ENTROPY;
+    return algos;
+}
+
+bool load_hashes(const std::string& filename, HashStore& store) {
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        msg = "Error opening file: " + filename;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r\n"));
+        line.erase(line.find_last_not_of(" \t\r\n") + 1);
+
+        if (line.empty() || line[0] == '#') continue;
+
+        if (!store.add(line)) {
+            msg = "Invalid hash found: " + line;
+        }
+    }
+
+    return true;
+}
+
+// Splits one CSV line, honouring double quotes
+static std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '"') {
+            if (quoted && i + 1 < line.size() && line[i + 1] == '"') {
+                fields.back() += '"';
+                ++i;
+            } else {
+                quoted = !quoted;
+            }
+        } else if (c == ',' && !quoted) {
+            fields.emplace_back();
+        } else {
+            fields.back() += c;
+        }
+    }
+    for (auto& field : fields) {
+        field.erase(0, field.find_first_not_of(" \t\r\n"));
+        field.erase(field.find_last_not_of(" \t\r\n") + 1);
+    }
+    return fields;
+}
+
+static int64_t parse_size(const std::string& field) {
+    if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) return -1;
+    try {
+        return static_cast<int64_t>(std::stoull(field));
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+static bool load_clamav_hashes(std::ifstream& file, HashStore& store) {
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        // hash:size:name[:flevel]; size may be '*' for "any size"
+        size_t first = line.find(':');
+        size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+        if (second == std::string::npos) {
+            msg = "Invalid hash signature: " + line;
+            continue;
+        }
+        int64_t sample_size = parse_size(line.substr(first + 1, second - first - 1));
+        if (!store.add(line.substr(0, first), sample_size)) {
+            msg = "Invalid hash signature: " + line;
+        }
+    }
+    return true;
+}
+
+static bool load_csv_hashes(std::ifstream& file, HashStore& store) {
+    std::string line;
+    std::vector<size_t> digest_columns;
+    size_t size_column = std::string::npos;
+    size_t tlsh_column = std::string::npos;
+    size_t name_column = std::string::npos;
+
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+
+        // The MalwareBazaar export prefixes its header with '# '
+        if (digest_columns.empty()) {
+            if (line[0] == '#') line.erase(0, line.find_first_not_of("# "));
+            std::vector<std::string> header = split_csv(line);
+            for (size_t i = 0; i < header.size(); ++i) {
+                if (header[i] == "sha256_hash" || header[i] == "sha1_hash" || header[i] == "md5_hash")
+                    digest_columns.push_back(i);
+                else if (header[i] == "file_size")
+                    size_column = i;
+                else if (header[i] == "tlsh")
+                    tlsh_column = i;
+                else if (header[i] == "signature")
+                    name_column = i;
+            }
+            continue;
+        }
+        if (line[0] == '#') continue;
+
+        std::vector<std::string> fields = split_csv(line);
+        int64_t sample_size = size_column < fields.size() ? parse_size(fields[size_column]) : -1;
+        for (size_t column : digest_columns) {
+            if (column < fields.size() && !fields[column].empty())
+                store.add(fields[column], sample_size);
+        }
+        // Name fuzzy matches after the malware family, else the sample
+        if (tlsh_column < fields.size() && !fields[tlsh_column].empty()) {
+            std::string name = name_column < fields.size() ? fields[name_column] : "";
+            if ((name.empty() || name == "n/a") && !digest_columns.empty() && digest_columns[0] < fields.size())
+                name = fields[digest_columns[0]];
+            store.add_fuzzy(fields[tlsh_column], name);
+        }
+    }
+
+    if (digest_columns.empty()) {
+        msg = "No digest columns in CSV header";
+        return false;
+    }
+    return true;
+}
+
+static bool load_fuzzy_hashes(std::ifstream& file, HashStore& store) {
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        // digest, then an optional name after whitespace
+        size_t end = line.find_first_of(" \t\r");
+        size_t name_start = end == std::string::npos ? end : line.find_first_not_of(" \t", end);
+        std::string name = name_start == std::string::npos ? "" : line.substr(name_start);
+        name.erase(name.find_last_not_of(" \t\r") + 1);
+        std::string digest = line.substr(0, end);
+        if (!store.add_fuzzy(digest, name.empty() ? digest : name)) {
+            msg = "Invalid TLSH digest: " + line;
+        }
+    }
+    return true;
+}
+
+bool load_sized_hashes(const std::string& filename, HashStore& store) {
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        msg = "Error opening file: " + filename;
+        return false;
+    }
+
+    std::string ext = std::filesystem::path(filename).extension().string();
+    if (ext == ".csv") return load_csv_hashes(file, store);
+    if (ext == ".tlsh") return load_fuzzy_hashes(file, store);
+    return load_clamav_hashes(file, store);
+}
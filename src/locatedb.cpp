@@ -0,0 +1,175 @@
+#include "locatedb.h"
+#include "scan.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include <sys/stat.h>
+
+std::atomic<bool> use_locate_db(false);
+
+// mlocate.db(5): a header, then one record per directory holding its time
+// (the later of mtime and ctime) and the names it contained. All integers
+// are big-endian.
+static const char MLOCATE_MAGIC[8] = {'\0', 'm', 'l', 'o', 'c', 'a', 't', 'e'};
+
+enum : unsigned char {
+    ENTRY_FILE = 0,     // anything that isn't a directory
+    ENTRY_DIR = 1,
+    ENTRY_END = 2
+};
+
+struct LocateDir {
+    std::string path;
+    uint64_t sec = 0;
+    uint32_t nsec = 0;
+    std::vector<std::string> files;
+    std::vector<std::string> subdirs;
+};
+
+class LocateParser {
+public:
+    explicit LocateParser(const std::vector<char>& data) : data(data) {}
+
+    bool parse(std::vector<LocateDir>& dirs) {
+        if (data.size() < 16 || !std::equal(MLOCATE_MAGIC, MLOCATE_MAGIC + 8, data.begin())) return false;
+        pos = 8;
+        uint32_t conf_size = static_cast<uint32_t>(read_be(4));
+        if (data[pos] != 0) return false;   // format version
+        pos += 4;                           // version, visibility flag, padding
+
+        std::string db_root;
+        if (!read_string(db_root)) return false;
+        pos += conf_size;
+
+        while (pos < data.size()) {
+            LocateDir dir;
+            if (data.size() - pos < 16) return false;
+            dir.sec = read_be(8);
+            dir.nsec = static_cast<uint32_t>(read_be(4));
+            pos += 4;
+            if (!read_string(dir.path)) return false;
+
+            for (;;) {
+                if (pos >= data.size()) return false;
+                unsigned char type = static_cast<unsigned char>(data[pos++]);
+                if (type == ENTRY_END) break;
+                std::string name;
+                if (type > ENTRY_DIR || !read_string(name)) return false;
+                (type == ENTRY_DIR ? dir.subdirs : dir.files).push_back(std::move(name));
+            }
+            dirs.push_back(std::move(dir));
+        }
+        return true;
+    }
+
+private:
+    uint64_t read_be(size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            value = (value << 8) | static_cast<unsigned char>(data[pos++]);
+        return value;
+    }
+
+    bool read_string(std::string& out) {
+        if (pos >= data.size()) return false;
+        const char* start = data.data() + pos;
+        const void* nul = memchr(start, '\0', data.size() - pos);
+        if (!nul) return false;
+        out.assign(start, static_cast<const char*>(nul));
+        pos += out.size() + 1;
+        return true;
+    }
+
+    const std::vector<char>& data;
+    size_t pos = 0;
+};
+
+static std::string join_path(const std::string& dir, const std::string& name) {
+    return dir == "/" ? "/" + name : dir + "/" + name;
+}
+
+static bool under_dir(const std::string& path, const std::string& root) {
+    if (root == "/") return true;
+    return path.compare(0, root.size(), root) == 0 &&
+           (path.size() == root.size() || path[root.size()] == '/');
+}
+
+// True if `path` or one of its parents below `root` is already to be walked
+static bool inside_walked(const std::string& path, const std::string& root,
+                          const std::unordered_set<std::string>& walked) {
+    std::string dir = path;
+    for (;;) {
+        if (walked.count(dir)) return true;
+        if (dir.size() <= root.size()) return false;
+        size_t slash = dir.rfind('/');
+        if (slash == std::string::npos) return false;
+        dir.resize(slash == 0 ? 1 : slash);
+    }
+}
+
+bool locate_listing(const std::string& scan_root, LocateListing& out) {
+    std::string root = scan_root;
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    std::ifstream in(MLOCATE_DB_PATH, std::ios::binary);
+    if (!in) {
+        // plocate.db has no published format, only plocate's own headers,
+        // and only databases its updatedb wrote carry directory times. A
+        // misread time would vouch for a directory that changed, so hosts
+        // with only plocate get a walk.
+        struct stat st;
+        msg = stat(PLOCATE_DB_PATH.c_str(), &st) == 0
+            ? "Locate database: plocate format is not supported"
+            : "Locate database: " + MLOCATE_DB_PATH + " not found";
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<LocateDir> dirs;
+    if (!LocateParser(data).parse(dirs)) {
+        msg = "Locate database: " + MLOCATE_DB_PATH + " is damaged or of an unknown version";
+        return false;
+    }
+
+    std::unordered_set<std::string> known;
+    for (const LocateDir& dir : dirs) known.insert(dir.path);
+    if (!known.count(root)) {
+        msg = "Locate database: " + root + " is not covered (pruned by updatedb?)";
+        return false;
+    }
+
+    // Parents sort before their children, so a directory's fate is
+    // settled before anything below it is looked at
+    std::sort(dirs.begin(), dirs.end(),
+              [](const LocateDir& a, const LocateDir& b) { return a.path < b.path; });
+
+    std::unordered_set<std::string> walked;
+    out.database = MLOCATE_DB_PATH;
+    for (const LocateDir& dir : dirs) {
+        if (!under_dir(dir.path, root) || inside_walked(dir.path, root, walked)) continue;
+
+        struct stat st;
+        if (lstat(dir.path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) continue;  // gone since
+
+        // An entry was added, removed or renamed since updatedb ran
+        const struct timespec& newer = st.st_ctim.tv_sec > st.st_mtim.tv_sec ||
+            (st.st_ctim.tv_sec == st.st_mtim.tv_sec && st.st_ctim.tv_nsec > st.st_mtim.tv_nsec)
+            ? st.st_ctim : st.st_mtim;
+        if (static_cast<uint64_t>(newer.tv_sec) != dir.sec ||
+            static_cast<uint32_t>(newer.tv_nsec) != dir.nsec) {
+            walked.insert(dir.path);
+            out.walk_dirs.push_back(dir.path);
+            continue;
+        }
+
+        for (const std::string& name : dir.files) out.files.push_back(join_path(dir.path, name));
+
+        // Subdirectories updatedb pruned (PRUNEPATHS, PRUNEFS) have no record
+        for (const std::string& name : dir.subdirs) {
+            std::string sub = join_path(dir.path, name);
+            if (!known.count(sub) && walked.insert(sub).second) out.walk_dirs.push_back(sub);
+        }
+    }
+    return true;
+}
@@ -6,6 +6,8 @@
 #include <string>
 #include <filesystem>
 #include <fstream>
+#include <algorithm>
+#include <cstdlib>
 
 
 #include "widget.h"
@@ -14,16 +16,183 @@
 #include "callback.h"
 #include "downloadhash.h"
 #include "gui.h"
+#include "filereader.h"
+#include "kernelhash.h"
+#include "dedup.h"
+#include "changetracker.h"
+#include "onaccess.h"
+#include "locatedb.h"
+#include "packageindex.h"
+#include "bundle.h"
+#include "sigengine.h"
+#include "yararules.h"
+#include "archive.h"
+#include "container.h"
+#include "memscan.h"
 
 bool mouseLeftPressed = false;
 Button* currentlyHoveredButton = nullptr;
-std::vector<Button> scanButtons, sideButtons;
+std::vector<Button> scanButtons, sideButtons, networkButtons;
 std::vector<Widget> scanRects, sideRects,networkRects;
 
-std::unordered_set<std::string> hash_set;
+HashStore hash_store;
+
+// Loads the byte signatures (.ndb) and YARA rules (.yar/.yara) in the
+// database directory and compiles them, reusing the automata cached by an
+// earlier run
+static void loadContentSignatures() {
+    std::error_code db_ec;
+    for (const auto& entry : std::filesystem::directory_iterator(DownloadConfig::LOCAL_DB_DIR, db_ec)) {
+        std::string ext = entry.path().extension().string();
+        bool ok = true;
+        if (ext == ".ndb") ok = content_signatures.load_ndb(entry.path().string());
+        else if (ext == ".yar" || ext == ".yara") ok = yara_rules.load(entry.path().string());
+        if (!ok) std::cerr << msg << std::endl;
+    }
+    content_signatures.compile(SIGNATURE_CACHE_FILE);
+    yara_rules.compile(RULE_CACHE_FILE);
+    if (!content_signatures.empty())
+        std::cout << "Loaded " << content_signatures.size() << " content signatures ("
+                  << content_signatures.skipped() << " unsupported)" << std::endl;
+    if (!yara_rules.empty() || yara_rules.skipped() > 0)
+        std::cout << "Loaded " << yara_rules.size() << " YARA rules (" << yara_rules.skipped()
+                  << " outside the supported subset)" << std::endl;
+}
+
+// Downloads the feeds if missing and loads every digest table into hash_store
+static void loadHashDatabase() {
+    // Update hash database before initializing the rest
+    std::ifstream fileHash("full_sha256.txt");
+    if(!fileHash.good())
+    {
+        if (!updateHashDatabase()) {
+            std::cerr << "Failed to update hash database: " << msg << std::endl;
+            std::cerr << "Will try to use existing database file..." << std::endl;
+        }
+        std::cout << "Updating malware hash database..." << std::endl;
+    }
+
+    // Load every digest table; MD5 and SHA-1 feeds are optional
+    load_hashes(DownloadConfig::DEFAULT_OUTPUT_PATH, hash_store);
+    load_hashes(DownloadConfig::SHA1_OUTPUT_PATH, hash_store);
+    load_hashes(DownloadConfig::MD5_OUTPUT_PATH, hash_store);
+
+    // Sized signatures let the scanner skip files no sample could match
+    std::error_code db_ec;
+    for (const auto& entry : std::filesystem::directory_iterator(DownloadConfig::LOCAL_DB_DIR, db_ec)) {
+        std::string ext = entry.path().extension().string();
+        if (ext == ".hdb" || ext == ".hsb" || ext == ".csv" || ext == ".tlsh")
+            load_sized_hashes(entry.path().string(), hash_store);
+    }
+    hash_store.finalize();
+    // The txt feeds carry no sample sizes; the size prefilter can only pass
+    // over files for the digests that did
+    size_t unsized = hash_store.sha256.unsized.size() + hash_store.sha1.unsized.size() +
+                     hash_store.md5.unsized.size();
+    if (unsized > 0)
+        std::cout << "Loaded " << unsized << " digests without sample sizes; every file is hashed for them"
+                  << std::endl;
+    if (!hash_store.fuzzy.empty())
+        std::cout << "Loaded " << hash_store.fuzzy.size() << " fuzzy digests" << std::endl;
+    loadContentSignatures();
+}
 
 int main(int argc, char** argv) {
+    // Scan options
+    bool track_changes = false;
+    bool daemon = false;
+    OnAccessOptions onaccess;
+    std::string export_path, bundle_root = "/", bench_dir;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--cache-neutral") {
+            // Don't evict the page cache of co-located services
+            cache_mode = CacheMode::DropAfterRead;
+        } else if (arg == "--direct-io") {
+            cache_mode = CacheMode::Direct;
+        } else if (arg == "--track-changes") {
+            // Keep a dirty set so repeat Fullscans only touch what changed
+            track_changes = true;
+        } else if (arg == "--reflink-dedup") {
+            // Hash reflinked copies (btrfs/XFS) once, like hardlinks
+            reflink_dedup = true;
+        } else if (arg == "--locate-db") {
+            // Take Fullscan's file list from updatedb's database
+            use_locate_db = true;
+        } else if (arg == "--trust-packages") {
+            // Speed over coverage: don't hash untouched dpkg/rpm files
+            trust_packages = true;
+        } else if (arg.rfind("--export-bundle=", 0) == 0) {
+            // Build-time: hash a golden image into a verdict bundle and exit
+            export_path = arg.substr(16);
+        } else if (arg.rfind("--bundle-root=", 0) == 0) {
+            bundle_root = arg.substr(14);
+        } else if (arg.rfind("--import-bundle=", 0) == 0) {
+            // Hosts cloned from that image only hash what differs from it
+            if (imported_bundle.load(arg.substr(16)))
+                std::cout << "Imported " << imported_bundle.size() << " paths from verdict bundle" << std::endl;
+            else
+                std::cerr << msg << std::endl;
+        } else if (arg == "--daemon") {
+            // Headless on-access scanning instead of the GUI
+            daemon = true;
+        } else if (arg == "--all-opens") {
+            onaccess.all_opens = true;
+        } else if (arg.rfind("--deadline-ms=", 0) == 0) {
+            onaccess.deadline_ms = std::max(1, std::atoi(arg.c_str() + 14));
+        } else if (arg == "--containers") {
+            // Walk running containers' overlay layers, shared ones once
+            scan_containers = true;
+        } else if (arg.rfind("--memscan-rate=", 0) == 0) {
+            // MiB/s the memory scan reads from other processes, 0 for no limit
+            memscan_rate_mib = static_cast<unsigned>(std::max(0, std::atoi(arg.c_str() + 15)));
+        } else if (arg == "--skip-archives") {
+            // Hash ZIP-based archives as opaque files, without their members
+            scan_archives = false;
+        } else if (arg.rfind("--bench-signatures=", 0) == 0) {
+            // Measure hashing and signature throughput over a corpus and exit
+            bench_dir = arg.substr(19);
+        }
+    }
+
+    if (track_changes) {
+#ifdef __linux__
+        if (change_tracker.start("/", TRACKER_STATE_FILE))
+            std::cout << "Tracking changes with " << change_tracker.backend() << std::endl;
+        else
+            std::cerr << "Failed to start change tracker" << std::endl;
+#endif
+    }
+
+    // Use AF_ALG offload only on hosts where it beats OpenSSL
+    select_hash_backend();
+
+    if (!export_path.empty()) {
+        if (!export_bundle(bundle_root, export_path)) {
+            std::cerr << "Failed to export verdict bundle: " << msg << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote verdict bundle " << export_path << std::endl;
+        return 0;
+    }
+
+    if (!bench_dir.empty()) {
+        loadContentSignatures();
+        benchmark_content_scan(bench_dir);
+        return 0;
+    }
+
+    if (daemon) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        loadHashDatabase();
+        bool ok = run_onaccess_daemon(hash_store, onaccess);
+        change_tracker.stop();
+        curl_global_cleanup();
+        return ok ? 0 : 1;
+    }
+
     glutInit(&argc, argv);
+
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -43,19 +212,7 @@ int main(int argc, char** argv) {
     // Initialize CURL globally
     curl_global_init(CURL_GLOBAL_ALL);
     
-    // Update hash database before initializing the rest
-    std::ifstream fileHash("full_sha256.txt");
-    if(!fileHash.good())
-    {
-        if (!updateHashDatabase()) {
-            std::cerr << "Failed to update hash database: " << msg << std::endl;
-            std::cerr << "Will try to use existing database file..." << std::endl;
-        }
-        std::cout << "Updating malware hash database..." << std::endl;
-    }
-
-    // Load hashes into an unordered_set (keep your existing code)
-    hash_set = load_hashes("full_sha256.txt");
+    loadHashDatabase();
 
     glfwMakeContextCurrent(window);
 
@@ -91,7 +248,8 @@ int main(int argc, char** argv) {
     scanButtons = {
         Button(110.0f, 500.0f, 80.0f, 30.0f, "Scan", "Scan", ""),
         Button(210.0f, 500.0f, 80.0f, 30.0f, "Fullscan", "Fullscan", ""),
-        Button(160.0f, 460.0f, 80.0f, 30.0f, "Log", "Log", ""),
+        Button(110.0f, 460.0f, 80.0f, 30.0f, "Quick", "Quick", ""),
+        Button(210.0f, 460.0f, 80.0f, 30.0f, "Log", "Log", ""),
     };
 
     // Add rounded rectangles
@@ -110,8 +268,18 @@ int main(int argc, char** argv) {
         Widget(80.0f, 5.0f, 720.0f, 140.0f, 20.0f, rectColor, msg),
     };
 
+    networkButtons = {
+        Button(110.0f, 500.0f, 80.0f, 30.0f, "Processes", "Processes", ""),
+        Button(210.0f, 500.0f, 80.0f, 30.0f, "Log", "Log", ""),
+        Button(110.0f, 460.0f, 80.0f, 30.0f, "Memory", "Memory", ""),
+    };
+
     networkRects = {
-        Widget(100.0f, 300.0f, 300.0f, 200.0f, 20.0f, rectColor)
+        Widget(100.0f, 450.0f, 200.0f, 100.0f, 20.0f, rectColor),
+        Widget(80.0f, 350.0f, 200.0f, 30.0f, 0.0f, rectColor, status),
+        Widget(80.0f, 320.0f, 200.0f, 30.0f, 0.0f, rectColor, numofthreat),
+        Widget(80.0f, 150.0f, 720.0f, 100.0f, 20.0f, rectColor, filePath),
+        Widget(80.0f, 5.0f, 720.0f, 140.0f, 20.0f, rectColor, msg),
     };
 
     float rotation = 0.0f;
@@ -156,6 +324,12 @@ int main(int argc, char** argv) {
             button.updateState(mouseX, mouseY, &button == currentlyHoveredButton);
             if (button.isHovered) newHoveredButton = &button;
         }
+        if (network) {
+            for (auto& button : networkButtons) {
+                button.updateState(mouseX, mouseY, &button == currentlyHoveredButton);
+                if (button.isHovered) newHoveredButton = &button;
+            }
+        }
 
         // Apply fade-out to the previous hovered button if necessary
         if (currentlyHoveredButton && currentlyHoveredButton != newHoveredButton) {
@@ -209,12 +383,27 @@ int main(int argc, char** argv) {
         {
             for (const auto& rect : networkRects)
                 rect.render();
+            for (const auto& button : networkButtons)
+                button.render(mouseX, mouseY);
+
+            if (scanning) {
+                char progressText[64];
+                snprintf(progressText, sizeof(progressText), "%d/%d files",
+                    files_processed.load(), total_files.load());
+                glColor3f(1.0f, 1.0f, 1.0f);
+                renderText(progressText, 450, 400);
+            }
+            networkRects[1].setText("status: " + status);
+            networkRects[2].setText("viruses found: " + numofthreat);
+            networkRects[3].setText("filepath: " + filePath);
+            networkRects[4].setText("msg: " + msg);
         }
         // Swap the screen buffers
         glfwSwapBuffers(window);
         newHoveredButton = nullptr;
         currentlyHoveredButton = nullptr;
     }
+    change_tracker.stop();
     curl_global_cleanup();
     // Terminate GLFW
     glfwTerminate();
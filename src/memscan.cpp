@@ -0,0 +1,231 @@
+#include "memscan.h"
+#include "scan.h"
+#include "sigengine.h"
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+std::atomic<unsigned> memscan_rate_mib(32);
+MemoryScanner memory_scanner;
+
+// One process_vm_readv call reads at most this much, in pieces of at most
+// READ_PIECE_BYTES (one remote iovec each)
+static const size_t READ_BATCH_BYTES = 1 << 20;
+static const size_t READ_PIECE_BYTES = 256 * 1024;
+// Reserved-but-untouched regions read back as zeros; don't read terabytes of them
+static const uint64_t MAX_REGION_BYTES = 64ull << 20;
+// Heap and anonymous data read per process, after its executable regions
+static const uint64_t WRITABLE_BUDGET_PER_PROCESS = 16ull << 20;
+
+// Whole contents of a /proc file; "" if it can't be read
+static std::string read_proc_file(const std::string& path) {
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return data;
+    char buffer[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) data.append(buffer, static_cast<size_t>(n));
+    close(fd);
+    return data;
+}
+
+// Sorts a maps entry into a region class; false for what isn't scanned here
+static bool classify(const std::string& perms, uint64_t inode, const std::string& name, RegionClass& kind) {
+    if (perms[0] != 'r') return false;      // guard pages, PROT_NONE reservations
+    const bool memfd = name.compare(0, 7, "/memfd:") == 0;
+    const bool anonymous = inode == 0 && (name.empty() || name == "[heap]" || name == "[stack]" ||
+                                          name.compare(0, 6, "[anon:") == 0);
+    if (!memfd && !anonymous) return false;  // files, and [vdso]/[vvar]
+    if (perms[2] == 'x') kind = RegionClass::ExecutableAnonymous;
+    else if (memfd) kind = RegionClass::Memfd;
+    else if (perms[1] == 'w') kind = RegionClass::WritableAnonymous;
+    else return false;
+    return true;
+}
+
+bool MemoryScanner::plan(std::vector<MemoryRegion>& regions) {
+    regions.clear();
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        msg = "Error: Cannot read /proc";
+        return false;
+    }
+
+    const pid_t self = getpid();
+    decltype(last_seen) seen;
+    while (dirent* entry = readdir(proc)) {
+        const char* name = entry->d_name;
+        if (!*name || strspn(name, "0123456789") != strlen(name)) continue;
+        const pid_t pid = static_cast<pid_t>(atoi(name));
+        if (pid == self) continue;
+
+        uint64_t writable_budget = WRITABLE_BUDGET_PER_PROCESS;
+        const std::string maps = read_proc_file(std::string("/proc/") + name + "/maps");
+        size_t pos = 0;
+        while (pos < maps.size()) {
+            size_t eol = maps.find('\n', pos);
+            if (eol == std::string::npos) eol = maps.size();
+            const std::string line = maps.substr(pos, eol - pos);
+            pos = eol + 1;
+
+            unsigned long long start, end, offset, inode;
+            char perms[8];
+            unsigned major, minor;
+            int name_at = 0;
+            if (sscanf(line.c_str(), "%llx-%llx %7s %llx %x:%x %llu%n", &start, &end, perms, &offset, &major,
+                       &minor, &inode, &name_at) < 7 || strlen(perms) < 4)
+                continue;
+            size_t name_start = line.find_first_not_of(' ', static_cast<size_t>(name_at));
+            MemoryRegion region;
+            region.name = name_start == std::string::npos ? "" : line.substr(name_start);
+            if (!classify(perms, inode, region.name, region.kind)) continue;
+
+            region.pid = pid;
+            region.start = start;
+            region.end = std::min<uint64_t>(end, start + MAX_REGION_BYTES);
+            region.perms = perms;
+            if (region.kind == RegionClass::WritableAnonymous) {
+                if (writable_budget == 0) continue;
+                region.end = std::min(region.end, region.start + writable_budget);
+                writable_budget -= region.end - region.start;
+            }
+            auto key = std::make_tuple(pid, static_cast<uint64_t>(start), static_cast<uint64_t>(end), region.perms);
+            region.changed = !last_seen.empty() && !last_seen.count(key);
+            seen.insert(key);
+            regions.push_back(std::move(region));
+        }
+    }
+    closedir(proc);
+    last_seen = std::move(seen);
+
+    // By class, then what changed since the last pass; a process's regions
+    // stay together inside each so they share read batches
+    std::stable_sort(regions.begin(), regions.end(), [](const MemoryRegion& a, const MemoryRegion& b) {
+        if (a.kind != b.kind) return a.kind < b.kind;
+        if (a.changed != b.changed) return a.changed;
+        return a.pid < b.pid;
+    });
+    return true;
+}
+
+void MemoryScanner::scan(const std::vector<MemoryRegion>& regions, const HitHandler& hit,
+                         MemoryScanStats& stats, const std::function<void()>& progress) {
+    // The targets come first: this thread yields the CPU to them
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+
+    std::vector<unsigned char> buffer(READ_BATCH_BYTES);
+    const auto started = std::chrono::steady_clock::now();
+    uint64_t paced_bytes = 0;
+
+    size_t index = 0;
+    uint64_t offset = 0;                    // into regions[index]
+    std::unique_ptr<SignatureScanner> scanner;
+    MemoryHit found;
+    pid_t denied_pid = 0;
+
+    // Done with regions[index]: report it and move to the next
+    auto finish_region = [&](bool failed) {
+        if (failed) stats.failed++;
+        if (!found.signature.empty()) hit(found);
+        found = MemoryHit();
+        scanner.reset();
+        stats.regions++;
+        index++;
+        offset = 0;
+        if (progress) progress();
+    };
+
+    while (index < regions.size()) {
+        const MemoryRegion& first = regions[index];
+        if (first.pid == denied_pid) {
+            finish_region(false);
+            continue;
+        }
+
+        // One batch: the next pieces of this process's regions, in order
+        struct Piece {
+            size_t region;
+            uint64_t offset;
+            size_t len;
+        };
+        std::vector<Piece> pieces;
+        std::vector<struct iovec> remote;
+        size_t total = 0;
+        for (size_t r = index, o = offset; r < regions.size() && regions[r].pid == first.pid; ++r, o = 0) {
+            const MemoryRegion& region = regions[r];
+            uint64_t left = region.end - region.start - o;
+            while (left > 0 && total < READ_BATCH_BYTES && remote.size() < IOV_MAX) {
+                size_t len = static_cast<size_t>(std::min<uint64_t>({left, READ_PIECE_BYTES, READ_BATCH_BYTES - total}));
+                pieces.push_back({r, o, len});
+                remote.push_back({reinterpret_cast<void*>(region.start + o), len});
+                total += len;
+                o += len;
+                left -= len;
+            }
+            if (total >= READ_BATCH_BYTES || remote.size() >= IOV_MAX) break;
+        }
+
+        struct iovec local = {buffer.data(), total};
+        ssize_t got = process_vm_readv(first.pid, &local, 1, remote.data(), remote.size(), 0);
+        if (got < 0) {
+            if (errno == EPERM || errno == ESRCH) {
+                // Not ours to read, or gone: drop every region of the process
+                if (errno == EPERM) stats.denied++;
+                denied_pid = first.pid;
+            } else {
+                finish_region(true);    // EFAULT: unmapped since it was listed
+            }
+            continue;
+        }
+        stats.bytes += static_cast<uint64_t>(got);
+
+        // Whole pieces read come first; a short read stops inside the piece
+        // whose pages went away, and its region is given up there
+        size_t consumed = 0;
+        for (const Piece& piece : pieces) {
+            if (piece.region != index) finish_region(false);
+            const MemoryRegion& region = regions[index];
+            size_t len = std::min(piece.len, static_cast<size_t>(got) - consumed);
+            if (!scanner) {
+                scanner = std::make_unique<SignatureScanner>(content_signatures);
+                const MemoryRegion* matched = &region;
+                scanner->report_all([&found, matched](const ContentSignature& sig, uint64_t at) {
+                    if (!found.signature.empty()) return;
+                    found.pid = matched->pid;
+                    found.address = matched->start + at;
+                    found.region = matched->name.empty() ? "[anon]" : matched->name;
+                    found.signature = sig.name;
+                });
+            }
+            scanner->update(buffer.data() + consumed, len);
+            consumed += len;
+            offset = piece.offset + len;
+            if (len < piece.len) {
+                finish_region(true);
+                break;
+            }
+        }
+        if (consumed == total && index < regions.size() && offset == regions[index].end - regions[index].start)
+            finish_region(false);
+
+        // Pace to the configured rate
+        paced_bytes += total;
+        const unsigned rate = memscan_rate_mib.load();
+        if (rate > 0) {
+            auto due = started + std::chrono::microseconds(paced_bytes * 1000000 / (uint64_t(rate) << 20));
+            if (due > std::chrono::steady_clock::now()) std::this_thread::sleep_until(due);
+        }
+    }
+}
@@ -0,0 +1,264 @@
+#include "onaccess.h"
+#include "scan.h"
+#include "verdictcache.h"
+#include "changetracker.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <csignal>
+#include <climits>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/fanotify.h>
+#endif
+
+#ifdef __linux__
+
+static std::atomic<bool> daemon_stop(false);
+
+static void handle_stop_signal(int) {
+    daemon_stop = true;
+}
+
+// One permission event waiting for an answer. The kernel blocks the
+// accessing process until exactly one response is written for `fd`.
+struct PendingAccess {
+    int fd = -1;
+    int pid = 0;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool> answered{false};
+};
+
+class OnAccessDaemon {
+public:
+    OnAccessDaemon(const HashStore& store, const OnAccessOptions& opts)
+        : hash_store(store), options(opts), algos(scan_algorithms(store)) {}
+
+    bool run();
+
+private:
+    void respond(PendingAccess& access, bool allow);
+    void handle_events();
+    void expire_deadlines();
+    void worker_loop();
+    void report(int fd, int pid, const std::string& hash, const std::string& matched, bool late);
+
+    const HashStore& hash_store;
+    OnAccessOptions options;
+    const unsigned algos;
+
+    int fan_fd = -1;
+    std::mutex write_mutex;
+    std::ofstream log;      // opened before marking so logging never waits on ourselves
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<std::shared_ptr<PendingAccess>> queue;
+    std::vector<std::shared_ptr<PendingAccess>> waiting;    // unanswered, for the deadline sweep
+    bool stopping = false;
+
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> hashed{0};
+    std::atomic<uint64_t> timed_out{0};
+};
+
+void OnAccessDaemon::respond(PendingAccess& access, bool allow) {
+    if (access.answered.exchange(true)) return;
+    struct fanotify_response response;
+    response.fd = access.fd;
+    response.response = allow ? FAN_ALLOW : FAN_DENY;
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (write(fan_fd, &response, sizeof(response)) < 0) {
+        // Nothing to recover: the kernel allows the access when we go away
+    }
+}
+
+void OnAccessDaemon::report(int fd, int pid, const std::string& hash, const std::string& matched, bool late) {
+    char path[PATH_MAX];
+    std::string link = "/proc/self/fd/" + std::to_string(fd);
+    ssize_t n = readlink(link.c_str(), path, sizeof(path) - 1);
+    path[n > 0 ? n : 0] = '\0';
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+    log << (late ? "MALWARE DETECTED (allowed, verdict after deadline): " : "BLOCKED: ")
+        << path << " (pid " << pid << ")\n";
+    log << "Hash: " << hash << "\n";
+    log << "Matched: " << matched << "\n\n";
+    log.flush();
+}
+
+void OnAccessDaemon::handle_events() {
+    alignas(struct fanotify_event_metadata) char buffer[16 * 1024];
+    for (;;) {
+        ssize_t len = read(fan_fd, buffer, sizeof(buffer));
+        if (len <= 0) return;
+
+        auto* md = reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+        for (; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+            if (md->vers != FANOTIFY_METADATA_VERSION || md->fd < 0) continue;
+
+            auto access = std::make_shared<PendingAccess>();
+            access->fd = md->fd;
+            access->pid = md->pid;
+
+            // Our own opens (the log file) must never wait on ourselves
+            if (md->pid == getpid()) {
+                respond(*access, true);
+                close(md->fd);
+                continue;
+            }
+
+            // Unchanged since it was last hashed: answer right here
+            FileIdentity id;
+            FileDigests digests;
+            if (FileIdentity::from_fd(md->fd, id) && verdict_cache.lookup(id, algos, digests)) {
+                cache_hits++;
+                std::string matched = hash_store.match(digests);
+                respond(*access, matched.empty());
+                if (!matched.empty()) report(md->fd, md->pid, digests.sha256, matched, false);
+                close(md->fd);
+                continue;
+            }
+
+            access->deadline = std::chrono::steady_clock::now() +
+                               std::chrono::milliseconds(options.deadline_ms);
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                queue.push_back(access);
+                waiting.push_back(access);
+            }
+            queue_cv.notify_one();
+        }
+    }
+}
+
+void OnAccessDaemon::expire_deadlines() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (auto it = waiting.begin(); it != waiting.end();) {
+        PendingAccess& access = **it;
+        if (!access.answered && now >= access.deadline) {
+            // Fail open: bounded latency matters more than this one verdict.
+            // The worker still finishes and fills the cache for next time.
+            respond(access, true);
+            timed_out++;
+        }
+        if (access.answered) it = waiting.erase(it);
+        else ++it;
+    }
+}
+
+void OnAccessDaemon::worker_loop() {
+    for (;;) {
+        std::shared_ptr<PendingAccess> access;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping && queue.empty()) return;
+            access = queue.front();
+            queue.pop_front();
+        }
+
+        FileDigests digests;
+        bool ok = false;
+        try {
+            ok = digest_cached(access->fd, algos, digests);
+        } catch (const std::exception&) {
+            ok = false;
+        }
+        hashed++;
+
+        std::string matched = ok ? hash_store.match(digests) : "";
+        bool late = access->answered.load();
+        respond(*access, matched.empty());
+        if (!matched.empty()) report(access->fd, access->pid, digests.sha256, matched, late);
+        close(access->fd);
+    }
+}
+
+bool OnAccessDaemon::run() {
+    fan_fd = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK,
+                           O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fan_fd < 0) {
+        std::cerr << "fanotify permission events unavailable: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    log.open("log.txt", std::ios::app);
+
+    uint64_t mask = FAN_OPEN_EXEC_PERM;
+    if (options.all_opens) mask |= FAN_OPEN_PERM;
+
+    size_t marked = 0;
+    for (const std::string& dir : local_mounts(options.root)) {
+        if (fanotify_mark(fan_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, dir.c_str()) == 0)
+            marked++;
+        else
+            std::cerr << "Not watching " << dir << ": " << strerror(errno) << std::endl;
+    }
+    if (marked == 0) {
+        close(fan_fd);
+        return false;
+    }
+
+    unsigned num_workers = options.workers ? options.workers : std::max(2u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < num_workers; ++i)
+        workers.emplace_back(&OnAccessDaemon::worker_loop, this);
+
+    std::signal(SIGINT, handle_stop_signal);
+    std::signal(SIGTERM, handle_stop_signal);
+    std::cout << "On-access scanning " << marked << " filesystems ("
+              << (options.all_opens ? "open+exec" : "exec") << ", deadline "
+              << options.deadline_ms << " ms)" << std::endl;
+
+    struct pollfd pfd = { fan_fd, POLLIN, 0 };
+    auto last_stats = std::chrono::steady_clock::now();
+    while (!daemon_stop) {
+        // Wake up often enough to honour the shortest deadline
+        int rc = poll(&pfd, 1, std::max(1, std::min(options.deadline_ms / 4, 50)));
+        if (rc < 0 && errno != EINTR) break;
+        if (rc > 0 && (pfd.revents & POLLIN)) handle_events();
+        expire_deadlines();
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_stats >= std::chrono::minutes(1)) {
+            std::cout << "On-access: " << cache_hits.load() << " cached, " << hashed.load()
+                      << " hashed, " << timed_out.load() << " past deadline" << std::endl;
+            last_stats = now;
+        }
+    }
+
+    // Let every blocked process through before going away
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        for (auto& access : waiting) respond(*access, true);
+        waiting.clear();
+    }
+    queue_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+    close(fan_fd);
+    return true;
+}
+
+bool run_onaccess_daemon(const HashStore& hash_store, const OnAccessOptions& options) {
+    OnAccessDaemon daemon(hash_store, options);
+    return daemon.run();
+}
+
+#else
+
+bool run_onaccess_daemon(const HashStore&, const OnAccessOptions&) {
+    std::cerr << "On-access scanning needs Linux fanotify" << std::endl;
+    return false;
+}
+
+#endif
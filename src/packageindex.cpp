@@ -0,0 +1,166 @@
+#include "packageindex.h"
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <filesystem>
+#include <sys/stat.h>
+
+std::atomic<bool> trust_packages(false);
+PackageIndex package_index;
+
+static const char* DPKG_STATUS = "/var/lib/dpkg/status";
+static const char* DPKG_INFO_DIR = "/var/lib/dpkg/info";
+static const char* RPM_DATABASES[] = {"/var/lib/rpm/rpmdb.sqlite", "/var/lib/rpm/Packages"};
+
+// RPMFILE_CONFIG in rpm's FILEFLAGS
+static const unsigned long RPM_CONFIG_FILE = 1;
+
+// rpm's FILEDIGESTALGO values we can check; packages without the tag use MD5
+static unsigned rpm_digest_algo(unsigned long algo) {
+    switch (algo) {
+        case 0:
+        case 1: return DIGEST_MD5;
+        case 2: return DIGEST_SHA1;
+        case 8: return DIGEST_SHA256;
+        default: return 0;
+    }
+}
+
+static int64_t mtime_ns(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static int64_t rpm_database_stamp() {
+    for (const char* db : RPM_DATABASES) {
+        int64_t stamp = mtime_ns(db);
+        if (stamp >= 0) return stamp;
+    }
+    return -1;
+}
+
+void PackageIndex::refresh() {
+    int64_t dpkg_now = mtime_ns(DPKG_STATUS);
+    int64_t rpm_now = rpm_database_stamp();
+    if (dpkg_now == dpkg_stamp && rpm_now == rpm_stamp) return;
+
+    files.clear();
+    real_dirs.clear();
+    dpkg_stamp = dpkg_now;
+    rpm_stamp = rpm_now;
+    if (dpkg_stamp >= 0) load_dpkg();
+    if (rpm_stamp >= 0) load_rpm();
+}
+
+// Packages name paths as shipped; on merged-/usr systems /bin/ls is really
+// /usr/bin/ls, which is the path the walker reports
+void PackageIndex::add(const std::string& path, const Owned& owned) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash == 0) {
+        files[path] = owned;
+        return;
+    }
+
+    std::string dir = path.substr(0, slash);
+    auto it = real_dirs.find(dir);
+    if (it == real_dirs.end()) {
+        char resolved[PATH_MAX];
+        it = real_dirs.emplace(dir, realpath(dir.c_str(), resolved) ? resolved : dir).first;
+    }
+    files[it->second + path.substr(slash)] = owned;
+}
+
+void PackageIndex::load_dpkg() {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(DPKG_INFO_DIR, ec)) {
+        if (entry.path().extension() != ".md5sums") continue;
+
+        // dpkg writes <package>.list once the files are unpacked, so an
+        // untouched file's ctime can't be later than that
+        std::filesystem::path list = entry.path();
+        list.replace_extension(".list");
+        Owned owned;
+        owned.installed_ns = mtime_ns(list.string());
+        if (owned.installed_ns < 0) continue;
+
+        // "<md5>  <path relative to />"; conffiles are listed elsewhere.
+        // dpkg records no per-file size or mtime.
+        std::ifstream md5sums(entry.path());
+        std::string line;
+        owned.algo = DIGEST_MD5;
+        while (std::getline(md5sums, line)) {
+            if (line.size() < 35 || line[32] != ' ') continue;
+            owned.digest = line.substr(0, 32);
+            add("/" + line.substr(34), owned);
+        }
+    }
+}
+
+void PackageIndex::load_rpm() {
+    FILE* pipe = popen("rpm -qa --qf '[%{FILENAMES}\\t%{FILESIZES}\\t%{FILEMTIMES}\\t%{FILEFLAGS}"
+                       "\\t%{FILEDIGESTS}\\t%{=FILEDIGESTALGO}\\n]' 2>/dev/null", "r");
+    if (!pipe) return;
+
+    // Any later transaction moves the database's mtime, and a package's
+    // INSTALLTIME is taken before its files are written, so neither bounds
+    // a file's ctime; rpm files are only ever confirmed by digest
+    Owned owned;
+
+    char line[PATH_MAX + 256];
+    while (fgets(line, sizeof(line), pipe)) {
+        std::string record(line);
+        if (!record.empty() && record.back() == '\n') record.pop_back();
+
+        size_t tabs[5];
+        size_t from = 0, found = 0;
+        for (; found < 5; ++found, ++from) {
+            from = record.find('\t', from);
+            if (from == std::string::npos) break;
+            tabs[found] = from;
+        }
+        if (found < 5) continue;
+
+        if (std::strtoul(record.c_str() + tabs[2] + 1, nullptr, 10) & RPM_CONFIG_FILE) continue;
+        owned.size = std::strtoll(record.c_str() + tabs[0] + 1, nullptr, 10);
+        owned.mtime = std::strtoll(record.c_str() + tabs[1] + 1, nullptr, 10);
+        owned.digest = record.substr(tabs[3] + 1, tabs[4] - tabs[3] - 1);
+        owned.algo = rpm_digest_algo(std::strtoul(record.c_str() + tabs[4] + 1, nullptr, 10));
+        add(record.substr(0, tabs[0]), owned);
+    }
+    pclose(pipe);
+}
+
+const PackageIndex::Owned* PackageIndex::find(const ScanTarget& target) const {
+    // Any path of the inode will do; the first one seen may be an alias
+    auto it = files.find(target.path.string());
+    for (size_t i = 0; it == files.end() && i < target.aliases.size(); ++i)
+        it = files.find(target.aliases[i].string());
+    return it == files.end() ? nullptr : &it->second;
+}
+
+bool PackageIndex::unchanged(const ScanTarget& target) const {
+    const Owned* owned = find(target);
+    // mtime and size can be put back; ctime can't without root and a clock change
+    if (!owned || owned->installed_ns < 0 || target.ctime_ns > owned->installed_ns) return false;
+    if (owned->size >= 0 && static_cast<uint64_t>(owned->size) != target.size) return false;
+    if (owned->mtime >= 0 && owned->mtime != target.mtime_ns / 1000000000) return false;
+    return true;
+}
+
+unsigned PackageIndex::digest_algo(const ScanTarget& target) const {
+    const Owned* owned = find(target);
+    return owned && !owned->digest.empty() ? owned->algo : 0;
+}
+
+bool PackageIndex::matches_digest(const ScanTarget& target, const FileDigests& digests) const {
+    const Owned* owned = find(target);
+    if (!owned || owned->digest.empty()) return false;
+    switch (owned->algo) {
+        case DIGEST_MD5: return digests.md5 == owned->digest;
+        case DIGEST_SHA1: return digests.sha1 == owned->digest;
+        case DIGEST_SHA256: return digests.sha256 == owned->digest;
+        default: return false;
+    }
+}
@@ -0,0 +1,70 @@
+#include "priority.h"
+#include <algorithm>
+#include <sys/stat.h>
+
+static const char* TEMP_DIRS[] = {"/tmp/", "/var/tmp/", "/dev/shm/", "/run/user/"};
+static const char* EXEC_DIRS[] = {"/bin/", "/sbin/", "/libexec/"};
+
+const char* priority_name(ScanPriority priority) {
+    switch (priority) {
+        case ScanPriority::TempDir: return "temp";
+        case ScanPriority::Downloads: return "downloads";
+        case ScanPriority::Executable: return "executable";
+        case ScanPriority::Recent: return "recent";
+        default: return "other";
+    }
+}
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+// Class of one path, without the time-based Recent
+static ScanPriority path_priority(const std::string& path, uint32_t mode) {
+    for (const char* dir : TEMP_DIRS)
+        if (starts_with(path, dir)) return ScanPriority::TempDir;
+
+    if ((starts_with(path, "/home/") || starts_with(path, "/root/")) &&
+        path.find("/Downloads/") != std::string::npos)
+        return ScanPriority::Downloads;
+
+    if (mode & (S_IXUSR | S_IXGRP | S_IXOTH)) return ScanPriority::Executable;
+    for (const char* dir : EXEC_DIRS)
+        if (path.find(dir) != std::string::npos) return ScanPriority::Executable;
+
+    return ScanPriority::Rest;
+}
+
+ScanPriority scan_priority(const ScanTarget& target, time_t now) {
+    ScanPriority best = path_priority(target.path.string(), target.mode);
+    for (const auto& alias : target.aliases)
+        best = std::min(best, path_priority(alias.string(), target.mode));
+
+    if (best == ScanPriority::Rest && target.ctime_ns / 1000000000 >= now - RECENT_SECONDS)
+        best = ScanPriority::Recent;
+    return best;
+}
+
+void order_by_priority(std::vector<ScanTarget>& targets, std::vector<size_t>* counts) {
+    const time_t now = time(nullptr);
+
+    std::vector<std::pair<ScanPriority, size_t>> keys;
+    keys.reserve(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) keys.emplace_back(scan_priority(targets[i], now), i);
+
+    std::stable_sort(keys.begin(), keys.end(), [&](const auto& a, const auto& b) {
+        if (a.first != b.first) return a.first < b.first;
+        if (a.first == ScanPriority::Recent) return targets[a.second].ctime_ns > targets[b.second].ctime_ns;
+        return false;
+    });
+
+    if (counts) {
+        counts->assign(static_cast<size_t>(ScanPriority::Count), 0);
+        for (const auto& key : keys) (*counts)[static_cast<size_t>(key.first)]++;
+    }
+
+    std::vector<ScanTarget> ordered;
+    ordered.reserve(targets.size());
+    for (const auto& key : keys) ordered.push_back(std::move(targets[key.second]));
+    targets.swap(ordered);
+}
@@ -0,0 +1,129 @@
+#include "procscan.h"
+#include "scan.h"
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// What the kernel appends to the name of an unlinked file
+static const char DELETED_SUFFIX[] = " (deleted)";
+
+// Whole contents of a small /proc file; "" if it can't be read
+static std::string read_proc_file(const std::string& path) {
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return data;
+    char buffer[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) data.append(buffer, static_cast<size_t>(n));
+    close(fd);
+    return data;
+}
+
+static bool ends_with(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+class ImageCollector {
+public:
+    explicit ImageCollector(std::vector<ProcessImage>& images) : images(images) {}
+
+    // `fallback` reads the same content through the process when `path` no
+    // longer names it from here
+    void add(pid_t pid, uint64_t dev, uint64_t ino, const std::string& path, const std::string& fallback) {
+        auto key = std::make_pair(dev, ino);
+        auto it = by_inode.find(key);
+        if (it != by_inode.end()) {
+            std::vector<pid_t>& pids = images[it->second].pids;
+            if (pids.back() != pid) pids.push_back(pid);
+            return;
+        }
+
+        ProcessImage image;
+        image.path = path;
+        image.dev = dev;
+        image.ino = ino;
+        image.pids.push_back(pid);
+        struct stat st;
+        if (!path.empty() && path[0] == '/' && !ends_with(path, DELETED_SUFFIX) &&
+            stat(path.c_str(), &st) == 0 && st.st_dev == dev && st.st_ino == ino) {
+            image.read_path = path;
+        } else if (stat(fallback.c_str(), &st) == 0) {
+            image.read_path = fallback;
+        } else {
+            return;     // exited, or map_files is closed to us
+        }
+        if (!S_ISREG(st.st_mode)) return;
+        image.size = static_cast<uint64_t>(st.st_size);
+        by_inode[key] = images.size();
+        images.push_back(std::move(image));
+    }
+
+private:
+    std::vector<ProcessImage>& images;
+    std::map<std::pair<uint64_t, uint64_t>, size_t> by_inode;
+};
+
+bool list_process_images(std::vector<ProcessImage>& images, size_t* process_count) {
+    images.clear();
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        msg = "Error: Cannot read /proc";
+        return false;
+    }
+
+    ImageCollector collector(images);
+    size_t processes = 0;
+    while (dirent* entry = readdir(proc)) {
+        const char* name = entry->d_name;
+        if (!*name || strspn(name, "0123456789") != strlen(name)) continue;
+        const pid_t pid = static_cast<pid_t>(atoi(name));
+        const std::string dir = std::string("/proc/") + name;
+
+        // Kernel threads have no executable
+        struct stat exe_st;
+        const std::string exe = dir + "/exe";
+        if (stat(exe.c_str(), &exe_st) != 0) continue;
+        processes++;
+        char target[4096];
+        ssize_t len = readlink(exe.c_str(), target, sizeof(target) - 1);
+        collector.add(pid, exe_st.st_dev, exe_st.st_ino, len > 0 ? std::string(target, len) : "", exe);
+
+        // "start-end perms offset major:minor inode   path", one line per mapping.
+        // Only executable ones: data mappings (locale archives, fonts, caches)
+        // aren't code and can be large.
+        const std::string maps = read_proc_file(dir + "/maps");
+        size_t pos = 0;
+        while (pos < maps.size()) {
+            size_t eol = maps.find('\n', pos);
+            if (eol == std::string::npos) eol = maps.size();
+            const std::string line = maps.substr(pos, eol - pos);
+            pos = eol + 1;
+
+            char range[64], perms[8];
+            unsigned long long offset, inode;
+            unsigned major, minor;
+            int path_at = 0;
+            if (sscanf(line.c_str(), "%63s %7s %llx %x:%x %llu %n", range, perms, &offset, &major, &minor,
+                       &inode, &path_at) < 6 || inode == 0 || perms[2] != 'x' || path_at == 0)
+                continue;
+            collector.add(pid, makedev(major, minor), inode, line.substr(static_cast<size_t>(path_at)),
+                          dir + "/map_files/" + range);
+        }
+    }
+    closedir(proc);
+    if (process_count) *process_count = processes;
+    return true;
+}
+
+std::string process_name(pid_t pid) {
+    std::string name = read_proc_file("/proc/" + std::to_string(pid) + "/comm");
+    if (!name.empty() && name.back() == '\n') name.pop_back();
+    return name;
+}
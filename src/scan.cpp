@@ -1,6 +1,25 @@
 #include "scan.h"
+#include "filereader.h"
+#include "kernelhash.h"
+#include "changetracker.h"
+#include "verdictcache.h"
+#include "dirsummary.h"
+#include "locatedb.h"
+#include "packageindex.h"
+#include "bundle.h"
+#include "priority.h"
+#include "filetype.h"
+#include "sigengine.h"
+#include "yararules.h"
+#include "archive.h"
+#include "container.h"
+#include "procscan.h"
+#include "memscan.h"
+#include <unistd.h>
 #include <fstream>
 #include <future>
+#include <sys/stat.h>
+#include <cstring>
 
 std::mutex queue_mutex;
 std::mutex output_mutex;
@@ -13,6 +32,14 @@ std::string status;
 std::string numofthreat;
 std::string msg;
 std::atomic<size_t> threat(0);
+std::atomic<int> files_skipped(0);
+static std::atomic<int> files_not_executable(0);
+static std::atomic<size_t> archive_members(0);
+static std::atomic<size_t> archive_limited(0);
+static std::atomic<size_t> high_entropy_files(0);
+static std::atomic<size_t> trusted_files(0);
+static std::atomic<uint64_t> trusted_bytes(0);
+static std::atomic<size_t> package_verified(0);
 
 // RAII wrapper for OpenSSL digest context
 struct DigestContextRAII {
@@ -26,7 +53,23 @@ struct DigestContextRAII {
     DigestContextRAII& operator=(const DigestContextRAII&) = delete;
 };
 
+std::string to_hex(const unsigned char* data, size_t len) {
+    std::stringstream ss;
+    for (size_t i = 0; i < len; ++i) {
+        ss << std::hex << std::setw(2) << std::setfill('0')
+           << static_cast<int>(data[i]);
+    }
+    return ss.str();
+}
+
 std::string sha256_file(const std::string& path) {
+    // Zero-copy kernel hashing when it won the startup benchmark. It would
+    // pull pages into the cache behind DropAfterRead's back, so only in Normal mode.
+    if (hash_backend == HashBackend::KernelAlg && cache_mode == CacheMode::Normal) {
+        std::string hash = kernel_sha256_file(path);
+        if (!hash.empty()) return hash;
+    }
+
     DigestContextRAII mdctx;
     
     if (1 != EVP_DigestInit_ex(mdctx.ctx, EVP_sha256(), nullptr)) {
@@ -34,21 +77,25 @@ std::string sha256_file(const std::string& path) {
         return "";
     }
 
-    std::ifstream file(path, std::ifstream::binary);
-    if (!file) {
-        msg = "Error opening file: " + path;
+    bool update_failed = false;
+    ReadStatus read_status = read_file_chunks(path,
+        [&](const unsigned char* data, size_t len) {
+            if (1 != EVP_DigestUpdate(mdctx.ctx, data, len)) {
+                update_failed = true;
+                return false;
+            }
+            return true;
+        });
+
+    if (update_failed) {
+        msg = "Error updating digest";
         return "";
     }
-
-    std::vector<char> buffer(8192);
-    while (file.read(buffer.data(), buffer.size())) {
-        if (1 != EVP_DigestUpdate(mdctx.ctx, buffer.data(), file.gcount())) {
-            msg = "Error updating digest";
-            return "";
-        }
+    if (read_status == ReadStatus::OpenFailed) {
+        msg = "Error opening file: " + path;
+        return "";
     }
-
-    if (file.bad()) {
+    if (read_status != ReadStatus::Ok) {
         msg = "Error reading file";
         return "";
     }
@@ -60,12 +107,270 @@ std::string sha256_file(const std::string& path) {
         return "";
     }
 
-    std::stringstream ss;
-    for (unsigned int i = 0; i < hash_len; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') 
-           << static_cast<int>(hash[i]);
+    return to_hex(hash.data(), hash_len);
+}
+
+unsigned scan_algorithms(const HashStore& hash_store) {
+    unsigned algos = hash_store.algorithms() | DIGEST_SHA256 | DIGEST_ENTROPY;
+    if (!content_signatures.empty() || !yara_rules.empty()) algos |= DIGEST_CONTENT;
+    return algos;
+}
+
+void ContentMatch::update(const unsigned char* data, size_t len) {
+    signatures.update(data, len);
+    rules.update(data, len);
+}
+
+std::string ContentMatch::finish(int fd, uint64_t size) {
+    if (!signatures.result().empty()) return signatures.result();
+    std::string rule = rules.evaluate(fd, size);
+    return rule.empty() ? "" : "YARA." + rule;
+}
+
+std::string ContentMatch::finish(const RangeReader& read, uint64_t size) {
+    if (!signatures.result().empty()) return signatures.result();
+    std::string rule = rules.evaluate(read, size);
+    return rule.empty() ? "" : "YARA." + rule;
+}
+
+// Streams bytes [offset, size) of `fd` into `digest`, and into `content`
+// when given. With `midstate` set (its offset inside the range), a copy of
+// the state at that offset and the check of the block before it are kept
+// on the way past.
+static bool hash_range(int fd, uint64_t offset, uint64_t size, MultiDigest& digest, Midstate* midstate,
+                       ContentMatch* content = nullptr) {
+    const uint64_t mid = midstate ? midstate->offset : 0;
+    const uint64_t check_start = mid >= MIDSTATE_CHECK_SIZE ? mid - MIDSTATE_CHECK_SIZE : 0;
+    MultiDigest check(DIGEST_SHA256);
+    uint64_t pos = offset;
+
+    bool update_failed = false;
+    ReadStatus read_status = read_fd_chunks(fd, offset, size,
+        [&](const unsigned char* data, size_t len) {
+            size_t split = len;
+            if (midstate && pos < mid && pos + len >= mid) split = static_cast<size_t>(mid - pos);
+            if (midstate && pos < mid && pos + len > check_start) {
+                uint64_t from = std::max(pos, check_start);
+                uint64_t to = std::min<uint64_t>(pos + len, mid);
+                check.update(data + (from - pos), static_cast<size_t>(to - from));
+            }
+            if (content) content->update(data, len);
+
+            if (!digest.update(data, split)) {
+                update_failed = true;
+                return false;
+            }
+            if (midstate && (split < len || pos + len == mid)) {
+                midstate->state = std::make_shared<const MultiDigest>(digest);
+                if (!digest.update(data + split, len - split)) {
+                    update_failed = true;
+                    return false;
+                }
+            }
+            pos += len;
+            return true;
+        });
+
+    if (update_failed) {
+        msg = "Error updating digest";
+        return false;
     }
-    return ss.str();
+    if (read_status != ReadStatus::Ok) {
+        msg = "Error reading file";
+        return false;
+    }
+    if (midstate && midstate->state) {
+        FileDigests check_digest;
+        if (check.finish(check_digest)) midstate->check = check_digest.sha256;
+        else midstate->state.reset();
+    }
+    return true;
+}
+
+// Reads the first bytes of `fd` into `head`, the first read of a hash pass
+static bool read_head(int fd, uint64_t size, FileHead& head) {
+    head.len = 0;
+    ReadStatus read_status = read_fd_chunks(fd, 0, std::min<uint64_t>(size, sizeof(head.bytes)),
+        [&](const unsigned char* data, size_t len) {
+            memcpy(head.bytes + head.len, data, len);
+            head.len += len;
+            return true;
+        });
+    return read_status == ReadStatus::Ok;
+}
+
+bool digest_fd(int fd, uint64_t size, unsigned algos, FileDigests& out, Midstate* midstate,
+               const FileHead* head) {
+    // The kernel's bytes never reach us, so a native executable whose
+    // entropy is asked for is hashed here. Anything else would measure
+    // nothing anyway, so its entropy counts as computed either way.
+    FileHead sniffed;
+    if (!midstate && (algos & ~DIGEST_ENTROPY) == DIGEST_SHA256 && hash_backend == HashBackend::KernelAlg &&
+        cache_mode == CacheMode::Normal) {
+        if ((algos & DIGEST_ENTROPY) && !head) {
+            if (!read_head(fd, size, sniffed)) {
+                msg = "Error reading file";
+                return false;
+            }
+            head = &sniffed;
+        }
+        if (!(algos & DIGEST_ENTROPY) || !entropy_measures(head->bytes, head->len)) {
+            out.sha256 = kernel_sha256_fd(fd);
+            if (!out.sha256.empty()) return true;
+        }
+    }
+
+    MultiDigest digest(algos);
+    std::unique_ptr<ContentMatch> content;
+    if (algos & DIGEST_CONTENT) content = std::make_unique<ContentMatch>();
+    uint64_t offset = 0;
+    if (head) {
+        if (!digest.update(head->bytes, head->len)) {
+            msg = "Error updating digest";
+            return false;
+        }
+        if (content) content->update(head->bytes, head->len);
+        offset = head->len;
+    }
+    if (!hash_range(fd, offset, size, digest, midstate, content.get())) return false;
+    if (!digest.finish(out)) {
+        msg = "Error finalizing digest";
+        return false;
+    }
+    if (content) out.signature = content->finish(fd, size);
+    return true;
+}
+
+// True if the block before the midstate still holds what was hashed. Only
+// the tail is compared, so an in-place rewrite further back that also
+// grows the file goes unnoticed until the entry is evicted; that is the
+// price of not re-reading append-only files.
+static bool midstate_still_valid(int fd, const Midstate& midstate) {
+    MultiDigest check(DIGEST_SHA256);
+    ReadStatus read_status = read_fd_chunks(fd, midstate.offset - MIDSTATE_CHECK_SIZE, midstate.offset,
+        [&](const unsigned char* data, size_t len) { return check.update(data, len); });
+    FileDigests check_digest;
+    return read_status == ReadStatus::Ok && check.finish(check_digest) &&
+           check_digest.sha256 == midstate.check;
+}
+
+bool digest_cached(int fd, unsigned algos, FileDigests& out, FileHead* head) {
+    FileIdentity id;
+    if (!FileIdentity::from_fd(fd, id)) {
+        msg = "Error reading file";
+        return false;
+    }
+    if (verdict_cache.lookup(id, algos, out)) return true;
+    if (head && head->len == 0 && !read_head(fd, id.size, *head)) {
+        msg = "Error reading file";
+        return false;
+    }
+
+    // Keep a midstate of large files for when they grow. AF_ALG can't hand
+    // its state back, so none when the kernel backend is in use, and a
+    // signature may straddle the old end, so none when matching content.
+    Midstate next;
+    next.offset = id.size - id.size % READ_ALIGNMENT;
+    const bool keep_midstate = id.size >= MIDSTATE_MIN_SIZE && hash_backend == HashBackend::OpenSSL &&
+                               !(algos & DIGEST_CONTENT);
+
+    // Grown since the last visit: go on from where that hash left off
+    Midstate saved;
+    if (keep_midstate && verdict_cache.midstate(id, algos, saved) && midstate_still_valid(fd, saved)) {
+        MultiDigest digest(*saved.state);
+        Midstate* capture = next.offset > saved.offset ? &next : nullptr;
+        if (hash_range(fd, saved.offset, id.size, digest, capture) && digest.finish(out)) {
+            verdict_cache.store(id, digest.algorithms(), out, capture && next.state ? next : saved);
+            return true;
+        }
+    }
+
+    if (!digest_fd(fd, id.size, algos, out, keep_midstate ? &next : nullptr, head)) return false;
+    verdict_cache.store(id, algos, out, next);
+    return true;
+}
+
+bool digest_if_executable(int fd, unsigned algos, FileDigests& out, bool& skipped, FileHead* file_head) {
+    skipped = false;
+    FileIdentity id;
+    if (!FileIdentity::from_fd(fd, id)) {
+        msg = "Error reading file";
+        return false;
+    }
+    if (verdict_cache.lookup(id, algos, out)) return true;
+
+    // The head is the first read of the hash, not an extra one
+    unsigned char head[SNIFF_SIZE];
+    size_t head_len = 0;
+    ReadStatus read_status = read_fd_chunks(fd, 0, std::min<uint64_t>(id.size, SNIFF_SIZE),
+        [&](const unsigned char* data, size_t len) {
+            memcpy(head + head_len, data, len);
+            head_len += len;
+            return true;
+        });
+    if (read_status != ReadStatus::Ok) {
+        msg = "Error reading file";
+        return false;
+    }
+    if (!is_executable_type(sniff_file_type(head, head_len))) {
+        // Left unhashed, and remembered so that the caller gets the head
+        // only the first time the file is seen like this
+        if (!verdict_cache.unchanged(id)) {
+            if (file_head) {
+                file_head->len = std::min(head_len, sizeof(file_head->bytes));
+                memcpy(file_head->bytes, head, file_head->len);
+            }
+            verdict_cache.store(id, 0, FileDigests());
+        }
+        skipped = true;
+        return false;
+    }
+    if (file_head) {
+        file_head->len = std::min(head_len, sizeof(file_head->bytes));
+        memcpy(file_head->bytes, head, file_head->len);
+    }
+
+    MultiDigest digest(algos);
+    std::unique_ptr<ContentMatch> content;
+    if (algos & DIGEST_CONTENT) content = std::make_unique<ContentMatch>();
+    if (!digest.update(head, head_len)) {
+        msg = "Error updating digest";
+        return false;
+    }
+    if (content) content->update(head, head_len);
+    if (!hash_range(fd, head_len, id.size, digest, nullptr, content.get())) return false;
+    if (!digest.finish(out)) {
+        msg = "Error finalizing digest";
+        return false;
+    }
+    if (content) out.signature = content->finish(fd, id.size);
+    verdict_cache.store(id, algos, out);
+    return true;
+}
+
+bool digest_file(const std::string& path, unsigned algos, FileDigests& out, FileHead* head) {
+    int fd = open_for_scan(path);
+    if (fd < 0) {
+        msg = "Error opening file: " + path;
+        return false;
+    }
+    bool ok = digest_cached(fd, algos, out, head);
+    close(fd);
+    return ok;
+}
+
+// Quick scans only: digest_if_executable by path
+static bool digest_executable_file(const std::string& path, unsigned algos, FileDigests& out, bool& skipped,
+                                   FileHead* head) {
+    skipped = false;
+    int fd = open_for_scan(path);
+    if (fd < 0) {
+        msg = "Error opening file: " + path;
+        return false;
+    }
+    bool ok = digest_if_executable(fd, algos, out, skipped, head);
+    close(fd);
+    return ok;
 }
 
 bool is_hash_in_set(const std::unordered_set<std::string>& hash_set, 
@@ -76,51 +381,222 @@ bool is_hash_in_set(const std::unordered_set<std::string>& hash_set,
     return hash_set.find(lowercase_hash) != hash_set.end();
 }
 
-std::unordered_set<std::string> load_hashes(const std::string& filename) {
-    std::unordered_set<std::string> hash_set;
-    std::ifstream file(filename);
-    
-    if (!file.is_open()) {
-        msg = "Error opening file: " + filename;
-        return hash_set;
-    }
+// Keeps the directories of `target` out of the next clean-walk summary
+static void invalidate_summaries(const ScanTarget& target) {
+    dir_summaries.invalidate(target.path.parent_path().string());
+    for (const auto& alias : target.aliases)
+        dir_summaries.invalidate(alias.parent_path().string());
+}
 
-    std::string line;
-    while (std::getline(file, line)) {
-        line.erase(0, line.find_first_not_of(" \t\r\n"));
-        line.erase(line.find_last_not_of(" \t\r\n") + 1);
+// An archive member that matched, reported once the archive's own verdict is in
+struct MemberMatch {
+    std::string path;
+    std::string hash;
+    std::string matched;
+};
 
-        if (line.empty() || line[0] == '#') continue;
+// Walks the members of `target` if it is an archive, collecting those that
+// match; false if it isn't one. With `outer`, a stream archive's own
+// digests are taken in the same read and `outer_hashed` is set.
+static bool scan_archive_members(const HashStore& hash_store, const ScanTarget& target, unsigned algos,
+                                 ScanMode mode, std::vector<MemberMatch>& matches,
+                                 FileDigests* outer = nullptr, bool* outer_hashed = nullptr) {
+    ArchiveStats stats;
+    bool opened = scan_archive(target.path.string(), algos, mode == ScanMode::Quick,
+        [&](const ArchiveMember& member) {
+            std::string matched = hash_store.match(member.digests);
+            if (!matched.empty()) matches.push_back({member.path, member.digests.sha256, matched});
+        }, stats, outer);
+    if (!opened) return false;
 
-        std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+    if (outer_hashed) *outer_hashed = stats.outer_hashed;
+    archive_members += stats.members;
+    archive_limited += stats.limited;
+    // A member left unread may be what matches next time
+    if (stats.limited > 0 || stats.skipped > 0) invalidate_summaries(target);
+    return true;
+}
 
-        if (line.length() == 64 && 
-            line.find_first_not_of("0123456789abcdef") == std::string::npos) {
-            hash_set.insert(line);
-        } else {
-            msg = "Invalid hash found: " + line;
+// Walks `target` if the head its scan read says it is an archive. Nothing
+// is read of a file unchanged since it was last seen, so nor is it walked.
+static void walk_if_archive(const HashStore& hash_store, const ScanTarget& target, const FileHead& head,
+                            unsigned algos, ScanMode mode, std::vector<MemberMatch>& matches) {
+    if (!scan_archives || head.len == 0) return;
+    if (sniff_archive(head.bytes, head.len, target.size) == ArchiveKind::None) return;
+    scan_archive_members(hash_store, target, algos, mode, matches);
+}
+
+// The head of a file the size prefilter leaves unhashed, read once per
+// change of it for the archive sniff
+static void read_unhashed_head(const ScanTarget& target, FileHead& head) {
+    int fd = open_for_scan(target.path.string());
+    if (fd < 0) return;
+    FileIdentity id;
+    if (FileIdentity::from_fd(fd, id) && !verdict_cache.unchanged(id) && read_head(fd, id.size, head))
+        verdict_cache.store(id, 0, FileDigests());
+    close(fd);
+}
+
+// Full scans: the digests of `target`, from the verdict cache if it hasn't
+// changed. Otherwise its head is read first, as the start of the hash, so
+// a stream archive is walked and hashed in one read; `head` keeps it for
+// the other kinds of archive.
+static bool digest_full(const HashStore& hash_store, const ScanTarget& target, unsigned algos,
+                        unsigned file_algos, FileDigests& digests, FileHead& head,
+                        std::vector<MemberMatch>& matches, bool& walked) {
+    int fd = open_for_scan(target.path.string());
+    if (fd < 0) {
+        msg = "Error opening file: " + target.path.string();
+        return false;
+    }
+    FileIdentity id;
+    bool hashed = false;
+    if (!FileIdentity::from_fd(fd, id)) {
+        msg = "Error reading file";
+    } else if (verdict_cache.lookup(id, file_algos, digests)) {
+        hashed = true;
+    } else if (!read_head(fd, id.size, head)) {
+        msg = "Error reading file";
+    } else {
+        if (scan_archives && sniff_archive(head.bytes, head.len, id.size) == ArchiveKind::Stream) {
+            walked = scan_archive_members(hash_store, target, algos, ScanMode::Full, matches, &digests, &hashed);
+            if (hashed) verdict_cache.store(id, algos, digests);
+        }
+        if (!hashed) hashed = digest_cached(fd, file_algos, digests, &head);
+    }
+    close(fd);
+    return hashed;
+}
+
+// Names every container whose layers hold a path of `target`
+static void log_containers(const ScanTarget& target, std::ofstream& log_file) {
+    if (!scan_containers) return;
+    std::vector<std::string> ids = container_index.owners(target.path);
+    for (const auto& alias : target.aliases) {
+        for (auto& id : container_index.owners(alias))
+            if (std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(std::move(id));
+    }
+    for (const auto& id : ids) log_file << "Container: " << id << "\n";
+}
+
+// Reports each match as "archive.zip!inner/path"
+static void report_member_matches(const ScanTarget& target, const std::vector<MemberMatch>& matches,
+                                  std::ofstream* log_file) {
+    if (matches.empty()) return;
+    const int path_count = 1 + static_cast<int>(target.aliases.size());
+    invalidate_summaries(target);
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::lock_guard<std::mutex> threat_lock(queue_mutex);
+    for (const auto& match : matches) {
+        threat += path_count;
+        filePath = match.path;
+        hashString = match.hash;
+        status = "malware";
+        numofthreat = std::to_string(threat.load());
+
+        if (log_file && log_file->is_open()) {
+            *log_file << "MALWARE DETECTED: " << match.path << "\n";
+            *log_file << "Hash: " << match.hash << "\n";
+            *log_file << "Matched: " << match.matched << "\n";
+            for (const auto& alias : target.aliases)
+                *log_file << "Same content: " << alias.string() << "\n";
+            log_containers(target, *log_file);
+            *log_file << "Total threats found: " << threat.load() << "\n\n";
+            log_file->flush();
         }
     }
+}
 
-    return hash_set;
+// Logs a clean executable that looks packed, for a closer look with
+// other tools. Called with output_mutex held.
+static void log_high_entropy(const ScanTarget& target, const EntropyStats& entropy, std::ofstream* log_file) {
+    high_entropy_files++;
+    if (!log_file || !log_file->is_open()) return;
+    *log_file << "HIGH ENTROPY: " << target.path.string() << "\n";
+    *log_file << std::fixed << std::setprecision(2) << "Entropy: " << entropy.file << " bits/byte, max window "
+              << entropy.max_window << ", " << entropy.high_windows << " of " << entropy.windows
+              << " windows above " << HIGH_WINDOW_ENTROPY << "\n" << std::defaultfloat;
+    for (const auto& alias : target.aliases)
+        *log_file << "Same content: " << alias.string() << "\n";
+    *log_file << "\n";
+    log_file->flush();
 }
 
-void process_files(const std::unordered_set<std::string>& hash_set,
-                  const std::vector<std::filesystem::path>& file_batch) {
-    auto log_file = std::make_shared<std::ofstream>("log.txt", std::ios::app);
+void process_files(const HashStore& hash_store,
+                  const std::vector<ScanTarget>& file_batch, std::ofstream* log_file, ScanMode mode) {
+    const unsigned algos = scan_algorithms(hash_store);
     
-    for (const auto& file_path : file_batch) {
+    for (const auto& target : file_batch) {
+        const auto& file_path = target.path;
+        // Every alias shares this content, so one verdict covers all of them
+        const int path_count = 1 + static_cast<int>(target.aliases.size());
         try {           
-            std::string hash = sha256_file(file_path.string());
-            if (!hash.empty()) {
+            // A file whose size no sized sample has can only match digests
+            // that came without one, so only those are computed; with none
+            // it isn't read at all, unless content signatures need a look
+            unsigned file_algos = algos;
+            if (!(algos & DIGEST_CONTENT)) file_algos = hash_store.algorithms_for_size(target.size);
+            if (!file_algos) {
+                FileHead head;
+                std::vector<MemberMatch> member_matches;
+                if (scan_archives) read_unhashed_head(target, head);
+                walk_if_archive(hash_store, target, head, algos, mode, member_matches);
+                report_member_matches(target, member_matches, log_file);
+                files_skipped += path_count;
+                files_processed += path_count;
+                continue;
+            }
+
+            // Opt-in: files still as the package manager installed them. Not
+            // read, so their directories can't be vouched for either. Owned
+            // files the metadata can't vouch for are scanned like any other,
+            // their package's digest taken in the same pass.
+            if (trust_packages && package_index.unchanged(target)) {
+                invalidate_summaries(target);
+                trusted_files += path_count;
+                trusted_bytes += target.size;
+                files_processed += path_count;
+                continue;
+            }
+            if (trust_packages) file_algos |= package_index.digest_algo(target);
+
+            file_algos |= algos & (DIGEST_SHA256 | DIGEST_ENTROPY);
+            // Archives are told from the head the hash pass reads, or the
+            // bundle's fingerprint; a file whose digests come from a cache
+            // is unchanged and not walked
+            FileDigests digests;
+            FileHead head;
+            // Files as on the golden image take their digests from its bundle
+            bool hashed = imported_bundle.lookup(target, file_algos, digests, &head);
+            std::vector<MemberMatch> member_matches;
+            bool walked = false;
+            if (!hashed && mode == ScanMode::Quick) {
+                bool not_executable = false;
+                hashed = digest_executable_file(file_path.string(), file_algos, digests, not_executable, &head);
+                if (not_executable) {
+                    walk_if_archive(hash_store, target, head, algos, mode, member_matches);
+                    report_member_matches(target, member_matches, log_file);
+                    files_not_executable += path_count;
+                    files_processed += path_count;
+                    continue;
+                }
+            } else if (!hashed) {
+                hashed = digest_full(hash_store, target, algos, file_algos, digests, head, member_matches, walked);
+            }
+
+            bool clean = false;
+            if (hashed) {
+                const std::string& hash = digests.sha256;
+                std::string matched = hash_store.match(digests);
                 std::lock_guard<std::mutex> lock(output_mutex);
                 
                 filePath = file_path.string();
                 hashString = hash;
                 
-                if (is_hash_in_set(hash_set, hash)) {
+                if (!matched.empty()) {
+                    invalidate_summaries(target);
                     std::lock_guard<std::mutex> threat_lock(queue_mutex);
-                    threat++;
+                    threat += path_count;
                     status = "malware";
                     numofthreat = std::to_string(threat.load());
                     msg = "File is clean (hash not found in database).";
@@ -128,18 +604,30 @@ void process_files(const std::unordered_set<std::string>& hash_set,
                     if (log_file && log_file->is_open()) {
                         *log_file << "MALWARE DETECTED: " << filePath << "\n";
                         *log_file << "Hash: " << hash << "\n";
+                        *log_file << "Matched: " << matched << "\n";
+                        for (const auto& alias : target.aliases)
+                            *log_file << "Same content: " << alias.string() << "\n";
+                        log_containers(target, *log_file);
                         *log_file << "Total threats found: " << threat.load() << "\n\n";
                         log_file->flush();
                     }
                 } else {
                     status = "clean";
                     msg = "File is clean (hash not found in database).";
+                    clean = true;
+                    if (trust_packages && package_index.matches_digest(target, digests)) package_verified += path_count;
+                    if (digests.entropy.suspicious()) log_high_entropy(target, digests.entropy, log_file);
                 }
+            } else {
+                invalidate_summaries(target);
             }
+            if (clean && !walked) walk_if_archive(hash_store, target, head, algos, mode, member_matches);
+            if (clean) report_member_matches(target, member_matches, log_file);
             
-            files_processed++;
+            files_processed += path_count;
         }
         catch (const std::exception& e) {
+            invalidate_summaries(target);
             std::lock_guard<std::mutex> lock(output_mutex);
             msg = "Error processing file " + file_path.string() + ": " + e.what();
             
@@ -151,35 +639,8 @@ void process_files(const std::unordered_set<std::string>& hash_set,
     }
 }
 
-void scan_directory(const std::string& path, 
-                   const std::unordered_set<std::string>& hash_set) {
-    if (scanning.exchange(true)) return;
-    
-    // Reset all status variables at start
-    files_processed = 0;
-    total_files = 0;
-    threat = 0;
-    msg.clear();
-    status = "scanning...";
-    hashString.clear();
-    filePath.clear();
-    numofthreat = "0";
-    
-    if (!std::filesystem::exists(path)) {
-        msg = "Error: Directory does not exist: " + path;
-        scanning = false;
-        return;
-    }
-
-    if (!std::filesystem::is_directory(path)) {
-        msg = "Error: Path is not a directory: " + path;
-        scanning = false;
-        return;
-    }
-
-    std::vector<std::filesystem::path> files;
-    auto log_file = std::make_shared<std::ofstream>("log.txt", std::ios::app);
-    
+bool walk_directory(const std::string& path, ContentDeduper& deduper, std::ofstream* log_file,
+                    DirWalk* dir_walk) {
     try {
         std::error_code ec;
         const int MAX_DEPTH = 16;
@@ -214,8 +675,16 @@ void scan_directory(const std::string& path,
                     continue;
                 }
 
-                // Handle symbolic links
+                // Container roots seen through overlay or /proc are walked
+                // layer by layer instead
                 const auto& entry = *iter;
+                if (scan_containers && container_index.pruned(entry.path().string())) {
+                    iter.disable_recursion_pending();
+                    iter.increment(ec);
+                    continue;
+                }
+
+                // Handle symbolic links
                 if (std::filesystem::is_symlink(entry, ec)) {
                     if (log_file && log_file->is_open()) {
                         *log_file << "Info: Skipping symlink " << entry.path().string() << '\n';
@@ -227,8 +696,14 @@ void scan_directory(const std::string& path,
 
                 // Only process regular files
                 if (std::filesystem::is_regular_file(entry, ec)) {
-                    files.push_back(entry.path());
-                    total_files++;
+                    struct stat st;
+                    if (lstat(entry.path().c_str(), &st) != 0) {
+                        // vanished since the directory was read
+                    } else if (dir_walk) {
+                        dir_walk->add_file(entry.path().string(), st);
+                    } else if (deduper.add(entry.path(), st)) {
+                        total_files++;
+                    }
                 }
 
                 iter.increment(ec);
@@ -251,64 +726,292 @@ void scan_directory(const std::string& path,
     }
     catch (const std::exception& e) {
         msg = "Error during directory scan: " + std::string(e.what());
+        return false;
+    }
+    return true;
+
+}
+
+// Queues one path reported by the change tracker: a file directly, a new
+// or moved-in directory with everything below it
+static void add_changed_path(const std::string& path, ContentDeduper& deduper, std::ofstream* log_file) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) return;  // deleted since
+
+    if (S_ISREG(st.st_mode)) {
+        if (deduper.add(path, st)) total_files++;
+    } else if (S_ISDIR(st.st_mode)) {
+        walk_directory(path, deduper, log_file);
+    }
+}
+
+void scan_directory(const std::string& path, 
+                   const HashStore& hash_store, ScanMode mode) {
+    if (scanning.exchange(true)) return;
+    
+    // Reset all status variables at start
+    files_processed = 0;
+    files_skipped = 0;
+    files_not_executable = 0;
+    archive_members = 0;
+    archive_limited = 0;
+    high_entropy_files = 0;
+    trusted_files = 0;
+    trusted_bytes = 0;
+    package_verified = 0;
+    total_files = 0;
+    threat = 0;
+    msg.clear();
+    status = "scanning...";
+    hashString.clear();
+    filePath.clear();
+    numofthreat = "0";
+    
+    if (!std::filesystem::exists(path)) {
+        msg = "Error: Directory does not exist: " + path;
         scanning = false;
         return;
     }
 
+    if (!std::filesystem::is_directory(path)) {
+        msg = "Error: Path is not a directory: " + path;
+        scanning = false;
+        return;
+    }
+
+    ContentDeduper deduper;
+    auto log_file = std::make_shared<std::ofstream>("log.txt", std::ios::app);
+    
+    // Containers on this host, so their layers can be walked once each and
+    // what they hold attributed to them
+    if (scan_containers && !container_index.discover()) {
+        if (log_file && log_file->is_open()) {
+            *log_file << "Warning: " << msg << "\n";
+            log_file->flush();
+        }
+        msg.clear();
+    }
+
+    // With a change tracker running only what changed since the last full
+    // walk needs a look; anything else falls back to walking the whole tree.
+    // The tracker only forgets what this scan looked at once it has finished,
+    // and never after a quick scan: it leaves most changed files unhashed.
+    TrackedChanges changed;
+    size_t unchanged_files = 0;
+    bool incremental = tracked_changes(path, TRACKER_STATE_FILE, changed);
+    auto finish_tracking = [&]() {
+        if (mode != ScanMode::Full) return;
+        if (incremental) consume_tracked_changes(changed);
+        else change_tracker.end_full_walk(path);
+    };
+    if (incremental) {
+        for (const auto& changed_path : changed.paths)
+            add_changed_path(changed_path, deduper, log_file.get());
+        if (log_file && log_file->is_open()) {
+            *log_file << "Info: Incremental scan of " << changed.paths.size() << " changed paths\n";
+            log_file->flush();
+        }
+    } else {
+        if (mode == ScanMode::Full) change_tracker.begin_full_walk(path);
+        // Directories whose files all look as the last clean walk left
+        // them have nothing new to hash under the same database and signatures
+        dir_summaries.load(DIR_SUMMARY_FILE, hash_store.generation ^ content_signatures.generation() ^
+                                             yara_rules.generation());
+        DirWalk dir_walk;
+        LocateListing listing;
+        if (use_locate_db && locate_listing(path, listing)) {
+            // updatedb already walked the tree; only what changed since needs a walk
+            for (const auto& file : listing.files) {
+                struct stat st;
+                if (lstat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) dir_walk.add_file(file, st);
+            }
+            for (const auto& dir : listing.walk_dirs)
+                walk_directory(dir, deduper, log_file.get(), &dir_walk);
+            if (log_file && log_file->is_open()) {
+                *log_file << "Info: " << listing.files.size() << " entries from " << listing.database
+                          << ", " << listing.walk_dirs.size() << " changed or pruned directories walked\n";
+                log_file->flush();
+            }
+        } else {
+            if (use_locate_db && log_file && log_file->is_open()) {
+                *log_file << "Info: " << msg << ", walking the tree\n";
+                log_file->flush();
+                msg.clear();
+            }
+            if (!walk_directory(path, deduper, log_file.get(), &dir_walk)) {
+                scanning = false;
+                return;
+            }
+        }
+        if (scan_containers && !container_index.containers().empty()) {
+            // Layers outside the scanned tree are walked on their own; each
+            // shared image layer once, however many containers stack it
+            std::error_code ec;
+            std::string root = std::filesystem::weakly_canonical(path, ec).string();
+            if (root.empty() || root.back() != '/') root += '/';
+            size_t walked_layers = 0;
+            for (const auto& dir : container_index.layer_dirs()) {
+                if (dir.compare(0, root.size(), root) == 0 && !container_index.pruned(dir)) continue;
+                walk_directory(dir, deduper, log_file.get(), &dir_walk);
+                walked_layers++;
+            }
+            if (log_file && log_file->is_open()) {
+                *log_file << "Info: " << container_index.containers().size() << " containers, "
+                          << walked_layers << " layer directories walked outside " << path << "\n";
+                log_file->flush();
+            }
+        }
+        unchanged_files = dir_walk.resolve(dir_summaries,
+            [&](const std::string& file, const struct stat& st) {
+                if (deduper.add(file, st)) total_files++;
+            });
+        if (log_file && log_file->is_open()) {
+            *log_file << "Info: " << unchanged_files << " files in " << dir_walk.unchanged_directories()
+                      << " of " << dir_walk.directories() << " directories unchanged since the last clean scan\n";
+            log_file->flush();
+        }
+    }
+
+    if (deduper.folded() > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: " << deduper.folded() << " paths share content with another path and are hashed once\n";
+        log_file->flush();
+    }
+    std::vector<ScanTarget> files = deduper.take();
+
+    // Opt-in: the workers check files against what the package manager recorded
+    if (trust_packages) package_index.refresh();
+
+    // A quick scan didn't look at everything, nor did one that left archives
+    // unopened, so neither can vouch for a directory
+    const bool vouch_for_dirs = !incremental && mode == ScanMode::Full && scan_archives;
+
     if (files.empty()) {
-        msg = "No files found in directory: " + path;
+        finish_tracking();
+        if (vouch_for_dirs) {
+            dir_summaries.commit(path);
+            dir_summaries.save(DIR_SUMMARY_FILE);
+        }
+        msg = incremental || unchanged_files > 0 ? "No files changed since the last scan"
+                                                 : "No files found in directory: " + path;
         scanning = false;
         return;
     }
 
-    // Process files in batches
-    const size_t BATCH_SIZE = 100;
-    const unsigned int num_threads = std::thread::hardware_concurrency();
-    std::vector<std::future<void>> futures;
+    // Likeliest places first: batches go to the workers in this order
+    std::vector<size_t> class_counts;
+    order_by_priority(files, &class_counts);
+    if (log_file && log_file->is_open()) {
+        *log_file << "Info: Scan order:";
+        for (size_t c = 0; c < class_counts.size(); ++c)
+            *log_file << " " << class_counts[c] << " " << priority_name(static_cast<ScanPriority>(c));
+        *log_file << "\n";
+        log_file->flush();
+    }
 
-    for (size_t i = 0; i < files.size(); i += BATCH_SIZE) {
-        size_t batch_end = std::min(i + BATCH_SIZE, files.size());
-        std::vector<std::filesystem::path> batch(
-            files.begin() + i, files.begin() + batch_end);
+    // Workers pull small chunks in order, so each priority class is spread
+    // over every worker and drained before the next one starts
+    const size_t CHUNK_SIZE = 8;
+    const unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> next_file(0);
+    std::vector<std::future<void>> futures;
 
+    for (unsigned int t = 0; t < num_threads; ++t) {
         futures.push_back(
-            std::async(std::launch::async,
-                      [&hash_set, batch = std::move(batch)]() {
-                          process_files(hash_set, batch);
-                      }));
-
-        if (futures.size() >= num_threads) {
-            for (auto& future : futures) {
-                future.wait();
-            }
-            futures.clear();
-        }
+            std::async(std::launch::async, [&hash_store, &files, &next_file, &log_file, mode]() {
+                for (;;) {
+                    size_t begin = next_file.fetch_add(CHUNK_SIZE);
+                    if (begin >= files.size()) return;
+                    size_t end = std::min(begin + CHUNK_SIZE, files.size());
+                    std::vector<ScanTarget> batch(files.begin() + begin, files.begin() + end);
+                    process_files(hash_store, batch, log_file.get(), mode);
+                }
+            }));
     }
 
     // Wait for remaining tasks
     for (auto& future : futures) {
         future.wait();
     }
+    finish_tracking();
+
+    if (vouch_for_dirs) {
+        dir_summaries.commit(path);
+        dir_summaries.save(DIR_SUMMARY_FILE);
+    }
+
+    if (files_not_executable > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: Quick scan left " << files_not_executable.load()
+                  << " files that aren't executable content unhashed\n";
+        log_file->flush();
+    }
+
+    if (archive_members > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: Hashed " << archive_members.load() << " archive members";
+        if (archive_limited > 0)
+            *log_file << ", " << archive_limited.load() << " cut short by archive limits";
+        *log_file << "\n";
+        log_file->flush();
+    }
+
+    if (trusted_files > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: " << trusted_files.load() << " package files (" << (trusted_bytes.load() >> 20)
+                  << " MiB) untouched since install by their metadata, not read\n";
+        log_file->flush();
+    }
+    if (package_verified > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: " << package_verified.load()
+                  << " package files scanned and matching the digest their package recorded\n";
+        log_file->flush();
+    }
+
+    if (high_entropy_files > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: " << high_entropy_files.load()
+                  << " executables look packed or encrypted; see HIGH ENTROPY entries\n";
+        log_file->flush();
+    }
+
+    if (files_skipped > 0 && log_file && log_file->is_open()) {
+        *log_file << "Info: Size prefilter skipped " << files_skipped.load() << " of "
+                  << total_files.load() << " files\n";
+        log_file->flush();
+    }
 
     scanning = false;
 }
 
 void scan_file(const std::string& filePath, 
-               const std::unordered_set<std::string>& hash_set) {
+               const HashStore& hash_store) {
     std::cout << "Scanning file: " << filePath << std::endl;
 
     try {
-        std::string fileHash = sha256_file(filePath);
-        hashString = fileHash;
+        FileDigests digests;
+        const unsigned algos = scan_algorithms(hash_store);
+        bool hashed = digest_file(filePath, algos, digests);
+        hashString = digests.sha256;
 
-        if (fileHash.empty()) {
+        if (!hashed) {
             msg = "Error: Unable to calculate hash for file.";
             return;
         }
 
-        if (is_hash_in_set(hash_set, fileHash)) {
+        if (!hash_store.match(digests).empty()) {
             msg = "File is potentially harmful (hash found in database).";
             status = "malware";
+            return;
+        }
+
+        // A clean archive can still carry something inside
+        std::string member_match;
+        ArchiveStats stats;
+        if (scan_archives) {
+            scan_archive(filePath, algos, false, [&](const ArchiveMember& member) {
+                if (member_match.empty() && !hash_store.match(member.digests).empty())
+                    member_match = member.path;
+            }, stats);
+        }
+        if (!member_match.empty()) {
+            msg = "Archive member is potentially harmful (hash found in database): " + member_match;
+            status = "malware";
         } else {
             msg = "File is clean (hash not found in database).";
             status = "clean";
@@ -318,3 +1021,160 @@ void scan_file(const std::string& filePath,
         msg = "Filesystem error: " + std::string(e.what());
     }
 }
+
+void scan_processes(const HashStore& hash_store) {
+    if (scanning.exchange(true)) return;
+
+    files_processed = 0;
+    files_skipped = 0;
+    total_files = 0;
+    threat = 0;
+    msg.clear();
+    status = "scanning processes...";
+    hashString.clear();
+    filePath.clear();
+    numofthreat = "0";
+
+    std::vector<ProcessImage> images;
+    size_t process_count = 0;
+    if (!list_process_images(images, &process_count)) {
+        scanning = false;
+        return;
+    }
+    total_files = static_cast<int>(images.size());
+
+    auto log_file = std::make_shared<std::ofstream>("log.txt", std::ios::app);
+    if (log_file && log_file->is_open()) {
+        *log_file << "Info: " << process_count << " processes map " << images.size()
+                  << " distinct executables and libraries\n";
+        log_file->flush();
+    }
+
+    // Same workers and verdict cache as a directory scan: a binary that
+    // hasn't changed since it was last hashed, here or by a Fullscan, isn't read
+    const unsigned algos = scan_algorithms(hash_store);
+    const size_t CHUNK_SIZE = 8;
+    const unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> next_image(0);
+    std::vector<std::future<void>> futures;
+
+    for (unsigned int t = 0; t < num_threads; ++t) {
+        futures.push_back(std::async(std::launch::async, [&]() {
+            for (;;) {
+                size_t begin = next_image.fetch_add(CHUNK_SIZE);
+                if (begin >= images.size()) return;
+                size_t end = std::min(begin + CHUNK_SIZE, images.size());
+                for (size_t i = begin; i < end; ++i) {
+                    const ProcessImage& image = images[i];
+                    files_processed++;
+                    unsigned image_algos = algos;
+                    if (!(algos & DIGEST_CONTENT)) image_algos = hash_store.algorithms_for_size(image.size);
+                    if (!image_algos) {
+                        files_skipped++;
+                        continue;
+                    }
+                    FileDigests digests;
+                    int fd = open_for_scan(image.read_path);
+                    if (fd < 0) continue;   // the process exited
+                    bool hashed = digest_cached(fd, image_algos | (algos & (DIGEST_SHA256 | DIGEST_ENTROPY)), digests);
+                    close(fd);
+                    if (!hashed) continue;
+
+                    std::string matched = hash_store.match(digests);
+                    if (matched.empty()) continue;
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    std::lock_guard<std::mutex> threat_lock(queue_mutex);
+                    threat++;
+                    filePath = image.path;
+                    hashString = digests.sha256;
+                    status = "malware";
+                    numofthreat = std::to_string(threat.load());
+                    if (log_file && log_file->is_open()) {
+                        *log_file << "MALWARE DETECTED: " << image.path << "\n";
+                        *log_file << "Hash: " << digests.sha256 << "\n";
+                        *log_file << "Matched: " << matched << "\n";
+                        // A shared library can be in every process; name the first few
+                        const size_t MAX_LOGGED_PIDS = 16;
+                        for (size_t p = 0; p < image.pids.size() && p < MAX_LOGGED_PIDS; ++p)
+                            *log_file << "Process: " << image.pids[p] << " (" << process_name(image.pids[p]) << ")\n";
+                        if (image.pids.size() > MAX_LOGGED_PIDS)
+                            *log_file << "Processes: " << image.pids.size() - MAX_LOGGED_PIDS << " more\n";
+                        *log_file << "Total threats found: " << threat.load() << "\n\n";
+                        log_file->flush();
+                    }
+                }
+            }
+        }));
+    }
+    for (auto& future : futures) future.wait();
+
+    if (threat > 0) {
+        msg = "Running processes map files found in the database, see the log.";
+    } else {
+        status = "clean";
+        msg = "No running process maps a file found in the database.";
+    }
+    scanning = false;
+}
+
+void scan_memory() {
+    if (scanning.exchange(true)) return;
+
+    files_processed = 0;
+    files_skipped = 0;
+    total_files = 0;
+    threat = 0;
+    msg.clear();
+    status = "scanning memory...";
+    hashString.clear();
+    filePath.clear();
+    numofthreat = "0";
+
+    if (content_signatures.empty()) {
+        msg = "No byte signatures loaded, nothing to match memory against";
+        scanning = false;
+        return;
+    }
+    std::vector<MemoryRegion> regions;
+    if (!memory_scanner.plan(regions)) {
+        scanning = false;
+        return;
+    }
+    total_files = static_cast<int>(regions.size());
+
+    auto log_file = std::make_shared<std::ofstream>("log.txt", std::ios::app);
+    MemoryScanStats stats;
+    memory_scanner.scan(regions, [&](const MemoryHit& hit) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::lock_guard<std::mutex> threat_lock(queue_mutex);
+        threat++;
+        std::ostringstream where;
+        where << "/proc/" << hit.pid << "/mem@0x" << std::hex << hit.address;
+        filePath = where.str();
+        status = "malware";
+        numofthreat = std::to_string(threat.load());
+        if (log_file && log_file->is_open()) {
+            *log_file << "MALWARE DETECTED: " << filePath << "\n";
+            *log_file << "Matched: " << hit.signature << "\n";
+            *log_file << "Region: " << hit.region << "\n";
+            *log_file << "Process: " << hit.pid << " (" << process_name(hit.pid) << ")\n";
+            *log_file << "Total threats found: " << threat.load() << "\n\n";
+            log_file->flush();
+        }
+    }, stats, [] { files_processed++; });
+
+    if (log_file && log_file->is_open()) {
+        *log_file << "Info: Read " << (stats.bytes >> 20) << " MiB from " << stats.regions << " memory regions";
+        if (stats.denied > 0) *log_file << ", " << stats.denied << " processes not readable";
+        if (stats.failed > 0) *log_file << ", " << stats.failed << " regions unmapped while read";
+        *log_file << "\n";
+        log_file->flush();
+    }
+    if (threat > 0) {
+        msg = "Known byte signatures found in process memory, see the log.";
+    } else {
+        status = "clean";
+        msg = "No byte signature matched in process memory.";
+    }
+    scanning = false;
+}
@@ -0,0 +1,625 @@
+#include "sigengine.h"
+#include "scan.h"
+#include "filereader.h"
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <chrono>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAVE_TEDDY 1
+#endif
+
+ContentSignatures content_signatures;
+
+// Anchors shorter than this hit too often to be worth verifying, and Teddy
+// looks at the first three bytes. Longer literal runs are cut to the maximum
+// to keep the automaton small.
+static const size_t MIN_ANCHOR_LENGTH = 3;
+static const size_t MAX_ANCHOR_LENGTH = 16;
+
+// Teddy's eight buckets stop filtering well beyond this many anchors
+static const size_t TEDDY_MAX_SIGNATURES = 64;
+
+// Upper bound on the DFA table (states * classes); 512 MiB of entries
+static const uint64_t MAX_DFA_CELLS = 1ull << 27;
+
+static const char CACHE_MAGIC[8] = {'S', 'I', 'G', 'D', 'F', 'A', '0', '1'};
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Hex bytes, "??" for any byte and "{n}" for n of them. Alternatives,
+// nibble wildcards and variable gaps are rejected.
+static bool parse_hex_pattern(const std::string& hex, ContentSignature& sig) {
+    size_t i = 0;
+    while (i < hex.size()) {
+        if (hex[i] == '?') {
+            if (i + 1 >= hex.size() || hex[i + 1] != '?') return false;
+            sig.bytes.push_back(0);
+            sig.mask.push_back(0);
+            i += 2;
+        } else if (hex[i] == '{') {
+            size_t close = hex.find('}', i);
+            if (close == std::string::npos) return false;
+            std::string range = hex.substr(i + 1, close - i - 1);
+            size_t dash = range.find('-');
+            std::string low = range.substr(0, dash);
+            std::string high = dash == std::string::npos ? low : range.substr(dash + 1);
+            if (low.empty() || low.size() > 3 || low != high ||
+                low.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+            sig.bytes.resize(sig.bytes.size() + std::stoul(low), 0);
+            sig.mask.resize(sig.bytes.size(), 0);
+            i = close + 1;
+        } else {
+            int high = hex_value(hex[i]);
+            int low = i + 1 < hex.size() ? hex_value(hex[i + 1]) : -1;
+            if (high < 0 || low < 0) return false;
+            sig.bytes.push_back(static_cast<uint8_t>(high << 4 | low));
+            sig.mask.push_back(0xff);
+            i += 2;
+        }
+        if (sig.bytes.size() > MAX_PATTERN_LENGTH) return false;
+    }
+    return !sig.bytes.empty();
+}
+
+// The longest run of literal bytes is the rarest thing to search for
+static bool choose_anchor(ContentSignature& sig, size_t min_len) {
+    size_t best = 0, best_len = 0;
+    for (size_t i = 0; i < sig.mask.size();) {
+        if (!sig.mask[i]) {
+            ++i;
+            continue;
+        }
+        size_t j = i;
+        while (j < sig.mask.size() && sig.mask[j]) ++j;
+        if (j - i > best_len) {
+            best = i;
+            best_len = j - i;
+        }
+        i = j;
+    }
+    if (best_len < min_len) return false;
+    sig.anchor_offset = static_cast<uint32_t>(best);
+    sig.anchor_len = static_cast<uint32_t>(std::min(best_len, MAX_ANCHOR_LENGTH));
+    return true;
+}
+
+// ClamAV target types we can tell apart; anything else applies to every file
+static FileType target_type(const std::string& field) {
+    if (field == "1") return FileType::Pe;
+    if (field == "2") return FileType::OfficeOle;
+    if (field == "6") return FileType::Elf;
+    if (field == "9") return FileType::MachO;
+    if (field == "10") return FileType::Pdf;
+    if (field == "12") return FileType::JavaClass;
+    return FileType::Unknown;
+}
+
+bool ContentSignatures::load_ndb(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        msg = "Error opening file: " + filename;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for (size_t colon; (colon = line.find(':', start)) != std::string::npos; start = colon + 1)
+            fields.push_back(line.substr(start, colon - start));
+        fields.push_back(line.substr(start));
+        if (fields.size() < 4) {
+            unsupported++;
+            continue;
+        }
+
+        ContentSignature sig;
+        sig.name = fields[0];
+        sig.target = target_type(fields[1]);
+        // Only "anywhere" and absolute offsets; EP/section/EOF relative ones need a parser
+        if (fields[2] == "*") {
+            sig.offset = -1;
+        } else if (!fields[2].empty() && fields[2].size() < 12 &&
+                   fields[2].find_first_not_of("0123456789") == std::string::npos) {
+            sig.offset = std::stoll(fields[2]);
+        } else {
+            unsupported++;
+            continue;
+        }
+        if (!parse_hex_pattern(fields[3], sig) || !choose_anchor(sig, MIN_ANCHOR_LENGTH)) {
+            unsupported++;
+            continue;
+        }
+        signatures.push_back(std::move(sig));
+    }
+    return true;
+}
+
+bool ContentSignatures::add(ContentSignature sig) {
+    if (sig.bytes.empty() || sig.bytes.size() > MAX_PATTERN_LENGTH || sig.mask.size() != sig.bytes.size() ||
+        !choose_anchor(sig, 1))
+        return false;
+    signatures.push_back(std::move(sig));
+    return true;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool cpu_has_ssse3() {
+#ifdef HAVE_TEDDY
+    return __builtin_cpu_supports("ssse3");
+#else
+    return false;
+#endif
+}
+
+void ContentSignatures::compile(const std::string& cache_file) {
+    // A fixed order makes signature indexes, and so the cache, reproducible
+    std::sort(signatures.begin(), signatures.end(), [](const ContentSignature& a, const ContentSignature& b) {
+        return std::tie(a.name, a.bytes, a.mask, a.offset, a.target, a.tag) <
+               std::tie(b.name, b.bytes, b.mask, b.offset, b.target, b.tag);
+    });
+    key = 14695981039346656037ull;
+    max_length = 0;
+    for (const auto& sig : signatures) {
+        key = fnv1a(key, sig.name.data(), sig.name.size() + 1);
+        key = fnv1a(key, sig.bytes.data(), sig.bytes.size());
+        key = fnv1a(key, sig.mask.data(), sig.mask.size());
+        key = fnv1a(key, &sig.offset, sizeof(sig.offset));
+        key = fnv1a(key, &sig.target, sizeof(sig.target));
+        key = fnv1a(key, &sig.tag, sizeof(sig.tag));
+        max_length = std::max(max_length, sig.bytes.size());
+    }
+
+    // Teddy needs three literal bytes to look at; shorter anchors go to the DFA
+    teddy = !signatures.empty() && signatures.size() <= TEDDY_MAX_SIGNATURES && cpu_has_ssse3() &&
+            std::all_of(signatures.begin(), signatures.end(),
+                        [](const ContentSignature& sig) { return sig.anchor_len >= MIN_ANCHOR_LENGTH; });
+    if (signatures.empty()) return;
+    if (teddy) {
+        // Building the masks takes microseconds; nothing worth caching
+        build_teddy();
+        return;
+    }
+    if (!load_cache(cache_file)) {
+        build_dfa();
+        save_cache(cache_file);
+    }
+    for (int b = 0; b < 256; ++b) root_stays[b] = table[byte_class[b]] == 0;
+}
+
+void ContentSignatures::build_teddy() {
+    // Neighbours in prefix order share a bucket, so a bucket's masks stay tight
+    std::vector<uint32_t> order(signatures.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const ContentSignature& x = signatures[a];
+        const ContentSignature& y = signatures[b];
+        return memcmp(&x.bytes[x.anchor_offset], &y.bytes[y.anchor_offset], MIN_ANCHOR_LENGTH) < 0;
+    });
+
+    for (auto& bucket : buckets) bucket.clear();
+    memset(teddy_lo, 0, sizeof(teddy_lo));
+    memset(teddy_hi, 0, sizeof(teddy_hi));
+    for (size_t i = 0; i < order.size(); ++i) {
+        size_t bucket = i * 8 / order.size();
+        const ContentSignature& sig = signatures[order[i]];
+        buckets[bucket].push_back(order[i]);
+        for (size_t k = 0; k < 3; ++k) {
+            uint8_t b = sig.bytes[sig.anchor_offset + k];
+            teddy_lo[k][b & 0x0f] |= static_cast<uint8_t>(1u << bucket);
+            teddy_hi[k][b >> 4] |= static_cast<uint8_t>(1u << bucket);
+        }
+    }
+}
+
+void ContentSignatures::build_dfa() {
+    // One class per byte value some anchor uses; every other byte is class 0
+    bool used[256] = {};
+    for (const auto& sig : signatures)
+        for (uint32_t k = 0; k < sig.anchor_len; ++k) used[sig.bytes[sig.anchor_offset + k]] = true;
+    classes = 1;
+    for (int b = 0; b < 256; ++b) byte_class[b] = used[b] ? static_cast<uint8_t>(classes++) : 0;
+
+    // Drop signatures that would push the table past its limit
+    uint64_t states = 1;
+    size_t keep = 0;
+    while (keep < signatures.size() && (states + signatures[keep].anchor_len) * classes <= MAX_DFA_CELLS)
+        states += signatures[keep++].anchor_len;
+    unsupported += signatures.size() - keep;
+    signatures.resize(keep);
+
+    // Trie of the anchors
+    std::vector<int32_t> trie(classes, -1);
+    std::vector<std::vector<uint32_t>> matches(1);
+    for (uint32_t i = 0; i < signatures.size(); ++i) {
+        const ContentSignature& sig = signatures[i];
+        size_t node = 0;
+        for (uint32_t k = 0; k < sig.anchor_len; ++k) {
+            size_t cell = node * classes + byte_class[sig.bytes[sig.anchor_offset + k]];
+            if (trie[cell] < 0) {
+                trie[cell] = static_cast<int32_t>(matches.size());
+                matches.emplace_back();
+                trie.resize(trie.size() + classes, -1);
+            }
+            node = static_cast<size_t>(trie[cell]);
+        }
+        matches[node].push_back(i);
+    }
+
+    // Failure links breadth first, filling in the missing transitions from
+    // the failure state's row, which is complete by then
+    const size_t count = matches.size();
+    std::vector<uint32_t> dfa(count * classes, 0);
+    std::vector<uint32_t> fail(count, 0);
+    std::queue<uint32_t> queue;
+    for (uint32_t c = 0; c < classes; ++c) {
+        if (trie[c] < 0) continue;
+        dfa[c] = static_cast<uint32_t>(trie[c]);
+        queue.push(dfa[c]);
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop();
+        for (uint32_t c = 0; c < classes; ++c) {
+            int32_t child = trie[state * classes + c];
+            if (child < 0) {
+                dfa[state * classes + c] = dfa[fail[state] * classes + c];
+                continue;
+            }
+            dfa[state * classes + c] = static_cast<uint32_t>(child);
+            fail[child] = dfa[fail[state] * classes + c];
+            const auto& inherited = matches[fail[child]];
+            matches[child].insert(matches[child].end(), inherited.begin(), inherited.end());
+            queue.push(static_cast<uint32_t>(child));
+        }
+    }
+
+    table.resize(dfa.size());
+    for (size_t i = 0; i < dfa.size(); ++i)
+        table[i] = (dfa[i] * classes) << 1 | (matches[dfa[i]].empty() ? 0u : 1u);
+    output_start.assign(1, 0);
+    outputs.clear();
+    for (const auto& list : matches) {
+        outputs.insert(outputs.end(), list.begin(), list.end());
+        output_start.push_back(static_cast<uint32_t>(outputs.size()));
+    }
+}
+
+template <typename T>
+static void write_vector(std::ofstream& out, const std::vector<T>& v) {
+    uint64_t n = v.size();
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    out.write(reinterpret_cast<const char*>(v.data()), static_cast<std::streamsize>(n * sizeof(T)));
+}
+
+template <typename T>
+static bool read_vector(std::ifstream& in, std::vector<T>& v) {
+    uint64_t n = 0;
+    if (!in.read(reinterpret_cast<char*>(&n), sizeof(n)) || n > MAX_DFA_CELLS) return false;
+    v.resize(n);
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(v.data()), static_cast<std::streamsize>(n * sizeof(T))));
+}
+
+void ContentSignatures::save_cache(const std::string& cache_file) const {
+    std::string tmp = cache_file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+        uint64_t count = signatures.size();
+        out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        out.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(&classes), sizeof(classes));
+        out.write(reinterpret_cast<const char*>(byte_class), sizeof(byte_class));
+        write_vector(out, table);
+        write_vector(out, output_start);
+        write_vector(out, outputs);
+        if (!out.flush()) return;
+    }
+    std::rename(tmp.c_str(), cache_file.c_str());
+}
+
+bool ContentSignatures::load_cache(const std::string& cache_file) {
+    std::ifstream in(cache_file, std::ios::binary);
+    if (!in) return false;
+
+    char magic[sizeof(CACHE_MAGIC)];
+    uint64_t cached_key = 0, count = 0;
+    uint32_t cached_classes = 0;
+    uint8_t cached_class[256];
+    std::vector<uint32_t> cached_table, cached_start, cached_outputs;
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !in.read(reinterpret_cast<char*>(&cached_key), sizeof(cached_key)) || cached_key != key ||
+        !in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > signatures.size() ||
+        !in.read(reinterpret_cast<char*>(&cached_classes), sizeof(cached_classes)) ||
+        !in.read(reinterpret_cast<char*>(cached_class), sizeof(cached_class)) ||
+        !read_vector(in, cached_table) || !read_vector(in, cached_start) || !read_vector(in, cached_outputs))
+        return false;
+
+    // A damaged file must not send the scanner outside its tables
+    if (cached_classes == 0 || cached_classes > 256 || cached_table.empty() ||
+        cached_table.size() % cached_classes != 0 ||
+        cached_start.size() != cached_table.size() / cached_classes + 1 ||
+        cached_start.front() != 0 || cached_start.back() != cached_outputs.size())
+        return false;
+    for (int b = 0; b < 256; ++b)
+        if (cached_class[b] >= cached_classes) return false;
+    for (size_t s = 1; s < cached_start.size(); ++s)
+        if (cached_start[s] < cached_start[s - 1]) return false;
+    for (uint32_t entry : cached_table) {
+        uint32_t row = entry >> 1;
+        if (row % cached_classes != 0 || row >= cached_table.size()) return false;
+        uint32_t state = row / cached_classes;
+        if ((entry & 1) != (cached_start[state + 1] != cached_start[state] ? 1u : 0u)) return false;
+    }
+    for (uint32_t sig : cached_outputs)
+        if (sig >= count) return false;
+
+    // The build dropped the same trailing signatures when the table was full
+    unsupported += signatures.size() - count;
+    signatures.resize(count);
+    classes = cached_classes;
+    memcpy(byte_class, cached_class, sizeof(byte_class));
+    table = std::move(cached_table);
+    output_start = std::move(cached_start);
+    outputs = std::move(cached_outputs);
+    return true;
+}
+
+SignatureScanner::SignatureScanner(const ContentSignatures& signatures) : sigs(signatures) {}
+
+int SignatureScanner::byte_at(uint64_t pos) const {
+    if (pos >= base) return pos - base < chunk_len ? chunk[pos - base] : -1;
+    if (base - pos > carry.size()) return -1;
+    return carry[carry.size() - (base - pos)];
+}
+
+void SignatureScanner::update(const unsigned char* data, size_t len) {
+    if (sigs.empty() || len == 0 || !matched.empty()) return;
+    if (base == 0) type = sniff_file_type(data, std::min(len, SNIFF_SIZE));
+    chunk = data;
+    chunk_len = len;
+
+    // Matches that ran past the end of the previous chunk
+    std::vector<std::pair<uint32_t, uint64_t>> waiting;
+    waiting.swap(pending);
+    for (const auto& p : waiting)
+        if (matched.empty()) verify(p.first, p.second);
+
+    if (matched.empty()) find_anchors(data, len);
+
+    // Every pattern still open starts within the last max_length - 1 bytes
+    const size_t keep = sigs.max_length - 1;
+    if (len >= keep) {
+        carry.assign(data + len - keep, data + len);
+    } else {
+        carry.insert(carry.end(), data, data + len);
+        if (carry.size() > keep) carry.erase(carry.begin(), carry.end() - keep);
+    }
+    base += len;
+    chunk = nullptr;
+    chunk_len = 0;
+}
+
+void SignatureScanner::verify(uint32_t index, uint64_t start) {
+    const ContentSignature& sig = sigs.signatures[index];
+    if (sig.offset >= 0 && start != static_cast<uint64_t>(sig.offset)) return;
+    if (sig.target != FileType::Unknown && sig.target != type) return;
+
+    const size_t len = sig.bytes.size();
+    if (start + len > base + chunk_len) {
+        pending.emplace_back(index, start);
+        return;
+    }
+    if (start >= base) {
+        const unsigned char* p = chunk + (start - base);
+        for (size_t i = 0; i < len; ++i)
+            if ((p[i] ^ sig.bytes[i]) & sig.mask[i]) return;
+    } else {
+        for (size_t i = 0; i < len; ++i) {
+            int b = byte_at(start + i);
+            if (b < 0 || ((b ^ sig.bytes[i]) & sig.mask[i])) return;
+        }
+    }
+    if (on_hit) on_hit(sig, start);
+    else matched = sig.name;
+}
+
+void SignatureScanner::check_anchor_start(uint32_t index, uint64_t anchor_pos) {
+    const ContentSignature& sig = sigs.signatures[index];
+    if (anchor_pos < sig.anchor_offset) return;
+    // The nibble masks only narrow it down; confirm the three bytes first
+    for (size_t k = 0; k < MIN_ANCHOR_LENGTH; ++k)
+        if (byte_at(anchor_pos + k) != sig.bytes[sig.anchor_offset + k]) return;
+    verify(index, anchor_pos - sig.anchor_offset);
+}
+
+void SignatureScanner::find_anchors(const unsigned char* data, size_t len) {
+    if (sigs.teddy) {
+        teddy_candidates(data, len);
+        return;
+    }
+
+    const uint32_t* table = sigs.table.data();
+    const uint8_t* byte_class = sigs.byte_class;
+    uint32_t s = state;
+    for (size_t i = 0; i < len; ++i) {
+        // Most input leaves the root where it is; finding the next byte
+        // that doesn't is a run of independent loads instead of a chain
+        if (s == 0) {
+            while (i < len && sigs.root_stays[data[i]]) ++i;
+            if (i == len) break;
+        }
+        s = table[(s >> 1) + byte_class[data[i]]];
+        if (!(s & 1)) continue;
+        uint32_t node = (s >> 1) / sigs.classes;
+        uint64_t end = base + i + 1;
+        for (uint32_t o = sigs.output_start[node]; o < sigs.output_start[node + 1]; ++o) {
+            const ContentSignature& sig = sigs.signatures[sigs.outputs[o]];
+            uint64_t before = sig.anchor_offset + sig.anchor_len;
+            if (end >= before) verify(sigs.outputs[o], end - before);
+        }
+        if (!matched.empty()) break;
+    }
+    state = s;
+}
+
+static inline uint8_t teddy_bits(const uint8_t lo[3][16], const uint8_t hi[3][16], int b0, int b1, int b2) {
+    return lo[0][b0 & 0x0f] & hi[0][b0 >> 4] & lo[1][b1 & 0x0f] & hi[1][b1 >> 4] &
+           lo[2][b2 & 0x0f] & hi[2][b2 >> 4];
+}
+
+#ifdef HAVE_TEDDY
+// Sixteen candidate positions per step: each of the three leading bytes is
+// split into nibbles, each nibble looks up its bucket mask with pshufb, and
+// a position survives if all six masks share a bucket. Calls `candidate`
+// with (position, buckets) and stops when it returns false. Returns the
+// first position not examined.
+template <typename F>
+__attribute__((target("ssse3")))
+static size_t teddy_ssse3(const uint8_t lo[3][16], const uint8_t hi[3][16],
+                          const unsigned char* data, size_t len, F&& candidate) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo_mask[3], hi_mask[3];
+    for (int k = 0; k < 3; ++k) {
+        lo_mask[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(lo[k]));
+        hi_mask[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(hi[k]));
+    }
+
+    size_t i = 0;
+    for (; i + 18 <= len; i += 16) {
+        __m128i result = _mm_set1_epi8(-1);
+        for (int k = 0; k < 3; ++k) {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k));
+            __m128i l = _mm_shuffle_epi8(lo_mask[k], _mm_and_si128(in, nibble));
+            __m128i h = _mm_shuffle_epi8(hi_mask[k], _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+            result = _mm_and_si128(result, _mm_and_si128(l, h));
+        }
+        unsigned hits = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(result, zero))) & 0xffff;
+        if (!hits) continue;
+
+        alignas(16) uint8_t bits[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(bits), result);
+        for (; hits; hits &= hits - 1) {
+            unsigned j = static_cast<unsigned>(__builtin_ctz(hits));
+            if (!candidate(i + j, bits[j])) return i + j + 1;
+        }
+    }
+    return i;
+}
+#endif
+
+void SignatureScanner::teddy_candidates(const unsigned char* data, size_t len) {
+    auto candidate = [&](uint64_t pos, uint8_t bits) {
+        for (unsigned b = 0; b < 8; ++b) {
+            if (!(bits & (1u << b))) continue;
+            for (uint32_t index : sigs.buckets[b]) check_anchor_start(index, pos);
+        }
+        return matched.empty();
+    };
+
+    // Starts just before this chunk whose three bytes reach into it
+    const uint64_t end = base + len;
+    uint64_t pos = next_start;
+    for (; pos < base && pos + 2 < end; ++pos) {
+        uint8_t bits = teddy_bits(sigs.teddy_lo, sigs.teddy_hi, byte_at(pos), byte_at(pos + 1), byte_at(pos + 2));
+        if (bits && !candidate(pos, bits)) return;
+    }
+
+    if (pos >= base) {
+        size_t i = static_cast<size_t>(pos - base);
+#ifdef HAVE_TEDDY
+        i += teddy_ssse3(sigs.teddy_lo, sigs.teddy_hi, data + i, len - i,
+                         [&](size_t j, uint8_t bits) { return candidate(base + i + j, bits); });
+        if (!matched.empty()) return;
+#endif
+        for (; i + 2 < len; ++i) {
+            uint8_t bits = teddy_bits(sigs.teddy_lo, sigs.teddy_hi, data[i], data[i + 1], data[i + 2]);
+            if (bits && !candidate(base + i, bits)) return;
+        }
+        pos = base + i;
+    }
+    next_start = pos;
+}
+
+void benchmark_content_scan(const std::string& dir) {
+    const uint64_t LIMIT = 512ull << 20;
+    std::vector<std::vector<unsigned char>> corpus;
+    uint64_t total = 0;
+
+    std::error_code ec;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(dir, options, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator() && total < LIMIT; it.increment(ec)) {
+        if (it->is_symlink(ec) || !it->is_regular_file(ec)) continue;
+        std::ifstream in(it->path(), std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.empty()) continue;
+        if (data.size() > LIMIT - total) data.resize(LIMIT - total);
+        total += data.size();
+        corpus.push_back(std::move(data));
+    }
+    if (total == 0) {
+        std::cerr << "No files to benchmark under " << dir << std::endl;
+        return;
+    }
+
+    // Same chunking as a scan, so carries and pending matches are exercised
+    size_t found = 0;
+    auto run = [&](bool hash, bool match) {
+        found = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (const auto& data : corpus) {
+            MultiDigest digest(DIGEST_SHA256);
+            SignatureScanner scanner(content_signatures);
+            for (size_t off = 0; off < data.size(); off += READ_CHUNK_SIZE) {
+                size_t n = std::min(READ_CHUNK_SIZE, data.size() - off);
+                if (hash) digest.update(data.data() + off, n);
+                if (match) scanner.update(data.data() + off, n);
+            }
+            FileDigests out;
+            if (hash) digest.finish(out);
+            if (!scanner.result().empty()) found++;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        return static_cast<double>(total) / elapsed.count() / 1e9;
+    };
+
+    std::cout << "Corpus: " << corpus.size() << " files, " << (total >> 20) << " MiB from " << dir << "\n";
+    std::cout << "Signatures: " << content_signatures.size() << " (" << content_signatures.skipped()
+              << " unsupported), " << (content_signatures.uses_teddy() ? "Teddy prefilter" : "Aho-Corasick DFA")
+              << "\n";
+    double sha = run(true, false);
+    std::cout << "SHA-256:              " << sha << " GB/s\n";
+    double sigs = run(false, true);
+    std::cout << "Signatures:           " << sigs << " GB/s, " << found << " files matched\n";
+    double both = run(true, true);
+    std::cout << "SHA-256 + signatures: " << both << " GB/s" << std::endl;
+}
@@ -0,0 +1,116 @@
+#include "verdictcache.h"
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+VerdictCache verdict_cache;
+
+bool FileIdentity::from_fd(int fd, FileIdentity& out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+
+    out.dev = static_cast<uint64_t>(st.st_dev);
+    out.ino = static_cast<uint64_t>(st.st_ino);
+    out.size = static_cast<uint64_t>(st.st_size);
+    out.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    out.ctime_ns = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    out.generation = 0;
+#ifdef __linux__
+    int generation = 0;
+    if (ioctl(fd, FS_IOC_GETVERSION, &generation) == 0)
+        out.generation = static_cast<uint32_t>(generation);
+#endif
+    return true;
+}
+
+uint64_t VerdictCache::key(uint64_t dev, uint64_t ino) {
+    // Mix so that sequential inode numbers spread across shards
+    uint64_t k = ino ^ (dev * 0x9e3779b97f4a7c15ull);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    return k;
+}
+
+static bool same_version(const FileIdentity& a, const FileIdentity& b) {
+    return a.dev == b.dev && a.ino == b.ino && a.generation == b.generation && a.size == b.size &&
+           a.mtime_ns == b.mtime_ns && a.ctime_ns == b.ctime_ns;
+}
+
+bool VerdictCache::lookup(const FileIdentity& id, unsigned algos, FileDigests& out) {
+    uint64_t k = key(id.dev, id.ino);
+    Shard& shard = shards[k % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(k);
+    if (it == shard.entries.end()) return false;
+
+    const Entry& e = it->second;
+    if (!same_version(e.id, id)) return false;
+    if ((e.algos & algos) != algos) return false;
+
+    out = e.digests;
+    return true;
+}
+
+bool VerdictCache::unchanged(const FileIdentity& id) {
+    uint64_t k = key(id.dev, id.ino);
+    Shard& shard = shards[k % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(k);
+    return it != shard.entries.end() && same_version(it->second.id, id);
+}
+
+bool VerdictCache::midstate(const FileIdentity& id, unsigned algos, Midstate& out) {
+    uint64_t k = key(id.dev, id.ino);
+    Shard& shard = shards[k % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(k);
+    if (it == shard.entries.end()) return false;
+
+    const Entry& e = it->second;
+    if (!e.midstate.state || e.id.dev != id.dev || e.id.ino != id.ino ||
+        e.id.generation != id.generation || id.size <= e.id.size)
+        return false;
+    if ((e.midstate.state->algorithms() & algos) != algos) return false;
+
+    out = e.midstate;
+    return true;
+}
+
+void VerdictCache::store(const FileIdentity& id, unsigned algos, const FileDigests& digests,
+                         const Midstate& midstate) {
+    uint64_t k = key(id.dev, id.ino);
+    Shard& shard = shards[k % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // Crude bound on memory: start the shard over rather than track recency
+    if (shard.entries.size() >= MAX_ENTRIES_PER_SHARD) shard.entries.clear();
+
+    Entry& e = shard.entries[k];
+    e.id = id;
+    e.algos = algos;
+    e.digests = digests;
+    e.midstate = midstate;
+}
+
+void VerdictCache::clear() {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+    }
+}
+
+size_t VerdictCache::size() {
+    size_t total = 0;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.entries.size();
+    }
+    return total;
+}
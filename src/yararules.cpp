@@ -0,0 +1,809 @@
+#include "yararules.h"
+#include "scan.h"
+#include "filereader.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+
+RuleSet yara_rules;
+
+// Offsets kept per string and file. Past this a string's hits are only
+// counted, so a flood of hits on a short atom can't grow memory and
+// can't crowd out the hits of other strings.
+static const size_t MAX_OFFSETS_PER_STRING = 1 << 14;
+
+// Piece comparisons allowed when checking one hit of a string with jumps;
+// nested ranges could otherwise take exponential time
+static const size_t MAX_JUMP_STEPS = 1 << 16;
+
+static bool is_ident_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Recursive descent over the rule text. Errors, including anything outside
+// the subset, are thrown as runtime_error and cost the rule they occur in.
+class RuleParser {
+public:
+    RuleParser(RuleSet& rules, const std::string& source) : set(rules), text(source) {}
+
+    void parse_all() {
+        while (skip_space(), pos < text.size()) {
+            size_t start = pos;
+            try {
+                if (accept("import")) {
+                    string_literal();   // modules aren't supported; rules using them fail on their own
+                } else if (accept("include")) {
+                    string_literal();
+                    throw std::runtime_error("include");
+                } else {
+                    parse_rule();
+                }
+            } catch (const std::runtime_error&) {
+                set.unsupported++;
+                skip_to_next_rule(start);
+            }
+        }
+    }
+
+private:
+    using Node = RuleSet::Node;
+    using Op = RuleSet::Op;
+
+    void skip_space() {
+        while (pos < text.size()) {
+            if (std::isspace(static_cast<unsigned char>(text[pos]))) {
+                ++pos;
+            } else if (text.compare(pos, 2, "//") == 0) {
+                pos = text.find('\n', pos);
+                if (pos == std::string::npos) pos = text.size();
+            } else if (text.compare(pos, 2, "/*") == 0) {
+                pos = text.find("*/", pos + 2);
+                pos = pos == std::string::npos ? text.size() : pos + 2;
+            } else {
+                break;
+            }
+        }
+    }
+
+    // Resumes at the next line starting a rule after a failed one
+    void skip_to_next_rule(size_t start) {
+        pos = std::max(pos, start + 1);
+        while ((pos = text.find('\n', pos)) != std::string::npos) {
+            size_t line = ++pos;
+            skip_space();
+            if (accept("private") || accept("global") || accept("rule") || accept("import")) {
+                pos = line;
+                return;
+            }
+            pos = line;
+        }
+        pos = text.size();
+    }
+
+    char peek() {
+        skip_space();
+        return pos < text.size() ? text[pos] : '\0';
+    }
+
+    bool peek_word(const char* word) {
+        size_t saved = pos;
+        bool found = accept(word);
+        pos = saved;
+        return found;
+    }
+
+    // A keyword must not run on into an identifier
+    bool accept(const char* token) {
+        skip_space();
+        size_t len = strlen(token);
+        if (text.compare(pos, len, token) != 0) return false;
+        if (is_ident_char(token[len - 1]) && pos + len < text.size() && is_ident_char(text[pos + len]))
+            return false;
+        pos += len;
+        return true;
+    }
+
+    void expect(const char* token) {
+        if (!accept(token)) throw std::runtime_error(std::string("expected ") + token);
+    }
+
+    std::string identifier() {
+        skip_space();
+        size_t start = pos;
+        while (pos < text.size() && is_ident_char(text[pos])) ++pos;
+        if (start == pos || std::isdigit(static_cast<unsigned char>(text[start])))
+            throw std::runtime_error("expected identifier");
+        return text.substr(start, pos - start);
+    }
+
+    std::string string_literal() {
+        if (peek() != '"') throw std::runtime_error("expected string");
+        std::string out;
+        for (++pos; pos < text.size() && text[pos] != '"'; ++pos) {
+            char c = text[pos];
+            if (c == '\n') break;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (++pos >= text.size()) break;
+            switch (text[pos]) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case 'x': {
+                    if (pos + 2 >= text.size() || !std::isxdigit(static_cast<unsigned char>(text[pos + 1])) ||
+                        !std::isxdigit(static_cast<unsigned char>(text[pos + 2])))
+                        throw std::runtime_error("bad escape");
+                    out += static_cast<char>(std::stoi(text.substr(pos + 1, 2), nullptr, 16));
+                    pos += 2;
+                    break;
+                }
+                default: throw std::runtime_error("bad escape");
+            }
+        }
+        if (pos >= text.size() || text[pos] != '"') throw std::runtime_error("unterminated string");
+        ++pos;
+        return out;
+    }
+
+    int64_t number() {
+        skip_space();
+        size_t start = pos;
+        int base = 10;
+        if (text.compare(pos, 2, "0x") == 0) {
+            base = 16;
+            pos += 2;
+        }
+        size_t digits = pos;
+        while (pos < text.size() && (base == 16 ? std::isxdigit(static_cast<unsigned char>(text[pos]))
+                                                : std::isdigit(static_cast<unsigned char>(text[pos]))))
+            ++pos;
+        if (digits == pos || pos - digits > 15) throw std::runtime_error("expected number");
+        int64_t value = std::stoll(text.substr(digits, pos - digits), nullptr, base);
+        if (text.compare(pos, 2, "KB") == 0) {
+            value *= 1024;
+            pos += 2;
+        } else if (text.compare(pos, 2, "MB") == 0) {
+            value *= 1024 * 1024;
+            pos += 2;
+        }
+        if (pos < text.size() && is_ident_char(text[pos])) {
+            pos = start;
+            throw std::runtime_error("bad number");
+        }
+        return value;
+    }
+
+    void parse_rule() {
+        if (accept("global")) throw std::runtime_error("global rules");
+        RuleSet::Rule rule;
+        rule.is_private = accept("private");
+        if (accept("global")) throw std::runtime_error("global rules");
+        expect("rule");
+        rule.name = identifier();
+        if (set.rule_index.count(rule.name)) throw std::runtime_error("duplicate rule");
+        if (accept(":")) {
+            while (peek() != '{') identifier();     // tags
+        }
+        expect("{");
+
+        strings.clear();
+        string_ids.clear();
+        atoms.clear();
+        if (accept("meta")) {
+            expect(":");
+            while (!peek_word("strings") && !peek_word("condition")) {
+                identifier();
+                expect("=");
+                if (peek() == '"') string_literal();
+                else if (!accept("true") && !accept("false")) {
+                    accept("-");
+                    number();
+                }
+            }
+        }
+        if (accept("strings")) {
+            expect(":");
+            while (peek() == '$') parse_string(rule);
+        }
+        expect("condition");
+        expect(":");
+        rule.root = parse_or(rule);
+        expect("}");
+        commit(std::move(rule));
+    }
+
+    void parse_string(RuleSet::Rule& rule) {
+        expect("$");
+        std::string id = "$";
+        while (pos < text.size() && is_ident_char(text[pos])) id += text[pos++];
+        if (id != "$" && string_ids.count(id)) throw std::runtime_error("duplicate string");
+        expect("=");
+
+        RuleSet::RuleString str;
+        str.id = id;
+        if (peek() == '"') {
+            std::string literal = string_literal();
+            if (literal.empty()) throw std::runtime_error("empty string");
+            bool ascii = false, wide = false;
+            while (!peek_word("condition") && peek() != '$') {
+                std::string modifier = identifier();
+                if (modifier == "ascii") ascii = true;
+                else if (modifier == "wide") wide = true;
+                else if (modifier != "private") throw std::runtime_error("modifier " + modifier);
+            }
+            RuleSet::Piece piece;
+            if (ascii || !wide) {
+                piece.bytes.assign(literal.begin(), literal.end());
+                piece.mask.assign(literal.size(), 0xff);
+                add_atom(rule, id, piece);
+            }
+            if (wide) {
+                // UTF-16LE, as YARA does it: a zero after every byte
+                RuleSet::Piece utf16;
+                for (char c : literal) {
+                    utf16.bytes.push_back(static_cast<uint8_t>(c));
+                    utf16.bytes.push_back(0);
+                }
+                utf16.mask.assign(utf16.bytes.size(), 0xff);
+                add_atom(rule, id, utf16);
+                if (!ascii) piece = utf16;
+            }
+            str.pieces.push_back(std::move(piece));
+        } else if (peek() == '{') {
+            ++pos;
+            hex_string(str);
+            while (!peek_word("condition") && peek() != '$') {
+                if (identifier() != "private") throw std::runtime_error("hex modifier");
+            }
+            add_atom(rule, id, str.pieces[str.anchor]);
+        } else {
+            throw std::runtime_error("regular expressions");
+        }
+
+        if (id != "$") string_ids[id] = static_cast<uint32_t>(strings.size());
+        strings.push_back(std::move(str));
+    }
+
+    // Queues the bytes the automaton looks for on behalf of the next string
+    void add_atom(const RuleSet::Rule& rule, const std::string& id, const RuleSet::Piece& piece) {
+        if (piece.bytes.size() > MAX_PATTERN_LENGTH) throw std::runtime_error("string too long");
+        ContentSignature sig;
+        sig.name = rule.name + ":" + id;
+        sig.bytes = piece.bytes;
+        sig.mask = piece.mask;
+        sig.tag = static_cast<uint32_t>(strings.size());     // local until commit
+        atoms.push_back(std::move(sig));
+    }
+
+    // { 4D 5A ?? [2-4] 50 45 } up to the closing brace
+    void hex_string(RuleSet::RuleString& str) {
+        str.pieces.emplace_back();
+        size_t span = 0;
+        bool after_jump = false;
+        for (;;) {
+            char c = peek();
+            if (c == '}') {
+                ++pos;
+                break;
+            }
+            if (c == '[') {
+                ++pos;
+                if (!after_jump && str.pieces.back().bytes.empty()) throw std::runtime_error("jump at start");
+                int64_t low = number();
+                int64_t high = low;
+                if (accept("-")) high = number();     // "[n-]" fails here: open jumps are unbounded
+                expect("]");
+                if (low < 0 || high < low || high > static_cast<int64_t>(MAX_STRING_SPAN))
+                    throw std::runtime_error("bad jump");
+                if (!after_jump) str.pieces.emplace_back();
+                str.pieces.back().min_gap += static_cast<uint32_t>(low);
+                str.pieces.back().max_gap += static_cast<uint32_t>(high);
+                span += static_cast<size_t>(high);
+                after_jump = true;
+                continue;
+            }
+            if (pos + 1 >= text.size()) throw std::runtime_error("unterminated hex string");
+            RuleSet::Piece& piece = str.pieces.back();
+            if (text[pos] == '?' && text[pos + 1] == '?') {
+                piece.bytes.push_back(0);
+                piece.mask.push_back(0);
+            } else if (std::isxdigit(static_cast<unsigned char>(text[pos])) &&
+                       std::isxdigit(static_cast<unsigned char>(text[pos + 1]))) {
+                piece.bytes.push_back(static_cast<uint8_t>(std::stoi(text.substr(pos, 2), nullptr, 16)));
+                piece.mask.push_back(0xff);
+            } else {
+                throw std::runtime_error("hex syntax");     // alternatives, nibbles, ~
+            }
+            pos += 2;
+            span++;
+            after_jump = false;
+            if (piece.bytes.size() > MAX_PATTERN_LENGTH || span > MAX_STRING_SPAN)
+                throw std::runtime_error("hex string too long");
+        }
+        if (after_jump || str.pieces.front().bytes.empty()) throw std::runtime_error("bad jump");
+
+        // The piece with the longest literal run is searched for
+        size_t best = 0;
+        for (size_t i = 0; i < str.pieces.size(); ++i) {
+            size_t run = 0;
+            for (uint8_t m : str.pieces[i].mask) {
+                run = m ? run + 1 : 0;
+                if (run > best) {
+                    best = run;
+                    str.anchor = static_cast<uint32_t>(i);
+                }
+            }
+        }
+        if (best == 0) throw std::runtime_error("no literal bytes");
+    }
+
+    int node(RuleSet::Rule& rule, Op op, int a = -1, int b = -1, int64_t value = 0) {
+        Node n;
+        n.op = op;
+        n.a = a;
+        n.b = b;
+        n.value = value;
+        rule.nodes.push_back(std::move(n));
+        return static_cast<int>(rule.nodes.size() - 1);
+    }
+
+    int parse_or(RuleSet::Rule& rule) {
+        int left = parse_and(rule);
+        while (accept("or")) left = node(rule, Op::Or, left, parse_and(rule));
+        return left;
+    }
+
+    int parse_and(RuleSet::Rule& rule) {
+        int left = parse_not(rule);
+        while (accept("and")) left = node(rule, Op::And, left, parse_not(rule));
+        return left;
+    }
+
+    int parse_not(RuleSet::Rule& rule) {
+        if (accept("not")) return node(rule, Op::Not, parse_not(rule));
+        int left = parse_sum(rule);
+        static const std::pair<const char*, Op> COMPARISONS[] = {
+            {"==", Op::Eq}, {"!=", Op::Ne}, {"<=", Op::Le}, {">=", Op::Ge}, {"<", Op::Lt}, {">", Op::Gt}};
+        for (const auto& cmp : COMPARISONS)
+            if (accept(cmp.first)) return node(rule, cmp.second, left, parse_sum(rule));
+        return left;
+    }
+
+    int parse_sum(RuleSet::Rule& rule) {
+        int left = parse_primary(rule);
+        for (;;) {
+            if (accept("+")) left = node(rule, Op::Add, left, parse_primary(rule));
+            else if (accept("-"))
+                left = node(rule, Op::Sub, left, parse_primary(rule));
+            else return left;
+        }
+    }
+
+    uint32_t string_ref(const std::string& id) {
+        auto it = string_ids.find(id);
+        if (it == string_ids.end()) throw std::runtime_error("unknown string " + id);
+        return it->second;
+    }
+
+    // "them", or a parenthesised list of $ids and $prefix* patterns
+    std::vector<uint32_t> string_set() {
+        std::vector<uint32_t> set_strings;
+        if (accept("them")) {
+            for (uint32_t i = 0; i < strings.size(); ++i) set_strings.push_back(i);
+            return set_strings;
+        }
+        expect("(");
+        do {
+            expect("$");
+            std::string id = "$";
+            while (pos < text.size() && is_ident_char(text[pos])) id += text[pos++];
+            if (pos < text.size() && text[pos] == '*') {
+                ++pos;
+                for (const auto& entry : string_ids)
+                    if (entry.first.compare(0, id.size(), id) == 0) set_strings.push_back(entry.second);
+            } else {
+                set_strings.push_back(string_ref(id));
+            }
+        } while (accept(","));
+        expect(")");
+        std::sort(set_strings.begin(), set_strings.end());
+        set_strings.erase(std::unique(set_strings.begin(), set_strings.end()), set_strings.end());
+        if (set_strings.empty()) throw std::runtime_error("empty string set");
+        return set_strings;
+    }
+
+    int of_node(RuleSet::Rule& rule, int64_t count) {
+        std::vector<uint32_t> set_strings = string_set();
+        if (count < 0) count = static_cast<int64_t>(set_strings.size());
+        int n = node(rule, Op::Of, -1, -1, count);
+        rule.nodes[n].strings = std::move(set_strings);
+        return n;
+    }
+
+    int parse_primary(RuleSet::Rule& rule) {
+        char c = peek();
+        if (c == '(') {
+            ++pos;
+            int inner = parse_or(rule);
+            expect(")");
+            return inner;
+        }
+        if (c == '#') {
+            ++pos;
+            std::string id = "#";
+            while (pos < text.size() && is_ident_char(text[pos])) id += text[pos++];
+            return node(rule, Op::Count, -1, -1, string_ref("$" + id.substr(1)));
+        }
+        if (c == '@') {
+            ++pos;
+            std::string id = "@";
+            while (pos < text.size() && is_ident_char(text[pos])) id += text[pos++];
+            int64_t index = string_ref("$" + id.substr(1));
+            expect("[");
+            int i = parse_sum(rule);
+            expect("]");
+            return node(rule, Op::Offset, i, -1, index);
+        }
+        if (c == '$') {
+            ++pos;
+            std::string id = "$";
+            while (pos < text.size() && is_ident_char(text[pos])) id += text[pos++];
+            int64_t index = string_ref(id);
+            if (accept("at")) return node(rule, Op::FoundAt, parse_sum(rule), -1, index);
+            if (accept("in")) {
+                expect("(");
+                int low = parse_sum(rule);
+                expect("..");
+                int high = parse_sum(rule);
+                expect(")");
+                return node(rule, Op::FoundIn, low, high, index);
+            }
+            return node(rule, Op::Found, -1, -1, index);
+        }
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            int64_t value = number();
+            if (accept("of")) return of_node(rule, value);
+            return node(rule, Op::Const, -1, -1, value);
+        }
+        if (accept("true")) return node(rule, Op::Const, -1, -1, 1);
+        if (accept("false")) return node(rule, Op::Const, -1, -1, 0);
+        if (accept("filesize")) return node(rule, Op::Filesize);
+        if (accept("any")) {
+            expect("of");
+            return of_node(rule, 1);
+        }
+        if (accept("all")) {
+            expect("of");
+            return of_node(rule, -1);
+        }
+        if (accept("none")) {
+            expect("of");
+            return node(rule, Op::Not, of_node(rule, 1));
+        }
+        static const std::pair<const char*, int> READERS[] = {
+            {"uint8", 1}, {"uint16", 2}, {"uint32", 4}, {"uint8be", -1}, {"uint16be", -2}, {"uint32be", -4}};
+        for (const auto& reader : READERS) {
+            if (!accept(reader.first)) continue;
+            expect("(");
+            int offset = parse_or(rule);
+            expect(")");
+            return node(rule, Op::Uint, offset, -1, reader.second);
+        }
+
+        // Only rules declared before this one can be referenced
+        std::string name = identifier();
+        auto it = set.rule_index.find(name);
+        if (it == set.rule_index.end() || peek() == '.' || peek() == '(')
+            throw std::runtime_error("unsupported identifier " + name);
+        return node(rule, Op::RuleRef, -1, -1, it->second);
+    }
+
+    // True if the condition is false whenever none of the rule's strings
+    // were found, so the rule can wait for an atom hit
+    static bool needs_hit(const RuleSet::Rule& rule, int n) {
+        const Node& node = rule.nodes[n];
+        auto count_at_least_one = [&](int count, int bound, int64_t min) {
+            return rule.nodes[count].op == Op::Count && rule.nodes[bound].op == Op::Const &&
+                   rule.nodes[bound].value >= min;
+        };
+        switch (node.op) {
+            case Op::Found: case Op::FoundAt: case Op::FoundIn: return true;
+            case Op::Of: return node.value >= 1;
+            case Op::And: return needs_hit(rule, node.a) || needs_hit(rule, node.b);
+            case Op::Or: return needs_hit(rule, node.a) && needs_hit(rule, node.b);
+            case Op::Gt: return count_at_least_one(node.a, node.b, 0);
+            case Op::Ge: case Op::Eq: return count_at_least_one(node.a, node.b, 1);
+            default: return false;
+        }
+    }
+
+    // Moves the rule and its strings into the set, renumbering string
+    // references from rule-local to set-wide
+    void commit(RuleSet::Rule rule) {
+        const uint32_t base = static_cast<uint32_t>(set.strings.size());
+        const uint32_t index = static_cast<uint32_t>(set.rules.size());
+        for (auto& n : rule.nodes) {
+            if (n.op == Op::Count || n.op == Op::Offset || n.op == Op::Found || n.op == Op::FoundAt ||
+                n.op == Op::FoundIn)
+                n.value += base;
+            for (auto& s : n.strings) s += base;
+        }
+        for (auto& str : strings) {
+            str.rule = index;
+            rule.strings.push_back(static_cast<uint32_t>(set.strings.size()));
+            set.strings.push_back(std::move(str));
+        }
+        for (auto& atom : atoms) {
+            atom.tag += base;
+            set.atoms.add(std::move(atom));
+        }
+        rule.needs_hit = needs_hit(rule, rule.root);
+        if (!rule.needs_hit) set.always_evaluate.push_back(index);
+        set.rule_index[rule.name] = index;
+        set.rules.push_back(std::move(rule));
+    }
+
+    RuleSet& set;
+    const std::string& text;
+    size_t pos = 0;
+
+    // The rule being parsed
+    std::vector<RuleSet::RuleString> strings;
+    std::unordered_map<std::string, uint32_t> string_ids;
+    std::vector<ContentSignature> atoms;
+};
+
+bool RuleSet::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        msg = "Error opening file: " + filename;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    for (unsigned char c : text) {
+        key ^= c;
+        key *= 1099511628211ull;
+    }
+    RuleParser(*this, text).parse_all();
+    return true;
+}
+
+void RuleSet::compile(const std::string& cache_file) {
+    atoms.compile(cache_file);
+    key ^= atoms.generation();
+}
+
+RuleScanner::RuleScanner(const RuleSet& rules) : set(rules), scanner(rules.atoms) {
+    scanner.report_all([this](const ContentSignature& sig, uint64_t start) {
+        StringHits& string_hits = hits[sig.tag];
+        string_hits.count++;
+        if (string_hits.offsets.size() < MAX_OFFSETS_PER_STRING) string_hits.offsets.push_back(start);
+    });
+}
+
+void RuleScanner::update(const unsigned char* data, size_t len) {
+    scanner.update(data, len);
+}
+
+// What evaluating the candidate rules for one file has worked out so far
+struct RuleScanner::Context {
+    const RuleSet& set;
+    const RangeReader& reader;
+    uint64_t size;
+    const std::unordered_map<uint32_t, StringHits>& hits;
+    std::unordered_map<uint32_t, std::vector<uint64_t>> matches;
+    std::unordered_map<uint32_t, bool> results;
+
+    bool read(uint64_t offset, uint64_t end, std::vector<unsigned char>& out) {
+        out.clear();
+        return reader && reader(offset, std::min(end, size), out);
+    }
+
+    static bool piece_at(const RuleSet::Piece& piece, const std::vector<unsigned char>& window,
+                         uint64_t window_start, uint64_t pos) {
+        if (pos < window_start || pos - window_start + piece.bytes.size() > window.size()) return false;
+        const unsigned char* p = window.data() + (pos - window_start);
+        for (size_t i = 0; i < piece.bytes.size(); ++i)
+            if ((p[i] ^ piece.bytes[i]) & piece.mask[i]) return false;
+        return true;
+    }
+
+    // Where the string starts if its anchor piece at `anchor_pos` is part
+    // of a full match, trying every jump length
+    std::optional<uint64_t> verify_jumps(const RuleSet::RuleString& str, uint64_t anchor_pos) {
+        const auto& pieces = str.pieces;
+        uint64_t before = 0, after = 0;
+        for (size_t i = 0; i < str.anchor; ++i) before += pieces[i].bytes.size() + pieces[i + 1].max_gap;
+        for (size_t i = str.anchor; i < pieces.size(); ++i)
+            after += pieces[i].bytes.size() + (i > str.anchor ? pieces[i].max_gap : 0);
+
+        uint64_t window_start = anchor_pos > before ? anchor_pos - before : 0;
+        std::vector<unsigned char> window;
+        if (!read(window_start, anchor_pos + after, window)) return std::nullopt;
+
+        size_t steps = 0;
+        std::function<bool(size_t, uint64_t)> right = [&](size_t i, uint64_t pos) {
+            if (i == pieces.size()) return true;
+            for (uint64_t g = pieces[i].min_gap; g <= pieces[i].max_gap && steps++ < MAX_JUMP_STEPS; ++g)
+                if (piece_at(pieces[i], window, window_start, pos + g) &&
+                    right(i + 1, pos + g + pieces[i].bytes.size()))
+                    return true;
+            return false;
+        };
+        std::function<std::optional<uint64_t>(size_t, uint64_t)> left = [&](size_t i, uint64_t end)
+            -> std::optional<uint64_t> {
+            for (uint64_t g = pieces[i + 1].min_gap; g <= pieces[i + 1].max_gap && steps++ < MAX_JUMP_STEPS; ++g) {
+                if (end < g + pieces[i].bytes.size()) break;
+                uint64_t pos = end - g - pieces[i].bytes.size();
+                if (!piece_at(pieces[i], window, window_start, pos)) continue;
+                if (i == 0) return pos;
+                if (auto start = left(i - 1, pos)) return start;
+            }
+            return std::nullopt;
+        };
+
+        if (!piece_at(pieces[str.anchor], window, window_start, anchor_pos) ||
+            !right(str.anchor + 1, anchor_pos + pieces[str.anchor].bytes.size()))
+            return std::nullopt;
+        if (str.anchor == 0) return anchor_pos;
+        return left(str.anchor - 1, anchor_pos);
+    }
+
+    // Sorted start offsets of a string's first matches, from the hits whose
+    // offsets were kept, worked out on first use
+    const std::vector<uint64_t>& matches_of(uint32_t index) {
+        auto found = matches.find(index);
+        if (found != matches.end()) return found->second;
+
+        std::vector<uint64_t>& out = matches[index];
+        auto string_hits = hits.find(index);
+        if (string_hits == hits.end()) return out;
+        const RuleSet::RuleString& str = set.strings[index];
+        for (uint64_t anchor_pos : string_hits->second.offsets) {
+            if (str.pieces.size() == 1) {
+                out.push_back(anchor_pos);
+            } else if (auto start = verify_jumps(str, anchor_pos)) {
+                out.push_back(*start);
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+
+    // Number of matches of a string. A hit on a string without jumps is a
+    // match whether or not its offset was kept; one with jumps can only be
+    // verified from a kept offset.
+    uint64_t count_of(uint32_t index) {
+        uint64_t count = matches_of(index).size();
+        auto string_hits = hits.find(index);
+        if (string_hits != hits.end() && set.strings[index].pieces.size() == 1)
+            count += string_hits->second.count - string_hits->second.offsets.size();
+        return count;
+    }
+
+    std::optional<int64_t> read_uint(int64_t offset, int width) {
+        size_t bytes = static_cast<size_t>(std::abs(width));
+        if (offset < 0 || static_cast<uint64_t>(offset) + bytes > size) return std::nullopt;
+        std::vector<unsigned char> data;
+        if (!read(static_cast<uint64_t>(offset), static_cast<uint64_t>(offset) + bytes, data) || data.size() != bytes)
+            return std::nullopt;
+        int64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            value |= static_cast<int64_t>(data[width > 0 ? i : bytes - 1 - i]) << (8 * i);
+        return value;
+    }
+
+    static bool truthy(const std::optional<int64_t>& v) { return v && *v != 0; }
+
+    // Undefined values (reads past the end) make the enclosing test false
+    std::optional<int64_t> eval(const RuleSet::Rule& rule, int n) {
+        using Op = RuleSet::Op;
+        const RuleSet::Node& node = rule.nodes[n];
+        switch (node.op) {
+            case Op::Const: return node.value;
+            case Op::Filesize: return static_cast<int64_t>(size);
+            case Op::Uint: {
+                auto offset = eval(rule, node.a);
+                if (!offset) return std::nullopt;
+                return read_uint(*offset, static_cast<int>(node.value));
+            }
+            case Op::Count: return static_cast<int64_t>(count_of(static_cast<uint32_t>(node.value)));
+            case Op::Offset: {
+                // 1-based; undefined past the last match, or past the kept offsets
+                auto i = eval(rule, node.a);
+                const auto& list = matches_of(static_cast<uint32_t>(node.value));
+                if (!i || *i < 1 || static_cast<uint64_t>(*i) > list.size()) return std::nullopt;
+                return static_cast<int64_t>(list[static_cast<size_t>(*i - 1)]);
+            }
+            case Op::Found: return matches_of(static_cast<uint32_t>(node.value)).empty() ? 0 : 1;
+            case Op::FoundAt: {
+                auto at = eval(rule, node.a);
+                if (!at || *at < 0) return 0;
+                const auto& list = matches_of(static_cast<uint32_t>(node.value));
+                return std::binary_search(list.begin(), list.end(), static_cast<uint64_t>(*at)) ? 1 : 0;
+            }
+            case Op::FoundIn: {
+                auto low = eval(rule, node.a), high = eval(rule, node.b);
+                if (!low || !high || *high < 0) return 0;
+                const auto& list = matches_of(static_cast<uint32_t>(node.value));
+                auto it = std::lower_bound(list.begin(), list.end(), static_cast<uint64_t>(std::max<int64_t>(*low, 0)));
+                return it != list.end() && *it <= static_cast<uint64_t>(*high) ? 1 : 0;
+            }
+            case Op::Of: {
+                int64_t found = 0;
+                for (uint32_t s : node.strings)
+                    if (!matches_of(s).empty() && ++found >= node.value) return 1;
+                return 0;
+            }
+            case Op::RuleRef: return rule_matches(static_cast<uint32_t>(node.value)) ? 1 : 0;
+            case Op::Not: {
+                auto v = eval(rule, node.a);
+                if (!v) return std::nullopt;
+                return *v == 0 ? 1 : 0;
+            }
+            case Op::And: return truthy(eval(rule, node.a)) && truthy(eval(rule, node.b)) ? 1 : 0;
+            case Op::Or: return truthy(eval(rule, node.a)) || truthy(eval(rule, node.b)) ? 1 : 0;
+            default: break;
+        }
+
+        auto a = eval(rule, node.a), b = eval(rule, node.b);
+        if (!a || !b) return std::nullopt;
+        switch (node.op) {
+            case Op::Add: return *a + *b;
+            case Op::Sub: return *a - *b;
+            case Op::Eq: return *a == *b ? 1 : 0;
+            case Op::Ne: return *a != *b ? 1 : 0;
+            case Op::Lt: return *a < *b ? 1 : 0;
+            case Op::Le: return *a <= *b ? 1 : 0;
+            case Op::Gt: return *a > *b ? 1 : 0;
+            case Op::Ge: return *a >= *b ? 1 : 0;
+            default: return std::nullopt;
+        }
+    }
+
+    bool rule_matches(uint32_t index) {
+        auto it = results.find(index);
+        if (it != results.end()) return it->second;
+        const RuleSet::Rule& rule = set.rules[index];
+        bool result = truthy(eval(rule, rule.root));
+        results[index] = result;
+        return result;
+    }
+};
+
+std::string RuleScanner::evaluate(int fd, uint64_t size) {
+    return evaluate([fd](uint64_t offset, uint64_t end, std::vector<unsigned char>& out) {
+        return read_fd_chunks(fd, offset, end, [&](const unsigned char* data, size_t len) {
+            out.insert(out.end(), data, data + len);
+            return true;
+        }) == ReadStatus::Ok;
+    }, size);
+}
+
+std::string RuleScanner::evaluate(const RangeReader& read, uint64_t size) {
+    if (set.rules.empty()) return "";
+
+    // Only rules whose strings were seen, plus those that don't need any
+    std::vector<uint32_t> candidates = set.always_evaluate;
+    for (const auto& entry : hits) candidates.push_back(set.strings[entry.first].rule);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    Context context{set, read, size, hits, {}, {}};
+    for (uint32_t index : candidates) {
+        if (!set.rules[index].is_private && context.rule_matches(index)) return set.rules[index].name;
+    }
+    return "";
+}